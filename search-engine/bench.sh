@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# Бенчмарк пайплайна на синтетическом корпусе (src/pipeline_bench.cpp).
+# Параметры передаются bin/pipeline_bench как есть, например:
+#   ./bench.sh --docs 100000 --positions
+# Каждый прогон дописывается строкой JSON в results/bench_history.jsonl
+# и сравнивается с предыдущим прогоном с теми же параметрами.
+
+echo "БЕНЧМАРК ПАЙПЛАЙНА"
+echo "=================="
+
+./compile.sh > /dev/null || { echo "Ошибка компиляции"; exit 1; }
+mkdir -p results data
+
+label=$(git rev-parse --short HEAD 2>/dev/null || echo "local")
+if ! git diff --quiet HEAD -- src 2>/dev/null; then
+    label="$label+dirty"
+fi
+
+history=results/bench_history.jsonl
+baseline=()
+[ -s "$history" ] && baseline=(--baseline "$history")
+
+./bin/pipeline_bench --label "$label" --json results/bench.json "${baseline[@]}" "$@" || exit 1
+cat results/bench.json >> "$history"
+echo "История прогонов: $history"
@@ -5,7 +5,7 @@ echo "================================="
 
 
 echo "1. Компиляция токенизатора..."
-g++ -std=c++11 -O2 src/tokenizer.cpp -o bin/tokenizer
+g++ -std=c++17 -O2 -pthread src/tokenizer.cpp -o bin/tokenizer
 if [ $? -eq 0 ]; then
     echo "Успешно"
 else
@@ -14,7 +14,7 @@ else
 fi
 
 echo "2. Компиляция стеммера..."
-g++ -std=c++11 -O2 src/simple_stemmer.cpp -o bin/stemmer
+g++ -std=c++17 -O2 src/simple_stemmer.cpp -o bin/stemmer
 if [ $? -eq 0 ]; then
     echo "Успешно"
 else
@@ -23,7 +23,7 @@ else
 fi
 
 echo "3. Компиляция построителя булева индекса..."
-g++ -std=c++11 -O2 src/boolean_index.cpp -o bin/index_builder
+g++ -std=c++17 -O2 -pthread src/boolean_index.cpp -o bin/index_builder
 if [ $? -eq 0 ]; then
     echo "Успешно"
 else
@@ -32,7 +32,34 @@ else
 fi
 
 echo "4. Компиляция булева поиска..."
-g++ -std=c++11 -O2 src/boolean_search.cpp -o bin/search
+g++ -std=c++17 -O2 -pthread src/boolean_search.cpp -o bin/search
+if [ $? -eq 0 ]; then
+    echo "Успешно"
+else
+    echo "Ошибка"
+    exit 1
+fi
+
+echo "5. Компиляция бенчмарка posting-кодека..."
+g++ -std=c++17 -O2 src/codec_bench.cpp -o bin/codec_bench
+if [ $? -eq 0 ]; then
+    echo "Успешно"
+else
+    echo "Ошибка"
+    exit 1
+fi
+
+echo "6. Компиляция бенчмарка словаря термов..."
+g++ -std=c++17 -O2 src/dict_bench.cpp -o bin/dict_bench
+if [ $? -eq 0 ]; then
+    echo "Успешно"
+else
+    echo "Ошибка"
+    exit 1
+fi
+
+echo "7. Компиляция бенчмарка пайплайна..."
+g++ -std=c++17 -O2 src/pipeline_bench.cpp -o bin/pipeline_bench
 if [ $? -eq 0 ]; then
     echo "Успешно"
 else
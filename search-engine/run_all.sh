@@ -21,7 +21,7 @@ python3 src/zipf_analyzer.py results/frequencies.csv
 echo ""
 echo "3. ПОСТРОЕНИЕ БУЛЕВА ИНДЕКСА"
 echo "Создание инвертированного индекса..."
-./bin/index_builder data/corpus.txt data/boolean_index.idx
+./bin/index_builder --binary data/corpus.txt data/boolean_index.idx
 
 
 echo ""
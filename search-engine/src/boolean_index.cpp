@@ -6,166 +6,249 @@
 #include <cctype>
 #include <chrono>
 #include <sstream>
+#include <thread>
+#include <functional>
+#include <queue>
+#include <cstdio>
+#include <unordered_map>
+
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "dump_scanner.h"
+#include "index_format.h"
+#include "mapped_file.h"
+#include "posting_arena.h"
+#include "segment_index.h"
+#include "stemmer.h"
+#include "term_dictionary.h"
+#include "text_tokenizer.h"
 
 using namespace std;
 
-static inline void ltrim(string& s) {
-    size_t i = 0;
-    while (i < s.size() && (s[i] == ' ' || s[i] == '\t')) i++;
-    if (i) s.erase(0, i);
+static inline void sanitize(string& s) {
+    for (char& c : s) {
+        if (c == '|' || c == '\r' || c == '\n') c = ' ';
+    }
 }
 
-static inline void rtrim(string& s) {
-    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r' || s.back() == '\n')) {
-        s.pop_back();
+// Терм токена; при stem — основа, укороченная на месте в scratch.lower.
+static inline string_view termOf(TokenScratch& scratch, string_view t, bool stem) {
+    if (!stem) return t;
+    char* p = &scratch.lower[(size_t)(t.data() - scratch.lower.data())];
+    return string_view(p, stemInPlace(p, t.size()));
+}
+
+// Уникальные термы текста по возрастанию и их частоты; термы указывают
+// в scratch. Возвращает длину текста в токенах.
+static uint32_t tokenizeTerms(string_view text, TokenScratch& scratch, bool stem, vector<string_view>& terms,
+                              vector<int>& freqs) {
+    terms.clear();
+    freqs.clear();
+    forEachToken(text, scratch, [&](string_view t) { terms.push_back(termOf(scratch, t, stem)); });
+    uint32_t length = (uint32_t)terms.size();
+    sort(terms.begin(), terms.end());
+    size_t n = 0;
+    for (size_t i = 0; i < terms.size();) {
+        size_t j = i + 1;
+        while (j < terms.size() && terms[j] == terms[i]) ++j;
+        terms[n++] = terms[i];
+        freqs.push_back((int)(j - i));
+        i = j;
     }
+    terms.resize(n);
+    return length;
 }
 
-static inline void trim(string& s) {
-    if (s.size() >= 3 &&
-        (unsigned char)s[0] == 0xEF &&
-        (unsigned char)s[1] == 0xBB &&
-        (unsigned char)s[2] == 0xBF) {
-        s.erase(0, 3);
+// То же с позициями: positions — номера вхождений каждого терма (среди
+// токенов длиной от MIN_TOKEN_LENGTH) подряд, в порядке terms.
+static uint32_t tokenizeTermPositions(string_view text, TokenScratch& scratch, bool stem,
+                                      vector<pair<string_view, uint32_t>>& occ, vector<string_view>& terms,
+                                      vector<int>& freqs, vector<uint32_t>& positions) {
+    occ.clear();
+    terms.clear();
+    freqs.clear();
+    positions.clear();
+    forEachToken(text, scratch, [&](string_view t) { occ.emplace_back(termOf(scratch, t, stem), (uint32_t)occ.size()); });
+    sort(occ.begin(), occ.end());
+    for (size_t i = 0; i < occ.size();) {
+        size_t j = i;
+        for (; j < occ.size() && occ[j].first == occ[i].first; ++j) positions.push_back(occ[j].second);
+        terms.push_back(occ[i].first);
+        freqs.push_back((int)(j - i));
+        i = j;
     }
-    rtrim(s);
-    ltrim(s);
+    return (uint32_t)occ.size();
 }
 
-static inline bool safeGetline(ifstream& f, string& s) {
-    if (!getline(f, s)) return false;
-    trim(s);
-    return true;
+// Превью — первые 200 байт текста, склеенного из непустых строк через пробел.
+static void makePreview(string_view body, string& preview) {
+    preview.clear();
+    forEachContentLine(body, [&](string_view line) {
+        preview.append(line.data(), line.size());
+        preview += ' ';
+        return preview.size() < 200;
+    });
+    if (preview.size() > 200) preview.resize(200);
+    for (char& c : preview) {
+        if (c == '\n' || c == '\r') c = ' ';
+    }
 }
 
-static inline string sanitize(string s) {
-    for (char& c : s) {
-        if (c == '|' || c == '\r' || c == '\n') c = ' ';
+// Копия строки в пуле с заменой разделителей формата (как sanitize).
+static string_view poolClean(TermArena& pool, string_view s) {
+    char* dst = pool.allocate(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        dst[i] = c == '|' || c == '\r' || c == '\n' ? ' ' : c;
     }
-    return s;
+    return string_view(dst, s.size());
 }
 
+// Термы документов и их posting-листы на время построения: словарь
+// термов с ключами в арене и цепочки постингов в PostingArena. Память
+// освобождается целиком в clear().
 class SimpleHashMap {
 private:
-    struct Node {
-        string key;
-        vector<int> values;
-        Node* next;
-        Node(const string& k) : key(k), next(nullptr) {}
-    };
-
-    static const int TABLE_SIZE = 1000000;
-    Node** table;
-
-    unsigned int hashStr(const string& str) const {
-        unsigned int h = 5381;
-        for (unsigned char c : str) {
-            h = ((h << 5) + h) + c;
-        }
-        return h % TABLE_SIZE;
-    }
+    TermDictionary<PostingChain> dict;
+    PostingArena postings;
+    bool positional = false;
 
 public:
-    SimpleHashMap() {
-        table = new Node*[TABLE_SIZE]();
-    }
+    void setPositional(bool on) { positional = on; }
+    size_t size() const { return dict.size(); }
+    size_t memoryBytes() const { return dict.memoryBytes() + postings.memoryBytes(); }
 
-    ~SimpleHashMap() {
-        for (int i = 0; i < TABLE_SIZE; ++i) {
-            Node* node = table[i];
-            while (node) {
-                Node* tmp = node;
-                node = node->next;
-                delete tmp;
-            }
+    // Возвращает true, если терм встретился впервые. Терм добавляется не
+    // больше одного раза на документ, doc_id по возрастанию. pos — tf
+    // позиций вхождений (для позиционного индекса).
+    bool add(string_view key, int doc_id, int tf = 1, const uint32_t* pos = nullptr) {
+        bool fresh;
+        PostingChain& c = dict.value(dict.insert(key, fresh));
+        postings.append(c, (uint32_t)doc_id);
+        postings.append(c, (uint32_t)tf);
+        if (positional) {
+            for (int i = 0; i < tf; ++i) postings.append(c, pos[i]);
         }
-        delete[] table;
+        ++c.count;
+        return fresh;
     }
 
-    void add(const string& key, int doc_id) {
-        unsigned int h = hashStr(key);
-        Node* node = table[h];
-        while (node) {
-            if (node->key == key) {
-                if (node->values.empty() || node->values.back() != doc_id)
-                    node->values.push_back(doc_id);
-                return;
+    // Переносит термы другой таблицы, сдвигая doc_id на doc_offset.
+    void mergeFrom(const SimpleHashMap& other, int doc_offset) {
+        for (uint32_t i = 0; i < other.dict.size(); ++i) {
+            const PostingChain& src = other.dict.value(i);
+            PostingChain& dst = dict[other.dict.key(i)];
+            PostingArena::Reader r(other.postings, src);
+            for (uint32_t k = 0; k < src.count; ++k) {
+                postings.append(dst, r.next() + (uint32_t)doc_offset);
+                uint32_t tf = r.next();
+                postings.append(dst, tf);
+                if (positional) {
+                    for (uint32_t j = 0; j < tf; ++j) postings.append(dst, r.next());
+                }
             }
-            node = node->next;
+            dst.count += src.count;
         }
-        Node* n = new Node(key);
-        n->values.push_back(doc_id);
-        n->next = table[h];
-        table[h] = n;
     }
 
-    vector<int> get(const string& key) const {
-        unsigned int h = hashStr(key);
-        Node* node = table[h];
-        while (node) {
-            if (node->key == key) return node->values;
-            node = node->next;
+    // Обходит термы по возрастанию ключа: f(key, list) для каждого.
+    // list переиспользуется между вызовами.
+    template <class F>
+    bool forEachSorted(F f) const {
+        PostingList l;
+        for (uint32_t i : dict.sortedOrder()) {
+            const PostingChain& c = dict.value(i);
+            l.docs.resize(c.count);
+            l.freqs.resize(c.count);
+            l.positions.clear();
+            PostingArena::Reader r(postings, c);
+            for (uint32_t k = 0; k < c.count; ++k) {
+                l.docs[k] = (int)r.next();
+                l.freqs[k] = (int)r.next();
+                if (positional) {
+                    for (int j = 0; j < l.freqs[k]; ++j) l.positions.push_back(r.next());
+                }
+            }
+            if (!f(dict.key(i), l)) return false;
         }
-        return {};
+        return true;
     }
 
-    vector<pair<string, vector<int>>> getAll() const {
-        vector<pair<string, vector<int>>> r;
-        for (int i = 0; i < TABLE_SIZE; ++i) {
-            Node* node = table[i];
-            while (node) {
-                r.push_back({node->key, node->values});
-                node = node->next;
-            }
-        }
-        return r;
+    void clear() {
+        dict.clear();
+        postings.clear();
     }
 };
 
+// Документы и термы, построенные в памяти. Заголовки и превью (уже
+// очищенные от разделителей формата) лежат в пуле строк, тексты
+// (--store-text) указывают прямо в отображённый дамп: он должен жить до
+// записи индекса.
 class BooleanIndex {
 private:
     SimpleHashMap index;
-    vector<string> titles;
-    vector<string> previews;
-
-    vector<string> tokenize_unique(const string& text) {
-        vector<string> t;
-        string cur;
-        for (unsigned char c : text) {
-            if (isalnum(c)) cur.push_back((char)tolower(c));
-            else {
-                if (cur.size() >= 2) t.push_back(cur);
-                cur.clear();
-            }
-        }
-        if (cur.size() >= 2) t.push_back(cur);
-        sort(t.begin(), t.end());
-        t.erase(unique(t.begin(), t.end()), t.end());
-        return t;
-    }
+    TermArena strings;
+    vector<string_view> titles;
+    vector<string_view> previews;
+    vector<string_view> texts;
+    vector<uint32_t> lengths;
+    bool positional = false;
+    bool stemmed = false;
+    bool store_text = false;
+    TokenScratch scratch;
+    vector<string_view> toks;
+    vector<int> freqs;
+    vector<uint32_t> positions;
+    vector<pair<string_view, uint32_t>> occurrences;
+    string preview;
 
 public:
-    void addDocument(int id, const string& title, const string& content) {
+    int documentCount() const { return (int)titles.size(); }
+
+    // Хранить позиции термов (только для бинарного индекса).
+    void setPositional(bool on) {
+        positional = on;
+        index.setPositional(on);
+    }
+
+    // Стемминг термов (только для бинарного индекса).
+    void setStemming(bool on) { stemmed = on; }
+
+    // Хранить тексты документов (только для бинарного индекса).
+    void setStoreText(bool on) { store_text = on; }
+
+    void append(BooleanIndex&& part) {
+        int offset = (int)titles.size();
+        for (string_view t : part.titles) titles.push_back(string_view(strings.copy(t), t.size()));
+        for (string_view p : part.previews) previews.push_back(string_view(strings.copy(p), p.size()));
+        if (store_text) texts.insert(texts.end(), part.texts.begin(), part.texts.end());
+        lengths.insert(lengths.end(), part.lengths.begin(), part.lengths.end());
+        index.mergeFrom(part.index, offset);
+        part.clear();
+    }
+
+    void addDocument(int id, string_view title, string_view body) {
         if ((int)titles.size() <= id) titles.resize(id + 1);
         if ((int)previews.size() <= id) previews.resize(id + 1);
+        if ((int)lengths.size() <= id) lengths.resize(id + 1);
+        if (store_text && (int)texts.size() <= id) texts.resize(id + 1);
         
-        string clean_preview;
-        if (content.size() > 200) {
-            clean_preview = content.substr(0, 200);
-        } else {
-            clean_preview = content;
-        }
+        titles[id] = poolClean(strings, title);
+        if (store_text) texts[id] = body;
+        makePreview(body, preview);
+        previews[id] = poolClean(strings, preview);
         
-        for (char& c : clean_preview) {
-            if (c == '\n' || c == '\r') c = ' ';
+        if (!positional) {
+            lengths[id] = tokenizeTerms(body, scratch, stemmed, toks, freqs);
+            for (size_t i = 0; i < toks.size(); ++i) index.add(toks[i], id, freqs[i]);
+            return;
         }
-        
-        titles[id] = title;
-        previews[id] = clean_preview;
-        
-        auto toks = tokenize_unique(content);
-        for (auto& tok : toks) {
-            index.add(tok, id);
+        lengths[id] = tokenizeTermPositions(body, scratch, stemmed, occurrences, toks, freqs, positions);
+        const uint32_t* pos = positions.data();
+        for (size_t i = 0; i < toks.size(); ++i) {
+            index.add(toks[i], id, freqs[i], pos);
+            pos += freqs[i];
         }
     }
 
@@ -180,96 +263,958 @@ public:
         f << titles.size() << "\n";
         
         for (size_t i = 0; i < titles.size(); ++i) {
-            string clean_title = sanitize(titles[i]);
-            string clean_preview = sanitize(previews[i]);
-            f << i << "|" << clean_title << "|" << clean_preview << "\n";
+            f << i << "|" << titles[i] << "|" << previews[i] << "\n";
         }
         
         f << "TERMS\n";
-        auto all = index.getAll();
-        f << all.size() << "\n";
+        f << index.size() << "\n";
         
-        for (auto& e : all) {
-            f << e.first << "|";
-            for (size_t i = 0; i < e.second.size(); ++i) {
-                if (i) f << ",";
-                f << e.second[i];
+        string line;
+        index.forEachSorted([&](string_view key, const PostingList& l) {
+            line.assign(key.data(), key.size());
+            line += '|';
+            for (size_t i = 0; i < l.docs.size(); ++i) {
+                if (i) line += ',';
+                line += to_string(l.docs[i]);
             }
-            f << "\n";
-        }
+            line += '\n';
+            f.write(line.data(), (streamsize)line.size());
+            return true;
+        });
         
         f.close();
         return true;
     }
+
+    bool saveToBinaryFile(const string& file) const {
+        ofstream f(file, ios::binary);
+        if (!f) {
+            cerr << "Не удалось открыть файл для записи: " << file << endl;
+            return false;
+        }
+
+        IndexFileWriter w(false, true, positional, stemmed, store_text);
+        for (size_t i = 0; i < titles.size(); ++i) {
+            w.addDocument(titles[i], previews[i], lengths[i], store_text ? texts[i] : string_view());
+        }
+        bool ok = index.forEachSorted([&](string_view key, const PostingList& l) {
+            return w.addTerm(key, l.docs.data(), l.freqs.data(), l.docs.size(),
+                             positional ? l.positions.data() : nullptr);
+        });
+        if (!ok || !w.finish(f)) {
+            cerr << "Ошибка записи бинарного индекса: " << file << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Освобождает словарь, постинги и строки разом.
+    void clear() {
+        index.clear();
+        strings.clear();
+        vector<string_view>().swap(titles);
+        vector<string_view>().swap(previews);
+        vector<string_view>().swap(texts);
+        vector<uint32_t>().swap(lengths);
+    }
+};
+
+// Объём дампа и время, ушедшее на его разбор (без токенизации и индексации).
+struct ParseStats {
+    uint64_t bytes = 0;
+    double seconds = 0;
+
+    void report(int threads) const {
+        double mb = bytes / 1048576.0;
+        cout << "Разбор дампа: " << mb << " МБ за " << (long long)(seconds * 1000) << " мс";
+        if (threads > 1) cout << " (потоков: " << threads << ", по самому долгому)";
+        cout << ", " << (seconds > 0 ? mb / seconds : 0) << " МБ/с" << endl;
+    }
 };
 
-static bool buildIndex(const string& dump, const string& out) {
-    ifstream f(dump);
-    if (!f) {
+static bool mapDump(const string& dump, MappedFile& file) {
+    if (!file.open(dump, true)) {
         cerr << "Не удалось открыть файл дампа: " << dump << endl;
         return false;
     }
+    return true;
+}
 
-    BooleanIndex idx;
-    string line, ext, content;
-    bool inDoc = false, inContent = false;
+// Блочное (SPIMI) построение индекса для корпусов больше ОЗУ. Термы блока
+// копятся в SimpleHashMap, пока занятая им память не превысит бюджет;
+// тогда блок сбрасывается на диск отсортированным прогоном. В конце
+// прогоны сливаются k-way слиянием прямо в выходной файл. Заголовки и
+// превью документов сразу уходят во временные секции и в памяти не живут.
+class SpimiIndexBuilder {
+private:
+    size_t budget;
+    string out_file;
+    bool binary;
+    bool positional;
+    bool stemmed;
+    bool store_text;
+
+    SimpleHashMap block;
+    vector<string> runs;
+    int docs = 0;
+
+    IndexFileWriter bin_out;
+    SectionBuffer text_docs;
+    TokenScratch scratch;
+    vector<string_view> toks;
+    vector<int> freqs;
+    vector<uint32_t> positions;
+    vector<pair<string_view, uint32_t>> occurrences;
+    string title_buf, preview_buf, line_buf;
+
+    // Запись прогона: uint32 длина ключа, ключ, uint32 n, int[n] doc_id, int[n] tf,
+    // [uint32[sum(tf)] позиции].
+    struct RunReader {
+        FILE* f = nullptr;
+        bool positional = false;
+        string key;
+        vector<int> docs, freqs;
+        vector<uint32_t> positions;
+
+        bool next() {
+            uint32_t len, n;
+            if (fread(&len, sizeof(len), 1, f) != 1) return false;
+            key.resize(len);
+            if (len && fread(&key[0], 1, len, f) != len) return false;
+            if (fread(&n, sizeof(n), 1, f) != 1) return false;
+            docs.resize(n);
+            freqs.resize(n);
+            if (n && (fread(docs.data(), sizeof(int), n, f) != n || fread(freqs.data(), sizeof(int), n, f) != n)) {
+                return false;
+            }
+            if (!positional) return true;
+            size_t total = 0;
+            for (int tf : freqs) total += (size_t)tf;
+            positions.resize(total);
+            return total == 0 || fread(positions.data(), sizeof(uint32_t), total, f) == total;
+        }
+    };
+
+    bool flushRun() {
+        if (block.size() == 0) return true;
+        string path = out_file + ".run" + to_string(runs.size());
+        FILE* f = fopen(path.c_str(), "wb");
+        if (!f) {
+            cerr << "Не удалось создать файл прогона: " << path << endl;
+            return false;
+        }
+        block.forEachSorted([&](string_view key, const PostingList& l) {
+            uint32_t len = (uint32_t)key.size(), n = (uint32_t)l.docs.size();
+            fwrite(&len, sizeof(len), 1, f);
+            fwrite(key.data(), 1, len, f);
+            fwrite(&n, sizeof(n), 1, f);
+            fwrite(l.docs.data(), sizeof(int), n, f);
+            fwrite(l.freqs.data(), sizeof(int), n, f);
+            if (positional) fwrite(l.positions.data(), sizeof(uint32_t), l.positions.size(), f);
+            return true;
+        });
+        bool ok = fclose(f) == 0;
+        if (!ok) cerr << "Ошибка записи файла прогона: " << path << endl;
+        runs.push_back(path);
+        size_t terms = block.size();
+        block.clear();
+        cout << "Сброшен прогон " << runs.size() << " (" << terms << " термов, документов: " << docs << ")" << endl;
+        return ok;
+    }
+
+    bool writeText(SectionBuffer& terms, size_t term_count) {
+        ofstream f(out_file, ios::binary);
+        if (!f) {
+            cerr << "Не удалось открыть файл для записи: " << out_file << endl;
+            return false;
+        }
+        f << "DOCS\n" << docs << "\n";
+        if (!text_docs.copyTo(f)) return false;
+        f << "TERMS\n" << term_count << "\n";
+        return terms.copyTo(f);
+    }
+
+    bool mergeRuns() {
+        vector<RunReader> readers(runs.size());
+        for (size_t i = 0; i < runs.size(); ++i) {
+            readers[i].f = fopen(runs[i].c_str(), "rb");
+            readers[i].positional = positional;
+            if (!readers[i].f) {
+                cerr << "Не удалось открыть файл прогона: " << runs[i] << endl;
+                return false;
+            }
+        }
+
+        auto later = [&readers](size_t a, size_t b) {
+            int c = readers[a].key.compare(readers[b].key);
+            return c != 0 ? c > 0 : a > b;
+        };
+        priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+        for (size_t i = 0; i < readers.size(); ++i) {
+            if (readers[i].next()) heap.push(i);
+        }
+
+        SectionBuffer text_terms(!binary);
+        size_t term_count = 0;
+        bool ok = text_terms.ok(!binary);
+        string key;
+        vector<int> merged, merged_freqs;
+        vector<uint32_t> merged_positions;
+        while (ok && !heap.empty()) {
+            key = readers[heap.top()].key;
+            merged.clear();
+            merged_freqs.clear();
+            merged_positions.clear();
+            while (!heap.empty() && readers[heap.top()].key == key) {
+                size_t i = heap.top();
+                heap.pop();
+                merged.insert(merged.end(), readers[i].docs.begin(), readers[i].docs.end());
+                merged_freqs.insert(merged_freqs.end(), readers[i].freqs.begin(), readers[i].freqs.end());
+                merged_positions.insert(merged_positions.end(), readers[i].positions.begin(), readers[i].positions.end());
+                if (readers[i].next()) heap.push(i);
+            }
+            ++term_count;
+            if (binary) {
+                ok = bin_out.addTerm(key, merged.data(), merged_freqs.data(), merged.size(), merged_positions.data());
+            } else {
+                string line = key + "|";
+                for (size_t i = 0; i < merged.size(); ++i) {
+                    if (i) line += ",";
+                    line += to_string(merged[i]);
+                }
+                line += "\n";
+                text_terms.write(line.data(), line.size());
+            }
+        }
+
+        for (size_t i = 0; i < readers.size(); ++i) {
+            fclose(readers[i].f);
+            remove(runs[i].c_str());
+        }
+        if (!ok) return false;
+
+        if (binary) {
+            ofstream f(out_file, ios::binary);
+            if (!f) {
+                cerr << "Не удалось открыть файл для записи: " << out_file << endl;
+                return false;
+            }
+            return bin_out.finish(f);
+        }
+        return writeText(text_terms, term_count);
+    }
+
+public:
+    SpimiIndexBuilder(size_t budget_bytes, const string& out, bool bin, bool pos, bool stem, bool text)
+        : budget(budget_bytes), out_file(out), binary(bin), positional(bin && pos), stemmed(bin && stem),
+          store_text(bin && text), bin_out(true, true, positional, stemmed, store_text), text_docs(true) {
+        block.setPositional(positional);
+    }
+
+    bool ok() const { return binary ? bin_out.ok() : text_docs.ok(true); }
+    int documentCount() const { return docs; }
+
+    bool addDocument(int id, string_view title, string_view body) {
+        title_buf.assign(title.data(), title.size());
+        sanitize(title_buf);
+        makePreview(body, preview_buf);
+        sanitize(preview_buf);
+        uint32_t length = positional
+            ? tokenizeTermPositions(body, scratch, stemmed, occurrences, toks, freqs, positions)
+            : tokenizeTerms(body, scratch, stemmed, toks, freqs);
+        if (binary) {
+            bin_out.addDocument(title_buf, preview_buf, length, body);
+        } else {
+            line_buf = to_string(id);
+            line_buf += '|';
+            line_buf += title_buf;
+            line_buf += '|';
+            line_buf += preview_buf;
+            line_buf += '\n';
+            text_docs.write(line_buf.data(), line_buf.size());
+        }
+        ++docs;
+
+        const uint32_t* pos = positional ? positions.data() : nullptr;
+        for (size_t i = 0; i < toks.size(); ++i) {
+            block.add(toks[i], id, freqs[i], pos);
+            if (pos) pos += freqs[i];
+        }
+        return block.memoryBytes() < budget || flushRun();
+    }
+
+    bool finish() {
+        if (!flushRun()) return false;
+        cout << "Слияние прогонов: " << runs.size() << endl;
+        return mergeRuns();
+    }
+};
+
+static bool buildIndexSpimi(const string& dump, const string& out, bool binary, bool positions, bool stem, bool text,
+                            size_t memory_mb) {
+    MappedFile file;
+    if (!mapDump(dump, file)) return false;
+
+    SpimiIndexBuilder builder(memory_mb << 20, out, binary, positions, stem, text);
+    if (!builder.ok()) {
+        cerr << "Не удалось создать временные файлы" << endl;
+        return false;
+    }
+    DumpScanner scanner(file.data(), file.size());
+    DumpDocument doc;
     int id = 0;
+    size_t released = 0;
+    while (scanner.next(doc)) {
+        if (!builder.addDocument(id++, doc.ext, doc.body)) return false;
+        // Прочитанная часть дампа не должна занимать бюджет памяти.
+        if (scanner.offset() - released >= (4u << 20)) {
+            released = scanner.offset();
+            file.release(released);
+        }
+    }
+
+    ParseStats stats;
+    stats.bytes = file.size();
+    stats.seconds = scanner.seconds();
+    stats.report(1);
+    cout << "Обработано документов: " << builder.documentCount() << endl;
+    return builder.finish();
+}
+
+static void buildIndexSequential(const MappedFile& file, BooleanIndex& idx, ParseStats& stats) {
+    DumpScanner scanner(file.data(), file.size());
+    DumpDocument doc;
+    int id = 0;
+    while (scanner.next(doc)) idx.addDocument(id++, doc.ext, doc.body);
+    stats.bytes = file.size();
+    stats.seconds = scanner.seconds();
+}
+
+// Дамп делится на n диапазонов по границам ==DOC_START==, каждый поток
+// строит свой частичный индекс с локальными doc_id; done(t) вызывается
+// в потоке диапазона t сразу после разбора.
+template <class Done>
+static bool buildIndexParts(const MappedFile& file, int n, bool positional, bool stem, bool text,
+                            vector<BooleanIndex>& parts, ParseStats& stats, Done done) {
+    const char* data = file.data();
+    size_t size = file.size();
 
-    while (safeGetline(f, line)) {
-        if (line.empty()) continue;
+    vector<size_t> bounds(1, 0);
+    for (int t = 1; t < n; ++t) {
+        size_t pos = max(bounds.back(), size * t / n);
+        bounds.push_back(nextDumpDocStart(data, size, pos));
+    }
+    bounds.push_back(size);
+
+    parts = vector<BooleanIndex>(n);
+    for (auto& p : parts) {
+        p.setPositional(positional);
+        p.setStemming(stem);
+        p.setStoreText(text);
+    }
+    vector<double> parse_sec(n, 0);
+    vector<char> ok(n, 1);
+    vector<thread> workers;
+    for (int t = 0; t < n; ++t) {
+        workers.emplace_back([&, t]() {
+            DumpScanner scanner(data + bounds[t], bounds[t + 1] - bounds[t], t == n - 1);
+            DumpDocument doc;
+            int id = 0;
+            while (scanner.next(doc)) parts[t].addDocument(id++, doc.ext, doc.body);
+            parse_sec[t] = scanner.seconds();
+            ok[t] = done(t);
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    stats.bytes = size;
+    stats.seconds = *max_element(parse_sec.begin(), parse_sec.end());
+    return find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+// Частичные индексы потоков сливаются по порядку; результат совпадает с
+// последовательным построением.
+static bool buildIndexParallel(const MappedFile& file, int threads, bool positional, bool stem, bool text,
+                               BooleanIndex& idx, ParseStats& stats) {
+    vector<BooleanIndex> parts;
+    if (!buildIndexParts(file, threads, positional, stem, text, parts, stats, [](int) { return true; })) return false;
+    for (auto& p : parts) idx.append(std::move(p));
+    return true;
+}
 
-        if (line == "==DOC_START==") {
-            inDoc = true;
-            inContent = false;
-            ext.clear();
-            content.clear();
-            continue;
+static bool buildIndex(const string& dump, const string& out, bool binary, bool positions, bool stem, bool text,
+                       int threads, size_t memory_mb) {
+    if (memory_mb > 0) return buildIndexSpimi(dump, out, binary, positions, stem, text, memory_mb);
+
+    // Дамп отображён до записи индекса: тексты документов указывают в него.
+    MappedFile file;
+    if (!mapDump(dump, file)) return false;
+    BooleanIndex idx;
+    idx.setPositional(positions);
+    idx.setStemming(stem);
+    idx.setStoreText(text);
+    ParseStats stats;
+    if (threads > 1) {
+        if (!buildIndexParallel(file, threads, positions, stem, text, idx, stats)) return false;
+    } else {
+        buildIndexSequential(file, idx, stats);
+    }
+
+    stats.report(threads);
+    cout << "Обработано документов: " << idx.documentCount() << endl;
+    return binary ? idx.saveToBinaryFile(out) : idx.saveToFile(out);
+}
+
+// Шардированный индекс (см. segment_index.h): частичные индексы потоков
+// не сливаются, а пишутся каждый своим шардом — диапазоном doc_id.
+static bool buildShards(const string& dump, const string& dir, int shards, bool positional, bool stem, bool text) {
+    if (!isIndexDirectory(dir) && mkdir(dir.c_str(), 0755) != 0) {
+        cerr << "Не удалось создать каталог индекса: " << dir << endl;
+        return false;
+    }
+    struct stat st;
+    if (stat((dir + "/" + MANIFEST_NAME).c_str(), &st) == 0) {
+        cerr << "Каталог уже содержит инкрементальный индекс: " << dir << endl;
+        return false;
+    }
+
+    ShardManifest m;
+    m.shards.assign(shards, SegmentInfo());
+    MappedFile file;
+    if (!mapDump(dump, file)) return false;
+    vector<BooleanIndex> parts;
+    ParseStats stats;
+    bool ok = buildIndexParts(file, shards, positional, stem, text, parts, stats, [&](int t) {
+        SegmentInfo& s = m.shards[t];
+        s.file = "shard_" + to_string(t) + ".idx";
+        s.count = (uint32_t)parts[t].documentCount();
+        bool saved = parts[t].saveToBinaryFile(dir + "/" + s.file);
+        parts[t].clear();
+        return saved;
+    });
+    if (!ok) return false;
+
+    stats.report(shards);
+    uint32_t base = 0;
+    for (auto& s : m.shards) {
+        s.base = base;
+        base += s.count;
+    }
+    cout << "Обработано документов: " << base << ", шардов: " << shards << endl;
+    if (!m.save(dir)) {
+        cerr << "Ошибка записи " << SHARDS_NAME << ": " << dir << endl;
+        return false;
+    }
+    return true;
+}
+
+// ---- Инкрементальный индекс (каталог сегментов, см. segment_index.h) ----
+
+static const size_t MAX_DELTA_SEGMENTS = 4;
+
+struct DocRef {
+    int id;
+    uint64_t hash;
+    bool seen;
+};
+
+// FNV-1a текста, склеенного из непустых строк через пробел.
+static uint64_t contentHash(string_view body) {
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&h](unsigned char c) {
+        h ^= c;
+        h *= 1099511628211ull;
+    };
+    forEachContentLine(body, [&](string_view line) {
+        for (unsigned char c : line) mix(c);
+        mix(' ');
+        return true;
+    });
+    return h;
+}
+
+// docmap: строки "doc_id<TAB>hash<TAB>external_id".
+static bool loadDocMap(const string& path, unordered_map<string, DocRef>& docs) {
+    ifstream f(path);
+    if (!f) return false;
+    string line;
+    while (getline(f, line)) {
+        size_t p1 = line.find('\t');
+        size_t p2 = line.find('\t', p1 + 1);
+        if (p1 == string::npos || p2 == string::npos) continue;
+        DocRef r;
+        r.id = atoi(line.substr(0, p1).c_str());
+        r.hash = strtoull(line.substr(p1 + 1, p2 - p1 - 1).c_str(), nullptr, 10);
+        r.seen = false;
+        docs[line.substr(p2 + 1)] = r;
+    }
+    return true;
+}
+
+static bool saveDocMap(const string& path, const unordered_map<string, DocRef>& docs) {
+    vector<pair<int, const string*>> order;
+    order.reserve(docs.size());
+    for (auto& d : docs) order.push_back({d.second.id, &d.first});
+    sort(order.begin(), order.end());
+    ofstream f(path);
+    if (!f) return false;
+    for (auto& o : order) f << o.first << "\t" << docs.at(*o.second).hash << "\t" << *o.second << "\n";
+    return (bool)f;
+}
+
+// Эксклюзивная блокировка каталога на время изменения (ingest/compact).
+// Читатели (search) блокировку не берут.
+class IndexDirLock {
+private:
+    int fd = -1;
+
+public:
+    bool acquire(const string& dir) {
+        fd = open((dir + "/LOCK").c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+            cerr << "Не удалось заблокировать каталог индекса: " << dir << endl;
+            return false;
+        }
+        return true;
+    }
+    ~IndexDirLock() {
+        if (fd >= 0) close(fd);
+    }
+};
+
+// Сливает сегменты от first до последнего в один. Удалённые документы и
+// их postings выбрасываются, живые нумеруются подряд от базы first;
+// remap[gid - base] — новый номер документа или -1 для удалённого.
+static bool mergeSegments(const string& dir, const IndexManifest& m, size_t first, const TombstoneSet& dead,
+                          const string& out_file, uint32_t& out_count, vector<int>& remap) {
+    size_t last = m.segments.size() - 1;
+    vector<unique_ptr<MappedIndex>> segs;
+    for (size_t i = first; i <= last; ++i) {
+        segs.emplace_back(new MappedIndex());
+        if (!segs.back()->open(dir + "/" + m.segments[i].file)) return false;
+    }
+
+    // Позиции и тексты сохраняются, только если они есть во всех
+    // сливаемых сегментах.
+    bool positional = true, text = true;
+    for (auto& seg : segs) {
+        positional = positional && seg->hasPositions();
+        text = text && seg->hasText();
+        if (seg->stemmed() != segs[0]->stemmed()) {
+            cerr << "Сегменты построены с разным стеммингом, слияние невозможно" << endl;
+            return false;
         }
-        if (!inDoc) continue;
+    }
 
-        if (ext.empty()) {
-            ext = line;
-            continue;
+    uint32_t new_base = m.segments[first].base;
+    uint32_t end = m.segments[last].base + m.segments[last].count;
+    IndexFileWriter w(true, true, positional, segs[0]->stemmed(), text);
+    if (!w.ok()) return false;
+
+    StoredDocument doc;
+    DocBlockCache cache;
+    remap.assign(end - new_base, -1);
+    int next_id = 0;
+    size_t s = 0;
+    for (uint32_t gid = new_base; gid < end; ++gid) {
+        while (s + 1 < segs.size() && gid >= m.segments[first + s + 1].base) ++s;
+        const SegmentInfo& info = m.segments[first + s];
+        if (dead.test(gid) || gid < info.base || gid >= info.base + info.count) continue;
+        remap[gid - new_base] = next_id++;
+        int local = (int)(gid - info.base);
+        if (!segs[s]->document(local, doc, text, &cache)) {
+            cerr << "Хранилище документов сегмента повреждено: " << m.segments[first + s].file << endl;
+            return false;
         }
-        if (!inContent) {
-            if (line == "==CONTENT_START==") {
-                inContent = true;
+        w.addDocument(doc.title, doc.preview, segs[s]->docLength(local), doc.text);
+    }
+
+    vector<uint32_t> pos(segs.size(), 0);
+    auto later = [&](size_t a, size_t b) {
+        int c = segs[a]->termKey(*segs[a]->termAt(pos[a])).compare(segs[b]->termKey(*segs[b]->termAt(pos[b])));
+        return c != 0 ? c > 0 : a > b;
+    };
+    priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < segs.size(); ++i) {
+        if (segs[i]->termCount() > 0) heap.push(i);
+    }
+
+    string key;
+    vector<int> merged, merged_freqs;
+    vector<uint32_t> merged_positions, doc_positions;
+    while (!heap.empty()) {
+        size_t i = heap.top();
+        key.assign(segs[i]->termKey(*segs[i]->termAt(pos[i])));
+        merged.clear();
+        merged_freqs.clear();
+        merged_positions.clear();
+        while (!heap.empty()) {
+            i = heap.top();
+            const TermEntry* e = segs[i]->termAt(pos[i]);
+            if (segs[i]->termKey(*e) != key) break;
+            heap.pop();
+            int shift = (int)(m.segments[first + i].base - new_base);
+            PositionReader reader = segs[i]->positions(e);
+            for (PostingCursor c(segs[i]->postings(e)); c.valid(); c.next()) {
+                int id = remap[c.doc() + shift];
+                if (id < 0) continue;
+                merged.push_back(id);
+                merged_freqs.push_back(c.freq());
+                if (positional) {
+                    reader.read(c.ordinal(), doc_positions);
+                    merged_positions.insert(merged_positions.end(), doc_positions.begin(), doc_positions.end());
+                }
             }
-            continue;
+            if (++pos[i] < segs[i]->termCount()) heap.push(i);
+        }
+        if (!merged.empty() &&
+            !w.addTerm(key, merged.data(), merged_freqs.data(), merged.size(), merged_positions.data())) {
+            return false;
         }
-        if (line == "==DOC_END==") {
-            if (!ext.empty() && !content.empty()) {
-                idx.addDocument(id++, ext, content);
+    }
+
+    ofstream f(dir + "/" + out_file, ios::binary);
+    if (!f || !w.finish(f)) {
+        cerr << "Ошибка записи сегмента: " << out_file << endl;
+        return false;
+    }
+    out_count = (uint32_t)next_id;
+    return true;
+}
+
+// Слияние всегда доходит до последнего сегмента, поэтому номера после
+// диапазона никем не заняты: удалённые doc_id освобождаются, а docmap,
+// tombstones и next_id переписываются в том же поколении MANIFEST.
+// Номера сегментов перед first не меняются.
+static bool compactRange(const string& dir, IndexManifest& m, size_t first, TombstoneSet& dead,
+                         unordered_map<string, DocRef>& docs) {
+    IndexManifest next = m;
+    next.generation++;
+    string gen = to_string(next.generation);
+    SegmentInfo merged;
+    merged.file = "seg_" + gen + ".idx";
+    merged.base = m.segments[first].base;
+    cout << "Слияние сегментов " << first + 1 << ".." << m.segments.size() << " в " << merged.file << endl;
+    vector<int> remap;
+    if (!mergeSegments(dir, m, first, dead, merged.file, merged.count, remap)) return false;
+
+    next.segments.resize(first);
+    next.segments.push_back(merged);
+    unordered_map<string, DocRef> next_docs;
+    for (auto& d : docs) {
+        DocRef r = d.second;
+        if (r.id >= (int)merged.base) {
+            int id = remap[r.id - merged.base];
+            if (id < 0) {
+                cerr << "docmap ссылается на удалённый документ " << r.id << ": " << d.first << endl;
+                return false;
             }
-            inDoc = false;
-            inContent = false;
-            continue;
+            r.id = (int)merged.base + id;
         }
-        content += line + " ";
+        next_docs[d.first] = r;
     }
-    
-    if (inDoc && !ext.empty() && !content.empty()) {
-        idx.addDocument(id++, ext, content);
+    TombstoneSet next_dead;
+    dead.forEach(0, merged.base, [&](uint32_t id) { next_dead.set(id); });
+    next.next_id = merged.base + merged.count;
+    next.tombstones = "tombstones_" + gen + ".bin";
+    next.docmap = "docmap_" + gen + ".txt";
+    if (!next_dead.save(dir + "/" + next.tombstones) || !saveDocMap(dir + "/" + next.docmap, next_docs)) {
+        cerr << "Ошибка записи состояния каталога индекса: " << dir << endl;
+        return false;
     }
-    
-    cout << "Обработано документов: " << id << endl;
-    return idx.saveToFile(out);
+    if (!next.save(dir)) {
+        cerr << "Не удалось записать MANIFEST" << endl;
+        return false;
+    }
+    for (size_t i = first; i < m.segments.size(); ++i) remove((dir + "/" + m.segments[i].file).c_str());
+    remove((dir + "/" + m.tombstones).c_str());
+    remove((dir + "/" + m.docmap).c_str());
+    cout << "Освобождено doc_id: " << (m.next_id - next.next_id) << endl;
+    docs.swap(next_docs);
+    dead = next_dead;
+    m = next;
+    return true;
+}
+
+// LSM-политика: когда дельта-сегментов становится MAX_DELTA_SEGMENTS, они
+// сливаются в один; если суммарно дельты доросли до четверти базового
+// сегмента, вместе с ними переписывается и база. full сливает всё.
+// Слияние синхронное: выполняется в том же процессе под блокировкой
+// каталога, читатели тем временем работают с прежним поколением.
+static bool compactIndex(const string& dir, IndexManifest& m, TombstoneSet& dead,
+                         unordered_map<string, DocRef>& docs, bool full) {
+    if (m.segments.size() <= 1 && !(full && !m.segments.empty() && !dead.empty())) return true;
+
+    uint64_t delta_docs = 0;
+    for (size_t i = 1; i < m.segments.size(); ++i) delta_docs += m.segments[i].count;
+    bool merge_deltas = m.segments.size() - 1 >= MAX_DELTA_SEGMENTS;
+    bool merge_base = full || (merge_deltas && delta_docs * 4 >= m.segments[0].count);
+
+    if (merge_base) return compactRange(dir, m, 0, dead, docs);
+    if (merge_deltas) return compactRange(dir, m, 1, dead, docs);
+    return true;
+}
+
+static bool openIndexDirectory(const string& dir, IndexDirLock& lock, IndexManifest& m, bool& exists) {
+    if (!isIndexDirectory(dir) && mkdir(dir.c_str(), 0755) != 0) {
+        cerr << "Не удалось создать каталог индекса: " << dir << endl;
+        return false;
+    }
+    if (isShardDirectory(dir)) {
+        cerr << "Каталог содержит шардированный индекс, он не обновляется: " << dir << endl;
+        return false;
+    }
+    if (!lock.acquire(dir)) return false;
+    struct stat st;
+    exists = stat((dir + "/" + MANIFEST_NAME).c_str(), &st) == 0;
+    return !exists || m.load(dir);
+}
+
+// Добавляет в каталог индекса дельта-сегмент с новыми и изменёнными
+// документами дампа. Документ опознаётся по external_id (строка после
+// ==DOC_START==); неизменённые документы сохраняют свой doc_id, новая
+// версия изменённого получает новый doc_id, а старый попадает в
+// tombstones, как и документы, пропавшие из дампа. Дамп без единого
+// документа удалил бы весь индекс (обычно это обрезанный или пустой
+// вход), поэтому он применяется только с allow_empty.
+static bool buildIncremental(const string& dump, const string& dir, bool positions, bool stem, bool text,
+                             bool allow_empty) {
+    IndexDirLock lock;
+    IndexManifest m;
+    bool exists = false;
+    if (!openIndexDirectory(dir, lock, m, exists)) return false;
+    if (exists && !m.segments.empty()) {
+        // Термы дельты должны совпадать по форме с термами прежних сегментов.
+        MappedIndex first;
+        if (!first.open(dir + "/" + m.segments[0].file)) return false;
+        if (first.stemmed() != stem) {
+            cerr << "Каталог индекса построен " << (first.stemmed() ? "со стеммингом" : "без стемминга")
+                 << (stem ? ", а задан --stem" : ", а --stem не задан") << endl;
+            return false;
+        }
+    }
+
+    TombstoneSet dead;
+    unordered_map<string, DocRef> docs;
+    if (exists) {
+        if (!dead.load(dir + "/" + m.tombstones) || !loadDocMap(dir + "/" + m.docmap, docs)) {
+            cerr << "Не удалось прочитать состояние каталога индекса: " << dir << endl;
+            return false;
+        }
+    }
+
+    MappedFile file;
+    if (!mapDump(dump, file)) return false;
+
+    BooleanIndex delta;
+    delta.setPositional(positions);
+    delta.setStemming(stem);
+    delta.setStoreText(text);
+    uint32_t base = m.next_id;
+    int local = 0, added = 0, changed = 0, unchanged = 0, removed = 0;
+    DumpScanner scanner(file.data(), file.size());
+    DumpDocument doc;
+    string title;
+    while (scanner.next(doc)) {
+        uint64_t h = contentHash(doc.body);
+        title.assign(doc.ext);
+        auto it = docs.find(title);
+        if (it != docs.end()) {
+            it->second.seen = true;
+            if (it->second.hash == h) {
+                ++unchanged;
+                continue;
+            }
+            dead.set((uint32_t)it->second.id);
+            ++changed;
+        } else {
+            ++added;
+        }
+        int gid = (int)base + local;
+        delta.addDocument(local++, doc.ext, doc.body);
+        docs[title] = DocRef{gid, h, true};
+    }
+
+    for (auto it = docs.begin(); it != docs.end();) {
+        if (!it->second.seen) {
+            dead.set((uint32_t)it->second.id);
+            ++removed;
+            it = docs.erase(it);
+        } else {
+            it->second.seen = false;
+            ++it;
+        }
+    }
+
+    cout << "Новых документов: " << added << ", изменённых: " << changed
+         << ", без изменений: " << unchanged << ", удалённых: " << removed << endl;
+    if (added + changed + unchanged == 0 && removed > 0 && !allow_empty) {
+        cerr << "В дампе нет ни одного документа: индекс не изменён. Чтобы удалить все "
+             << removed << " документов, повторите с --allow-empty" << endl;
+        return false;
+    }
+    if (exists && local == 0 && removed == 0) {
+        cout << "Изменений нет, индекс не тронут" << endl;
+        return true;
+    }
+
+    string old_tombstones = m.tombstones, old_docmap = m.docmap;
+    m.generation++;
+    string gen = to_string(m.generation);
+    if (local > 0) {
+        SegmentInfo seg;
+        seg.file = "seg_" + gen + ".idx";
+        seg.base = base;
+        seg.count = (uint32_t)local;
+        if (!delta.saveToBinaryFile(dir + "/" + seg.file)) return false;
+        delta.clear();
+        m.segments.push_back(seg);
+        m.next_id = base + (uint32_t)local;
+    }
+    m.tombstones = "tombstones_" + gen + ".bin";
+    m.docmap = "docmap_" + gen + ".txt";
+    if (!dead.save(dir + "/" + m.tombstones) || !saveDocMap(dir + "/" + m.docmap, docs) || !m.save(dir)) {
+        cerr << "Ошибка записи состояния каталога индекса: " << dir << endl;
+        return false;
+    }
+    if (!old_tombstones.empty()) remove((dir + "/" + old_tombstones).c_str());
+    if (!old_docmap.empty()) remove((dir + "/" + old_docmap).c_str());
+
+    cout << "Поколение " << m.generation << ": сегментов " << m.segments.size()
+         << ", удалённых doc_id " << dead.count() << endl;
+    return compactIndex(dir, m, dead, docs, false);
+}
+
+static bool compactDirectory(const string& dir) {
+    IndexDirLock lock;
+    IndexManifest m;
+    bool exists = false;
+    if (!isIndexDirectory(dir) || !openIndexDirectory(dir, lock, m, exists) || !exists) {
+        cerr << "Каталог индекса не найден: " << dir << endl;
+        return false;
+    }
+    TombstoneSet dead;
+    unordered_map<string, DocRef> docs;
+    if (!dead.load(dir + "/" + m.tombstones) || !loadDocMap(dir + "/" + m.docmap, docs)) {
+        cerr << "Не удалось прочитать состояние каталога индекса: " << dir << endl;
+        return false;
+    }
+    if (!compactIndex(dir, m, dead, docs, true)) return false;
+    cout << "Поколение " << m.generation << ": сегментов " << m.segments.size() << endl;
+    return true;
+}
+
+static void usage(const char* prog) {
+    cerr << "Использование: " << prog << " [--binary [--positions] [--stem] [--store-text]] [--threads N | --memory-mb N | --shards N] <входной_файл> <выходной_файл>" << endl;
+    cerr << "  --binary     записать бинарный индекс (mmap) вместо текстового" << endl;
+    cerr << "  --positions  хранить позиции термов для фраз и NEAR/k (бинарный индекс)" << endl;
+    cerr << "  --stem       индексировать основы слов (бинарный индекс); запросы стеммируются так же" << endl;
+    cerr << "  --store-text хранить сжатые тексты документов для сниппетов в выдаче (бинарный индекс)" << endl;
+    cerr << "  --threads N  строить индекс в N потоков" << endl;
+    cerr << "  --memory-mb N  блочное построение с бюджетом памяти N МБ (прогоны на диске + слияние)" << endl;
+    cerr << "  --incremental  <выходной_файл> — каталог сегментов; добавить дельту из дампа" << endl;
+    cerr << "  --allow-empty  с --incremental: применить дамп без документов (удаляет все документы индекса)" << endl;
+    cerr << "  --shards N   <выходной_файл> — каталог из N бинарных шардов по диапазонам doc_id (строятся в N потоков)" << endl;
+    cerr << "Слияние сегментов: " << prog << " --compact <каталог_индекса>" << endl;
+    cerr << "Пример: " << prog << " dump.txt data/boolean_index.idx" << endl;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Использование: " << argv[0] << " <входной_файл> <выходной_файл>" << endl;
-        cerr << "Пример: " << argv[0] << " dump.txt data/boolean_index.idx" << endl;
+    bool binary = false, positions = false, stem = false, text = false;
+    int threads = 1, shards = 0;
+    size_t memory_mb = 0;
+    bool incremental = false, compact = false, allow_empty = false;
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--binary") binary = true;
+        else if (a == "--positions") positions = true;
+        else if (a == "--stem") stem = true;
+        else if (a == "--store-text") text = true;
+        else if (a == "--incremental") incremental = true;
+        else if (a == "--compact") compact = true;
+        else if (a == "--allow-empty") allow_empty = true;
+        else if (a == "--threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads < 1) {
+                cerr << "Некорректное число потоков: " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (a == "--shards" && i + 1 < argc) {
+            shards = atoi(argv[++i]);
+            if (shards < 1) {
+                cerr << "Некорректное число шардов: " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (a == "--memory-mb" && i + 1 < argc) {
+            int mb = atoi(argv[++i]);
+            if (mb < 1) {
+                cerr << "Некорректный бюджет памяти: " << argv[i] << endl;
+                return 1;
+            }
+            memory_mb = (size_t)mb;
+        }
+        else if (a.rfind("--", 0) == 0) {
+            cerr << "Неизвестный параметр: " << a << endl;
+            usage(argv[0]);
+            return 1;
+        }
+        else args.push_back(a);
+    }
+    if (compact) {
+        if (args.size() != 1) {
+            usage(argv[0]);
+            return 1;
+        }
+        return compactDirectory(args[0]) ? 0 : 2;
+    }
+    if ((incremental || memory_mb > 0) && threads > 1) {
+        cerr << "--threads поддерживается только для обычного построения" << endl;
+        return 1;
+    }
+    if (shards > 0 && (incremental || memory_mb > 0 || threads > 1)) {
+        cerr << "--shards нельзя использовать вместе с --incremental, --memory-mb и --threads" << endl;
+        return 1;
+    }
+    // Шарды — всегда бинарные индексы.
+    if (shards > 0) binary = true;
+    if (incremental && memory_mb > 0) {
+        cerr << "--incremental и --memory-mb нельзя использовать вместе" << endl;
+        return 1;
+    }
+    if (allow_empty && !incremental) {
+        cerr << "--allow-empty используется только с --incremental" << endl;
+        return 1;
+    }
+    if (positions && !binary && !incremental) {
+        cerr << "--positions поддерживается только для бинарного индекса (--binary)" << endl;
+        return 1;
+    }
+    if (stem && !binary && !incremental) {
+        cerr << "--stem поддерживается только для бинарного индекса (--binary)" << endl;
+        return 1;
+    }
+    if (text && !binary && !incremental) {
+        cerr << "--store-text поддерживается только для бинарного индекса (--binary)" << endl;
+        return 1;
+    }
+    if (args.size() != 2) {
+        usage(argv[0]);
         return 1;
     }
     
-    string input_file = argv[1];
-    string output_file = argv[2];
+    string input_file = args[0];
+    string output_file = args[1];
     
     cout << "Построение индекса из файла: " << input_file << endl;
-    cout << "Выходной файл: " << output_file << endl;
+    cout << "Выходной файл: " << output_file << (binary ? " (бинарный формат)" : "") << endl;
     
-    if (buildIndex(input_file, output_file)) {
+    bool ok = incremental ? buildIncremental(input_file, output_file, positions, stem, text, allow_empty)
+              : shards > 0 ? buildShards(input_file, output_file, shards, positions, stem, text)
+                           : buildIndex(input_file, output_file, binary, positions, stem, text, threads, memory_mb);
+    if (ok) {
         cout << "Индекс успешно построен и сохранен в " << output_file << endl;
         return 0;
     } else {
@@ -4,249 +4,694 @@
 #include <algorithm>
 #include <cstring>
 #include <cctype>
+#include <cmath>
 #include <chrono>
 #include <sstream>
+#include <deque>
+#include <iomanip>
+#include <cstdlib>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "doc_bitmap.h"
+#include "doc_iterator.h"
+#include "index_format.h"
+#include "query_cache.h"
+#include "query_parser.h"
+#include "query_server.h"
+#include "ranking.h"
+#include "segment_index.h"
+#include "snippet.h"
+#include "stemmer.h"
+#include "task_pool.h"
 
 using namespace std;
 using namespace std::chrono;
 
 
-class SimpleHashMap {
+class BooleanSearch {
 private:
-    struct Node {
-        string key;
-        vector<int> values; 
-        Node* next;
-        Node(const string& k) : key(k), next(nullptr) {}
-    };
+    // Больше термов шаблон или нечёткий терм раскрываться не могут.
+    static const size_t MAX_EXPANSIONS = 4096;
 
-    static const int TABLE_SIZE = 1000000;
-    Node** table;
+    SegmentedIndex index;
+    // 0 — булев режим, иначе число документов в ранжированной выдаче.
+    int top_k = 0;
+    // Кэш может быть общим для нескольких поколений индекса (--serve);
+    // generation отличает результаты этого экземпляра.
+    QueryCaches* cache = nullptr;
+    uint64_t generation = 0;
 
-    unsigned int hashStr(const string& str) const {
-        unsigned int h = 5381;
-        for (size_t i = 0; i < str.size(); ++i) {
-            h = ((h << 5) + h) + (unsigned char)str[i];
-        }
-        return h % TABLE_SIZE;
+    // Шардированный индекс: index — все шарды вместе (планирование,
+    // статистика BM25, документы), shards — по поиску на шард с
+    // локальными doc_id; запрос выполняется на них в пуле потоков.
+    vector<unique_ptr<BooleanSearch>> shards;
+    vector<uint32_t> shard_bases;
+    WorkStealingPool* pool = nullptr;
+    // Число документов, для которого планировщик считал стоимости
+    // (у шарда — всего индекса).
+    uint32_t plan_docs = 0;
+
+    // Пакет запросов (--batch): готовые результаты узлов, общих для
+    // нескольких запросов пакета. Заполняются до выполнения запросов и
+    // во время него только читаются.
+    unordered_map<const QueryNode*, QueryCache::Value> shared_results;
+
+    QueryCache::Value sharedResult(const QueryNode& n) const {
+        if (shared_results.empty()) return nullptr;
+        auto it = shared_results.find(&n);
+        return it == shared_results.end() ? nullptr : it->second;
     }
 
-public:
-    SimpleHashMap() {
-        table = new Node*[TABLE_SIZE]();
+    void openShards() {
+        for (size_t i = 0; i < index.shardCount(); ++i) {
+            unique_ptr<BooleanSearch> s(new BooleanSearch());
+            s->index = index.shard(i);
+            s->plan_docs = index.docCount();
+            shards.push_back(std::move(s));
+            shard_bases.push_back(index.segmentBase(i));
+        }
     }
 
-    ~SimpleHashMap() {
-        for (int i = 0; i < TABLE_SIZE; ++i) {
-            Node* node = table[i];
-            while (node) {
-                Node* temp = node;
-                node = node->next;
-                delete temp;
+    bool loadIndex(const string& filename) {
+        if (isIndexDirectory(filename)) {
+            if (!index.openDirectory(filename)) return false;
+            if (index.shardCount()) {
+                openShards();
+                cout << "Индекс загружен успешно (шардов: " << index.shardCount() << ")!\n";
+            } else {
+                cout << "Индекс загружен успешно (сегментов: " << index.segmentCount() << ")!\n";
             }
+            cout << "Документов: " << index.docCount() - index.deletedCount() << "\n";
+            cout << "Терминов (по сегментам): " << index.termCount() << "\n";
+            if (index.stemmed()) cout << "Термы — основы слов, запросы стеммируются\n";
+            return true;
         }
-        delete[] table;
-    }
 
-    void add(const string& key, int doc_id) {
-        unsigned int h = hashStr(key);
-        Node* node = table[h];
+        bool mapped = false;
+        int text_terms = 0;
+        if (!index.openFile(filename, &mapped, &text_terms)) return false;
+        if (mapped) {
+            cout << "Индекс загружен успешно (mmap)!\n";
+            cout << "Документов: " << index.docCount() << "\n";
+            cout << "Терминов: " << index.termCount() << "\n";
+            if (index.stemmed()) cout << "Термы — основы слов, запросы стеммируются\n";
+        } else {
+            cout << "Индекс загружен успешно!\n";
+            cout << "Документов: " << index.docCount() << "\n";
+            cout << "Терминов (строк в файле): " << text_terms << "\n";
+        }
+        return true;
+    }
 
-        while (node) {
-            if (node->key == key) {
-                if (node->values.empty() || node->values.back() != doc_id) {
-                    node->values.push_back(doc_id);
-                }
-                return;
+    // Есть ли x в pos[0], для которого x + i лежит в pos[i] при всех i.
+    static bool phraseMatch(const vector<vector<uint32_t>>& pos) {
+        vector<size_t> at(pos.size(), 0);
+        for (uint32_t x : pos[0]) {
+            bool ok = true;
+            for (size_t i = 1; i < pos.size() && ok; ++i) {
+                const vector<uint32_t>& p = pos[i];
+                size_t& j = at[i];
+                while (j < p.size() && p[j] < x + i) ++j;
+                ok = j < p.size() && p[j] == x + i;
             }
-            node = node->next;
+            if (ok) return true;
         }
-
-        Node* n = new Node(key);
-        n->values.push_back(doc_id);
-        n->next = table[h];
-        table[h] = n;
+        return false;
     }
 
-    vector<int> get(const string& key) const {
-        unsigned int h = hashStr(key);
-        Node* node = table[h];
-        while (node) {
-            if (node->key == key) return node->values;
-            node = node->next;
+    // Есть ли x в a, для которого x + delta лежит в b.
+    static bool offsetMatch(const vector<uint32_t>& a, const vector<uint32_t>& b, int64_t delta) {
+        size_t j = 0;
+        for (uint32_t x : a) {
+            int64_t want = (int64_t)x + delta;
+            while (j < b.size() && (int64_t)b[j] < want) ++j;
+            if (j == b.size()) return false;
+            if ((int64_t)b[j] == want) return true;
         }
-        return vector<int>();
+        return false;
     }
-};
 
+    static bool nearMatch(const vector<uint32_t>& a, const vector<uint32_t>& b, uint32_t k) {
+        size_t i = 0, j = 0;
+        while (i < a.size() && j < b.size()) {
+            uint32_t d = a[i] > b[j] ? a[i] - b[j] : b[j] - a[i];
+            if (d <= k) return true;
+            if (a[i] < b[j]) ++i;
+            else ++j;
+        }
+        return false;
+    }
 
-class BooleanSearch {
-private:
-    SimpleHashMap index;
+    // Фраза и NEAR/k: doc_id термов пересекаются ленивым AND, и позиции
+    // читаются только для кандидатов — от самого редкого терма. Для фразы
+    // каждый следующий терм сразу сверяется с самым редким по смещению,
+    // и на первом несовпадении остальные позиции не читаются.
+    class PositionalIterator : public DocIterator {
+    private:
+        DocIteratorPtr docs;
+        vector<TermPositions> terms;
+        vector<size_t> order;
+        vector<vector<uint32_t>> pos;
+        bool phrase;
+        uint32_t distance;
 
-   
-    vector<string> doc_titles; 
-    vector<string> doc_preview; 
+        bool match(int doc) {
+            size_t lead = order[0];
+            for (size_t i = 0; i < order.size(); ++i) {
+                size_t t = order[i];
+                if (!terms[t].find(doc, pos[t])) return false;
+                if (phrase && i > 0 && !offsetMatch(pos[lead], pos[t], (int64_t)t - (int64_t)lead)) return false;
+            }
+            return phrase ? phraseMatch(pos) : nearMatch(pos[0], pos[1], distance);
+        }
 
-    bool loadIndex(const string& filename) {
-        ifstream file(filename.c_str());
-        if (!file) {
-            cerr << "Ошибка открытия файла индекса: " << filename << "\n";
-            return false;
+        void skip() {
+            while (docs->doc() != DOC_END && !match(docs->doc())) docs->next();
+            current = docs->doc();
         }
 
-        string line;
+    public:
+        PositionalIterator(const QueryNode& n, const SegmentedIndex& index)
+            : order(n.children.size()), pos(n.children.size()), phrase(n.type == QueryNode::PHRASE),
+              distance(n.distance) {
+            for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+            stable_sort(order.begin(), order.end(), [&n](size_t a, size_t b) {
+                return n.children[a]->cost < n.children[b]->cost;
+            });
+            vector<DocIteratorPtr> kids;
+            for (size_t t : order) kids.push_back(index.iterator(n.children[t]->term));
+            docs.reset(new AndIterator(std::move(kids)));
+            for (auto& c : n.children) terms.push_back(index.positions(c->term));
+            skip();
+        }
 
-        if (!getline(file, line) || line != "DOCS") {
-            cerr << "Bad index format: missing DOCS\n";
-            return false;
+        void next() override {
+            docs->next();
+            skip();
         }
 
-        if (!getline(file, line)) return false;
-        int doc_count = atoi(line.c_str());
-        doc_titles.assign(doc_count, "");
-        doc_preview.assign(doc_count, "");
+        void advance(int target) override {
+            if (target <= current) return;
+            docs->advance(target);
+            skip();
+        }
 
-        for (int i = 0; i < doc_count; ++i) {
-            if (!getline(file, line)) return false;
-            size_t p1 = line.find('|');
-            size_t p2 = line.find('|', p1 + 1);
-            if (p1 == string::npos || p2 == string::npos) return false;
+        uint64_t cost() const override { return docs->cost(); }
+    };
 
-            int doc_id = atoi(line.substr(0, p1).c_str());
-            string title = line.substr(p1 + 1, p2 - p1 - 1);
-            string prev = line.substr(p2 + 1);
+    // Не меньше документа из BITMAP_DENSITY: такой узел дешевле считать
+    // битовой картой, чем слиянием списков.
+    bool dense(const QueryNode& n) const {
+        uint32_t docs = plan_docs ? plan_docs : index.docCount();
+        return docs && n.cost * BITMAP_DENSITY >= docs;
+    }
 
-            if (doc_id >= 0 && doc_id < doc_count) {
-                doc_titles[doc_id] = title;
-                doc_preview[doc_id] = prev;
-            }
+    // Узел считается целиком по словам битовых карт: NOT (дополнение —
+    // почти всегда большая часть индекса), плотные OR и шаблоны, AND
+    // только из плотных частей и ANDNOT с плотной базой.
+    bool wordwise(const QueryNode& n) const {
+        switch (n.type) {
+            case QueryNode::NOT:
+                return index.docCount() > 0;
+            case QueryNode::OR:
+            case QueryNode::WILDCARD:
+            case QueryNode::FUZZY:
+                return dense(n);
+            case QueryNode::AND:
+                for (auto& c : n.children) {
+                    if (!dense(*c)) return false;
+                }
+                return true;
+            case QueryNode::ANDNOT:
+                return dense(*n.children[0]);
+            default:
+                return false;
         }
+    }
 
-        if (!getline(file, line) || line != "TERMS") {
-            cerr << "Bad index format: missing TERMS\n";
-            return false;
+    // Карта плотного терма прямо из mmap (один сегмент без удалений).
+    const uint64_t* mappedBitmap(const QueryNode& n) const {
+        uint64_t count;
+        return n.type == QueryNode::TERM ? index.directBitmap(n.term, count) : nullptr;
+    }
+
+    // Добавляет документы узла в b.
+    void addTo(DocBitmap& b, const QueryNode& n) const {
+        if (QueryCache::Value r = sharedResult(n)) {
+            for (int d : *r) b.set((uint32_t)d);
+        } else if (n.type == QueryNode::TERM) {
+            index.termBitmap(n.term, b);
+        } else if (wordwise(n)) {
+            b.orWith(*bitmapOf(n));
+        } else if (n.type == QueryNode::OR || n.type == QueryNode::WILDCARD || n.type == QueryNode::FUZZY) {
+            for (auto& c : n.children) addTo(b, *c);
+        } else {
+            for (DocIteratorPtr it = build(n); it->doc() != DOC_END; it->next()) b.set((uint32_t)it->doc());
         }
+    }
 
-        if (!getline(file, line)) return false;
-        int term_count = atoi(line.c_str());
+    void intersect(DocBitmap& b, const QueryNode& n) const {
+        if (const uint64_t* w = mappedBitmap(n)) {
+            b.andWith(w, bitmapWords(index.docCount()));
+        } else if (wordwise(n) && !sharedResult(n)) {
+            b.andWith(*bitmapOf(n));
+        } else {
+            DocBitmap t(index.docCount());
+            addTo(t, n);
+            b.andWith(t);
+        }
+    }
 
-        for (int i = 0; i < term_count; ++i) {
-            if (!getline(file, line)) return false;
-            size_t p = line.find('|');
-            if (p == string::npos) continue;
+    void subtract(DocBitmap& b, const QueryNode& n) const {
+        if (const uint64_t* w = mappedBitmap(n)) {
+            b.andNotWith(w, bitmapWords(index.docCount()));
+        } else if (wordwise(n) && !sharedResult(n)) {
+            b.andNotWith(*bitmapOf(n));
+        } else {
+            // Редкий вычитаемый: сбросить его биты дешевле, чем строить карту.
+            for (DocIteratorPtr it = build(n); it->doc() != DOC_END; it->next()) b.reset((uint32_t)it->doc());
+        }
+    }
 
-            string term = line.substr(0, p);
-            string doc_list_str = line.substr(p + 1);
+    // Результат узла битовой картой на docCount() документов.
+    unique_ptr<DocBitmap> bitmapOf(const QueryNode& n) const {
+        unique_ptr<DocBitmap> b(new DocBitmap(index.docCount()));
+        switch (n.type) {
+            case QueryNode::NOT:
+                index.liveBitmap(*b);
+                subtract(*b, *n.children[0]);
+                break;
+            case QueryNode::AND:
+                addTo(*b, *n.children[0]);
+                for (size_t i = 1; i < n.children.size(); ++i) intersect(*b, *n.children[i]);
+                break;
+            case QueryNode::ANDNOT:
+                addTo(*b, *n.children[0]);
+                for (size_t i = 1; i < n.children.size(); ++i) subtract(*b, *n.children[i]);
+                break;
+            default:
+                for (auto& c : n.children) addTo(*b, *c);
+        }
+        return b;
+    }
 
-            stringstream ss(doc_list_str);
-            string tok;
-            while (getline(ss, tok, ',')) {
-                if (!tok.empty()) index.add(term, atoi(tok.c_str()));
+    // Дерево ленивых итераторов по плану запроса. Узлы, которые выгоднее
+    // считать по словам, становятся итераторами по готовой битовой карте.
+    DocIteratorPtr build(const QueryNode& n) const {
+        if (QueryCache::Value r = sharedResult(n)) return DocIteratorPtr(new SharedListIterator(r));
+        if (wordwise(n)) return DocIteratorPtr(new BitmapIterator(bitmapOf(n)));
+        vector<DocIteratorPtr> kids;
+        switch (n.type) {
+            case QueryNode::TERM: {
+                uint64_t count;
+                if (const uint64_t* w = index.directBitmap(n.term, count)) {
+                    return DocIteratorPtr(new BitmapIterator(w, index.docCount(), count));
+                }
+                return index.iterator(n.term);
             }
+            case QueryNode::NOT:
+                kids.push_back(build(*n.children[0]));
+                return DocIteratorPtr(new AndNotIterator(index.liveDocs(), std::move(kids)));
+            case QueryNode::AND: {
+                size_t i = 0;
+                if (cache && cache->pairs.enabled() && n.children[0]->type == QueryNode::TERM &&
+                    n.children[1]->type == QueryNode::TERM) {
+                    kids.push_back(DocIteratorPtr(new SharedListIterator(termPair(n.children[0]->term, n.children[1]->term))));
+                    i = 2;
+                }
+                for (; i < n.children.size(); ++i) kids.push_back(build(*n.children[i]));
+                if (kids.size() == 1) return std::move(kids[0]);
+                return DocIteratorPtr(new AndIterator(std::move(kids)));
+            }
+            case QueryNode::OR:
+            case QueryNode::WILDCARD:
+            case QueryNode::FUZZY:
+                // Раскрытый шаблон — n-арное объединение через кучу OrIterator.
+                for (auto& c : n.children) kids.push_back(build(*c));
+                return DocIteratorPtr(new OrIterator(std::move(kids)));
+            case QueryNode::ANDNOT:
+                for (size_t i = 1; i < n.children.size(); ++i) kids.push_back(build(*n.children[i]));
+                return DocIteratorPtr(new AndNotIterator(build(*n.children[0]), std::move(kids)));
+            case QueryNode::PHRASE:
+            case QueryNode::NEAR:
+                return DocIteratorPtr(new PositionalIterator(n, index));
         }
+        return DocIteratorPtr(new CursorIterator(PostingCursor()));
+    }
 
-        cout << "Индекс загружен успешно!\n";
-        cout << "Документов: " << doc_titles.size() << "\n";
-        cout << "Терминов (строк в файле): " << term_count << "\n";
-
-        return true;
+    // fn(i) для каждого шарда, параллельно, если есть пул.
+    template <class Fn>
+    void forEachShard(const Fn& fn) const {
+        if (pool) pool->parallelFor(shards.size(), fn);
+        else for (size_t i = 0; i < shards.size(); ++i) fn(i);
     }
 
-    static vector<int> intersect(const vector<int>& a, const vector<int>& b) {
+    // Шарды покрывают возрастающие диапазоны doc_id, поэтому их ответы
+    // в глобальных doc_id склеиваются подряд.
+    vector<int> evaluateShards(const QueryNode& n) const {
+        vector<vector<int>> parts(shards.size());
+        forEachShard([&](size_t i) {
+            parts[i] = shards[i]->evaluate(n);
+            for (int& d : parts[i]) d += (int)shard_bases[i];
+        });
+        size_t total = 0;
+        for (auto& p : parts) total += p.size();
         vector<int> r;
-        r.reserve(min(a.size(), b.size()));
-        size_t i = 0, j = 0;
-        while (i < a.size() && j < b.size()) {
-            if (a[i] == b[j]) { r.push_back(a[i]); ++i; ++j; }
-            else if (a[i] < b[j]) ++i;
-            else ++j;
-        }
+        r.reserve(total);
+        for (auto& p : parts) r.insert(r.end(), p.begin(), p.end());
         return r;
     }
 
-    static vector<int> unionOp(const vector<int>& a, const vector<int>& b) {
-        vector<int> r;
-        r.reserve(a.size() + b.size());
-        size_t i = 0, j = 0;
-        while (i < a.size() && j < b.size()) {
-            if (a[i] < b[j]) r.push_back(a[i++]);
-            else if (a[i] > b[j]) r.push_back(b[j++]);
-            else { r.push_back(a[i]); ++i; ++j; }
+    vector<int> evaluate(const QueryNode& n) const {
+        if (!shards.empty()) return evaluateShards(n);
+        if (QueryCache::Value r = sharedResult(n)) return *r;
+        if (wordwise(n)) {
+            vector<int> r;
+            bitmapOf(n)->appendDocs(r);
+            return r;
         }
-        while (i < a.size()) r.push_back(a[i++]);
-        while (j < b.size()) r.push_back(b[j++]);
+        DocIteratorPtr it = build(n);
+        return drainIterator(*it, index.docCount());
+    }
+
+    // Пересечение двух самых редких термов конъюнкции — второй уровень
+    // кэша: частые пары термов повторяются и в разных запросах.
+    QueryCache::Value termPair(const string& a, const string& b) const {
+        string key = a < b ? a + " " + b : b + " " + a;
+        QueryCache::Value r = cache->pairs.get(key, generation);
+        if (r) return r;
+        vector<DocIteratorPtr> kids;
+        kids.push_back(index.iterator(a));
+        kids.push_back(index.iterator(b));
+        AndIterator both(std::move(kids));
+        r = make_shared<const vector<int>>(drainIterator(both, index.docCount()));
+        cache->pairs.put(key, generation, r);
         return r;
     }
 
-    vector<int> notOp(const vector<int>& list) const {
-        vector<int> r;
-        r.reserve(doc_titles.size());
+    // Результат плана целиком — первый уровень кэша, ключ — каноническая
+    // запись плана.
+    QueryCache::Value evaluateCached(const QueryNode& plan) const {
+        if (!cache || !cache->results.enabled()) return make_shared<const vector<int>>(evaluate(plan));
+        string key = describeQuery(plan);
+        QueryCache::Value r = cache->results.get(key, generation);
+        if (r) return r;
+        r = make_shared<const vector<int>>(evaluate(plan));
+        cache->results.put(key, generation, r);
+        return r;
+    }
 
-        size_t j = 0;
-        for (int doc = 0; doc < (int)doc_titles.size(); ++doc) {
-            while (j < list.size() && list[j] < doc) ++j;
-            if (j < list.size() && list[j] == doc) continue;
-            r.push_back(doc);
+    static bool needsPositions(const QueryNode& n) {
+        if (n.type == QueryNode::PHRASE || n.type == QueryNode::NEAR) return true;
+        for (auto& c : n.children) {
+            if (needsPositions(*c)) return true;
         }
-        return r;
+        return false;
     }
 
-    static vector<string> tokenizeQuery(const string& query) {
-        vector<string> tokens;
-        stringstream ss(query);
-        string t;
+    // Термы и нечёткие термы запроса к индексу со стеммингом приводятся к
+    // основам так же, как при индексации; шаблоны с '*' остаются как есть.
+    static void stemTerms(QueryNode& n) {
+        if (n.type == QueryNode::TERM || n.type == QueryNode::FUZZY) stemWord(n.term);
+        for (auto& c : n.children) stemTerms(*c);
+    }
 
-        while (ss >> t) {
-            for (size_t i = 0; i < t.size(); ++i) {
-                t[i] = (char)tolower((unsigned char)t[i]);
+    // Подставляет термы словаря в узлы шаблонов и нечётких термов.
+    bool expandPatterns(QueryNode& n, string& error) const {
+        if (n.type == QueryNode::WILDCARD || n.type == QueryNode::FUZZY) {
+            vector<string> terms = index.expand(n.term, n.type == QueryNode::FUZZY, n.distance);
+            if (terms.size() > MAX_EXPANSIONS) {
+                error = "'" + describeQuery(n) + "' раскрывается в " + to_string(terms.size()) +
+                        " термов (не больше " + to_string(MAX_EXPANSIONS) + "), уточните шаблон";
+                return false;
             }
+            for (auto& t : terms) n.children.push_back(QueryPtr(new QueryNode(QueryNode::TERM, t)));
+            return true;
+        }
+        for (auto& c : n.children) {
+            if (!expandPatterns(*c, error)) return false;
+        }
+        return true;
+    }
 
-            while (!t.empty() && !isalnum((unsigned char)t.back())) t.pop_back();
-            while (!t.empty() && !isalnum((unsigned char)t.front())) t.erase(t.begin());
+    // nullptr — пустой запрос (error пуст) или ошибка (error заполнен).
+    QueryPtr planQuery(const string& query, string& error) const {
+        QueryPtr q = QueryParser::parse(query, error);
+        if (!q) return nullptr;
+        if (needsPositions(*q) && !index.hasPositions()) {
+            error = "фразы и NEAR/k требуют индекса с позициями (index_builder --binary --positions)";
+            return nullptr;
+        }
+        if (index.stemmed()) stemTerms(*q);
+        if (!expandPatterns(*q, error)) return nullptr;
+        QueryPlanner planner([this](const string& t) -> uint64_t {
+            return index.docFreq(t);
+        }, index.docCount());
+        return planner.plan(std::move(q));
+    }
 
-            if (!t.empty()) tokens.push_back(t);
+    // Термы, по которым ранжируется результат: входящие в запрос под
+    // чётным числом отрицаний (NOT и вычитаемые ANDNOT).
+    static void positiveTerms(const QueryNode& n, vector<string>& out, bool negated = false) {
+        switch (n.type) {
+            case QueryNode::TERM:
+                if (!negated && find(out.begin(), out.end(), n.term) == out.end()) out.push_back(n.term);
+                return;
+            case QueryNode::NOT:
+                positiveTerms(*n.children[0], out, !negated);
+                return;
+            case QueryNode::ANDNOT:
+                positiveTerms(*n.children[0], out, negated);
+                for (size_t i = 1; i < n.children.size(); ++i) positiveTerms(*n.children[i], out, !negated);
+                return;
+            default:
+                for (auto& c : n.children) positiveTerms(*c, out, negated);
+        }
+    }
+
+    // Терм или OR термов (в том числе раскрытых шаблонов).
+    static bool isDisjunction(const QueryNode& n) {
+        if (n.type == QueryNode::TERM) return true;
+        if (n.type != QueryNode::OR && n.type != QueryNode::WILDCARD && n.type != QueryNode::FUZZY) return false;
+        for (auto& c : n.children) {
+            if (!isDisjunction(*c)) return false;
         }
-        return tokens;
+        return true;
     }
 
 public:
     bool init(const string& index_file) { return loadIndex(index_file); }
 
-   
-    vector<int> executeQuery(const string& query) {
-        vector<string> tokens = tokenizeQuery(query);
-        if (tokens.empty()) return vector<int>();
+    void setCache(QueryCaches* c, uint64_t g) {
+        cache = c;
+        generation = g;
+    }
+
+    // Пул для запросов к шардам; без пула шарды обходятся по очереди.
+    void setPool(WorkStealingPool* p) { pool = p; }
+    bool isSharded() const { return !shards.empty(); }
+
+    void setRanking(int k) {
+        top_k = k;
+        if (top_k > 0 && !index.hasFreqs()) {
+            cerr << "Предупреждение: в индексе нет частот термов, ранжирование только по idf "
+                    "(постройте индекс с --binary)\n";
+        }
+    }
+
+    bool ranked() const { return top_k > 0; }
+
+    uint32_t docCount() const { return index.docCount() - (uint32_t)index.deletedCount(); }
+    // Документ выдачи; текст читается, только если индекс его хранит.
+    bool document(int doc_id, StoredDocument& d, DocBlockCache* cache = nullptr) const {
+        return index.document(doc_id, d, index.hasText(), cache);
+    }
+
+    // words — термы запроса из rankQuery() или executeQuery().
+    SnippetBuilder snippets(const vector<string>& words) const { return SnippetBuilder(words, index.stemmed()); }
+
+    struct RankStats {
+        // Размер булева результата; для WAND он не вычисляется.
+        int64_t matched = -1;
+        uint64_t scored = 0;
+        uint64_t postings = 0;
+    };
+
+private:
+    // Top-k по готовому плану; idf[i] — для words[i], bm и idf считаются
+    // по всему индексу (у шарда — по всем шардам), поэтому оценки
+    // документов не зависят от того, в каком шарде они лежат.
+    vector<ScoredDoc> rankPlan(const QueryNode& plan, const vector<string>& words, const vector<double>& idf,
+                               const Bm25& bm, int k, RankStats& stats) const {
+        deque<vector<int>> storage;
+        vector<RankedTerm> terms;
+        for (size_t i = 0; i < words.size(); ++i) {
+            RankedTerm t;
+            t.cursor = index.cursor(words[i], storage, true);
+            if (!t.cursor.size()) continue;
+            uint32_t max_tf, min_len;
+            index.termBounds(words[i], max_tf, min_len);
+            t.idf = idf[i];
+            t.upper = bm.upperBound(t.idf, max_tf, min_len);
+            stats.postings += t.cursor.size();
+            terms.push_back(t);
+        }
 
-        if (tokens.size() == 1) {
-            return index.get(tokens[0]);
+        auto length = [this](int doc) { return index.docLength(doc); };
+        TopK top((size_t)k);
+        if (isDisjunction(plan)) {
+            stats.scored = wandTopK(terms, bm, length, top);
+        } else {
+            QueryCache::Value candidates = evaluateCached(plan);
+            stats.matched = (int64_t)candidates->size();
+            stats.scored = scoreCandidates(*candidates, terms, bm, length, top);
         }
+        return top.take();
+    }
+
+public:
+    // BM25 top-k. Запрос из одного терма или дизъюнкции термов идёт
+    // через WAND прямо по posting-листам; иначе сначала вычисляется
+    // булев результат, и ранжируются его документы. У шардированного
+    // индекса каждый шард находит свои k лучших, и они сливаются в общую
+    // кучу.
+    // words — термы запроса для сниппетов.
+    vector<ScoredDoc> rankQuery(const string& query, int k, RankStats& stats, string& error,
+                                vector<string>* words = nullptr) const {
+        stats = RankStats();
+        QueryPtr plan = planQuery(query, error);
+        if (!plan) return vector<ScoredDoc>();
+        if (words) positiveTerms(*plan, *words);
+        return rankPlanned(*plan, k, stats);
+    }
+
+    vector<ScoredDoc> rankPlanned(const QueryNode& plan, int k, RankStats& stats) const {
+        stats = RankStats();
+        uint64_t live = index.docCount() - index.deletedCount();
+        Bm25 bm(live, index.hasFreqs() ? index.avgDocLength() : 0);
+        vector<string> words;
+        positiveTerms(plan, words);
+        vector<double> idf;
+        for (auto& w : words) idf.push_back(bm.idf(index.liveDocFreq(w)));
+        if (shards.empty()) return rankPlan(plan, words, idf, bm, k, stats);
+
+        vector<vector<ScoredDoc>> parts(shards.size());
+        vector<RankStats> part_stats(shards.size());
+        forEachShard([&](size_t i) { parts[i] = shards[i]->rankPlan(plan, words, idf, bm, k, part_stats[i]); });
+        TopK top((size_t)k);
+        for (size_t i = 0; i < shards.size(); ++i) {
+            for (auto& d : parts[i]) top.push(d.doc + (int)shard_bases[i], d.score);
+            if (part_stats[i].matched >= 0) stats.matched = max<int64_t>(stats.matched, 0) + part_stats[i].matched;
+            stats.scored += part_stats[i].scored;
+            stats.postings += part_stats[i].postings;
+        }
+        return top.take();
+    }
+
+    // Пакет запросов (--batch): запросы планируются заранее, и узлы,
+    // одинаковые в нескольких планах, считаются один раз.
+    QueryPtr plan(const string& query, string& error) const { return planQuery(query, error); }
+
+    // Булев результат готового плана.
+    QueryCache::Value evaluatePlan(const QueryNode& plan) const { return evaluateCached(plan); }
+
+    // Нужен ли булев результат плана: в ранжированном режиме дизъюнкции
+    // термов идут через WAND прямо по posting-листам.
+    bool evaluatesPlan(const QueryNode& plan) const { return !ranked() || !isDisjunction(plan); }
+
+    // group — одинаковые по describeQuery узлы планов пакета, group[0]
+    // вычисляется. Все группы регистрируются до вычисления первой: потом
+    // таблица только читается, и группы без общих узлов можно считать
+    // параллельно.
+    void prepareShared(const vector<const QueryNode*>& group) {
+        for (auto& s : shards) s->prepareShared(group);
+        if (!shards.empty()) return;
+        for (const QueryNode* n : group) shared_results.emplace(n, nullptr);
+    }
 
-        if (tokens.size() == 2 && tokens[0] == "not") {
-            return notOp(index.get(tokens[1]));
+    // Группы считаются от нижних узлов к верхним, так что общие
+    // подзапросы группы уже готовы.
+    void computeShared(const vector<const QueryNode*>& group) {
+        if (!shards.empty()) {
+            forEachShard([&](size_t i) { shards[i]->computeShared(group); });
+            return;
         }
+        // Плотный терм и так читается готовой картой из индекса.
+        if (mappedBitmap(*group[0])) return;
+        QueryCache::Value r = make_shared<const vector<int>>(evaluate(*group[0]));
+        for (const QueryNode* n : group) shared_results.find(n)->second = r;
+    }
+
+    void clearShared() {
+        for (auto& s : shards) s->clearShared();
+        shared_results.clear();
+    }
 
-        if (tokens.size() == 3) {
-            vector<int> a = index.get(tokens[0]);
-            vector<int> b = index.get(tokens[2]);
-            if (tokens[1] == "and") return intersect(a, b);
-            if (tokens[1] == "or")  return unionOp(a, b);
+    // Заголовок документа и сниппет по его тексту (если индекс хранит
+    // тексты) или превью.
+    void printDocument(int doc_id, SnippetBuilder& snippets, DocBlockCache& cache) const {
+        StoredDocument d;
+        document(doc_id, d, &cache);
+        cout << "    external_id: " << d.title << "\n";
+        string snippet = d.text.empty() ? string() : snippets.build(d.text);
+        if (!snippet.empty()) cout << "    snippet: " << snippet << "\n";
+        else if (!d.preview.empty()) cout << "    preview: " << d.preview << "\n";
+    }
+
+    void printRanked(const vector<ScoredDoc>& results, const RankStats& stats,
+                     const vector<string>& words = vector<string>()) const {
+        if (results.empty()) {
+            cout << "Не найдено документов.\n";
+            return;
         }
 
-        vector<int> result;
-        bool first = true;
-        for (size_t i = 0; i < tokens.size(); ++i) {
-            const string& t = tokens[i];
-            if (t == "and" || t == "or" || t == "not") continue;
+        cout << "==========================================\n";
+        if (stats.matched >= 0) cout << "Найдено документов: " << stats.matched << "\n";
+        cout << "Оценено BM25: " << stats.scored << " док. (постингов в термах запроса: " << stats.postings << ")\n";
+        cout << "Лучшие " << results.size() << " по BM25:\n";
+        cout << "==========================================\n";
+
+        SnippetBuilder sb = snippets(words);
+        DocBlockCache cache;
+        for (size_t i = 0; i < results.size(); ++i) {
+            int doc_id = results[i].doc;
+            cout << "[" << (i + 1) << "] internal_id: " << doc_id << "  score: " << fixed << setprecision(4)
+                 << results[i].score << defaultfloat << "\n";
+            printDocument(doc_id, sb, cache);
+            cout << "------------------------------------------\n";
+        }
+    }
 
-            vector<int> cur = index.get(t);
-            if (first) { result = cur; first = false; }
-            else { result = intersect(result, cur); }
+    void runQuery(const string& query, int limit) const {
+        string error;
+        vector<string> words;
+        if (ranked()) {
+            RankStats stats;
+            vector<ScoredDoc> results = rankQuery(query, top_k, stats, error, &words);
+            if (!error.empty()) cerr << "Ошибка в запросе: " << error << "\n";
+            printRanked(results, stats, words);
+        } else {
+            QueryCache::Value results = executeQuery(query, error, &words);
+            if (!error.empty()) cerr << "Ошибка в запросе: " << error << "\n";
+            printResults(*results, limit, words);
         }
-        return result;
     }
 
-    void printResults(const vector<int>& results, int limit = 10) const {
+    // Результат — общий с кэшем неизменяемый список; words — термы
+    // запроса для сниппетов.
+    QueryCache::Value executeQuery(const string& query, string& error, vector<string>* words = nullptr) const {
+        QueryPtr plan = planQuery(query, error);
+        if (!plan) return make_shared<const vector<int>>();
+        if (words) positiveTerms(*plan, *words);
+        return evaluateCached(*plan);
+    }
+
+    void printResults(const vector<int>& results, int limit = 10,
+                      const vector<string>& words = vector<string>()) const {
         if (results.empty()) {
             cout << "Не найдено документов.\n";
             return;
@@ -257,15 +702,13 @@ public:
         cout << "Показано первых " << min(limit, (int)results.size()) << ":\n";
         cout << "==========================================\n";
 
+        SnippetBuilder sb = snippets(words);
+        DocBlockCache cache;
         int shown = min(limit, (int)results.size());
         for (int i = 0; i < shown; ++i) {
             int doc_id = results[i];
-            string title = (doc_id >= 0 && doc_id < (int)doc_titles.size()) ? doc_titles[doc_id] : "";
-            string preview = (doc_id >= 0 && doc_id < (int)doc_preview.size()) ? doc_preview[doc_id] : "";
-
             cout << "[" << (i + 1) << "] internal_id: " << doc_id << "\n";
-            cout << "    external_id: " << title << "\n";
-            if (!preview.empty()) cout << "    preview: " << preview << "\n";
+            printDocument(doc_id, sb, cache);
             cout << "------------------------------------------\n";
         }
 
@@ -281,51 +724,533 @@ public:
         cout << "  - word1 AND word2\n";
         cout << "  - word1 OR word2\n";
         cout << "  - NOT word\n";
+        cout << "  - (word1 OR word2) AND NOT word3\n";
+        cout << "  - \"exact phrase\", word1 NEAR/3 word2 (индекс с --positions)\n";
+        cout << "  - earthquak*, *quake, ea*ke (шаблоны); earthquke~, word~1 (нечёткий поиск, расстояние до 2)\n";
+        cout << "Приоритет: NEAR/k > NOT > AND > OR\n";
+        if (ranked()) cout << "Ранжирование: BM25, top-" << top_k << "\n";
         cout << "Введите 'quit' для выхода\n";
 
         string query;
         while (true) {
             cout << "\n>> ";
-            getline(cin, query);
+            if (!getline(cin, query)) break;
             if (query == "quit" || query == "exit" || query == "q") break;
             if (query.empty()) continue;
 
-            auto start = high_resolution_clock::now();
-            vector<int> results = executeQuery(query);
-            auto end = high_resolution_clock::now();
+            auto start = steady_clock::now();
+            runQuery(query, 5);
+            auto end = steady_clock::now();
 
-            printResults(results, 5);
-            cout << "Время поиска: " << duration_cast<milliseconds>(end - start).count() << " мс\n";
+            cout << "Время поиска: " << duration_cast<microseconds>(end - start).count() << " мкс\n";
         }
     }
 };
 
+static void appendJsonString(string& out, string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+static string jsonError(const string& message) {
+    string r = "{\"error\":";
+    appendJsonString(r, message);
+    return r + "}";
+}
+
+// Режим --serve: индекс загружается один раз, запросы выполняют воркеры
+// QueryServer параллельно над общим неизменяемым BooleanSearch.
+// Перезагрузка (!reload или SIGHUP) открывает новое поколение индекса
+// рядом со старым и подменяет указатель: запросы, уже взявшие старое
+// поколение, дорабатывают на нём, и оно освобождается вместе с последним.
+//
+// Запросы (по строке):
+//   <запрос>              булев поиск, первые 10 документов
+//   !limit N <запрос>     булев поиск, первые N документов
+//   !top K <запрос>       BM25, K лучших
+//   !reload               перечитать индекс
+//   !stats                поколение, число документов и запросов, счётчики кэша
+// Ответ — одна строка JSON.
+//
+// Кэш запросов общий для всех поколений: после подмены он очищается,
+// а запросы, ещё идущие по старому поколению, в него не пишут.
+class SearchService {
+private:
+    struct Generation {
+        BooleanSearch search;
+        uint64_t number = 0;
+    };
+
+    string index_file;
+    size_t threads;
+    unique_ptr<WorkStealingPool> pool;
+    mutex reload_mu;
+    mutable mutex current_mu;
+    shared_ptr<const Generation> current;
+    atomic<uint64_t> served{0};
+    QueryCaches cache;
+
+    shared_ptr<const Generation> snapshot() const {
+        lock_guard<mutex> lock(current_mu);
+        return current;
+    }
+
+    static bool takeNumber(string& rest, int& value) {
+        size_t sp = rest.find(' ');
+        string num = rest.substr(0, sp);
+        if (num.empty() || num.find_first_not_of("0123456789") != string::npos || num.size() > 9) return false;
+        value = atoi(num.c_str());
+        rest = sp == string::npos ? string() : rest.substr(sp + 1);
+        return value > 0;
+    }
+
+    // Поле snippet — только у индекса с текстами документов.
+    void appendDoc(string& out, const BooleanSearch& s, int doc_id, SnippetBuilder& snippets,
+                   DocBlockCache& block) const {
+        StoredDocument d;
+        s.document(doc_id, d, &block);
+        out += "\"id\":" + to_string(doc_id) + ",\"external_id\":";
+        appendJsonString(out, d.title);
+        out += ",\"preview\":";
+        appendJsonString(out, d.preview);
+        if (d.text.empty()) return;
+        out += ",\"snippet\":";
+        appendJsonString(out, snippets.build(d.text));
+    }
+
+    static string cacheStats(const QueryCache& c) {
+        QueryCache::Stats st = c.stats();
+        return "{\"hits\":" + to_string(st.hits) + ",\"misses\":" + to_string(st.misses) +
+               ",\"rejected\":" + to_string(st.rejected) + ",\"entries\":" + to_string(st.entries) +
+               ",\"bytes\":" + to_string(st.bytes) + "}";
+    }
+
+    string boolean(const Generation& g, const string& query, int limit) const {
+        string error;
+        vector<string> words;
+        QueryCache::Value result = g.search.executeQuery(query, error, &words);
+        if (!error.empty()) return jsonError(error);
+        const vector<int>& docs = *result;
+        SnippetBuilder snippets = g.search.snippets(words);
+        DocBlockCache block;
+        string r = "{\"generation\":" + to_string(g.number) + ",\"found\":" + to_string(docs.size()) + ",\"results\":[";
+        for (size_t i = 0; i < docs.size() && (int)i < limit; ++i) {
+            r += i ? ",{" : "{";
+            appendDoc(r, g.search, docs[i], snippets, block);
+            r += "}";
+        }
+        return r + "]";
+    }
+
+    string ranked(const Generation& g, const string& query, int k) const {
+        string error;
+        BooleanSearch::RankStats stats;
+        vector<string> words;
+        vector<ScoredDoc> docs = g.search.rankQuery(query, k, stats, error, &words);
+        if (!error.empty()) return jsonError(error);
+        SnippetBuilder snippets = g.search.snippets(words);
+        DocBlockCache block;
+        string r = "{\"generation\":" + to_string(g.number);
+        if (stats.matched >= 0) r += ",\"found\":" + to_string(stats.matched);
+        r += ",\"scored\":" + to_string(stats.scored) + ",\"results\":[";
+        char score[32];
+        for (size_t i = 0; i < docs.size(); ++i) {
+            snprintf(score, sizeof(score), "%.6f", docs[i].score);
+            r += i ? ",{" : "{";
+            appendDoc(r, g.search, docs[i].doc, snippets, block);
+            r += ",\"score\":" + string(score) + "}";
+        }
+        return r + "]";
+    }
+
+public:
+    // threads — потоков на запрос к шардированному индексу.
+    SearchService(const string& file, size_t cache_bytes, size_t query_threads)
+        : index_file(file), threads(query_threads), cache(cache_bytes) {}
+
+    // Новое поколение открывается целиком до подмены; при ошибке
+    // остаётся старое.
+    bool reload() {
+        lock_guard<mutex> lock(reload_mu);
+        auto g = make_shared<Generation>();
+        if (!g->search.init(index_file)) {
+            cerr << "Ошибка загрузки индекса, остаётся поколение " << (current ? current->number : 0) << "\n";
+            return false;
+        }
+        shared_ptr<const Generation> old = snapshot();
+        g->number = old ? old->number + 1 : 1;
+        g->search.setCache(&cache, g->number);
+        if (g->search.isSharded() && threads > 1) {
+            if (!pool) pool.reset(new WorkStealingPool(threads - 1));
+            g->search.setPool(pool.get());
+        }
+        {
+            lock_guard<mutex> guard(current_mu);
+            current = g;
+        }
+        cache.setGeneration(g->number);
+        cout << "Поколение индекса: " << g->number << endl;
+        return true;
+    }
+
+    string handle(const string& line) {
+        auto start = steady_clock::now();
+        if (line == "!reload") {
+            if (!reload()) return jsonError("не удалось загрузить индекс");
+            return "{\"generation\":" + to_string(snapshot()->number) + "}";
+        }
+        shared_ptr<const Generation> g = snapshot();
+        if (line == "!stats") {
+            return "{\"generation\":" + to_string(g->number) + ",\"documents\":" + to_string(g->search.docCount()) +
+                   ",\"queries\":" + to_string(served.load()) + ",\"cache\":{\"results\":" +
+                   cacheStats(cache.results) + ",\"pairs\":" + cacheStats(cache.pairs) + "}}";
+        }
+
+        string r;
+        string rest = line;
+        int n = 0;
+        if (line.rfind("!top ", 0) == 0) {
+            rest = line.substr(5);
+            if (!takeNumber(rest, n)) return jsonError("ожидается !top K <запрос>");
+            r = ranked(*g, rest, n);
+        } else if (line.rfind("!limit ", 0) == 0) {
+            rest = line.substr(7);
+            if (!takeNumber(rest, n)) return jsonError("ожидается !limit N <запрос>");
+            r = boolean(*g, rest, n);
+        } else if (!line.empty() && line[0] == '!') {
+            return jsonError("неизвестная команда: " + line);
+        } else {
+            r = boolean(*g, line, 10);
+        }
+        ++served;
+        if (r.rfind("{\"error\"", 0) == 0) return r;
+        return r + ",\"time_us\":" + to_string(duration_cast<microseconds>(steady_clock::now() - start).count()) + "}";
+    }
+};
+
+static int serve(const string& index_file, const string& address, int workers, size_t cache_bytes, int threads) {
+    SearchService service(index_file, cache_bytes, (size_t)threads);
+    if (!service.reload()) return 1;
+
+    QueryServer server([&service](const string& line) { return service.handle(line); },
+                       [&service]() { service.reload(); });
+    bool ok;
+    if (address.rfind("unix:", 0) == 0) {
+        ok = server.listenUnix(address.substr(5));
+    } else {
+        string port = address.rfind("tcp:", 0) == 0 ? address.substr(4) : address;
+        int p = atoi(port.c_str());
+        if (p <= 0 || p > 65535 || port.find_first_not_of("0123456789") != string::npos) {
+            cerr << "Адрес --serve: unix:<путь> или tcp:<порт>\n";
+            return 1;
+        }
+        ok = server.listenTcp(p);
+    }
+    if (!ok) return 1;
+    cout << "Сервер запросов: " << address << ", воркеров: " << workers << endl;
+    server.run(workers);
+    cout << "Сервер остановлен" << endl;
+    return 0;
+}
+
+// fn(0) ... fn(n - 1) в пуле или по очереди, если пула нет.
+template <class Fn>
+static void forAll(WorkStealingPool* pool, size_t n, const Fn& fn) {
+    if (pool) pool->parallelFor(n, fn);
+    else for (size_t i = 0; i < n; ++i) fn(i);
+}
+
+struct BatchQuery {
+    size_t line = 0;
+    string text;
+    QueryPtr plan;
+    string error;
+    // -1 — размер результата не вычислялся (WAND).
+    int64_t found = 0;
+    string results;
+    int64_t plan_ns = 0;
+    int64_t eval_ns = 0;
+};
+
+// Узлы планов пакета с одинаковой канонической записью. nodes[0] —
+// узел, в который обход спускался; под остальными узлами ничего не
+// вычисляется, поэтому их поддеревья не учитываются.
+struct BatchGroup {
+    vector<const QueryNode*> nodes;
+    int height = 0;
+    bool term = false;
+};
+
+// Возвращает высоту узла. Позиции фраз и NEAR/k читаются из индекса
+// напрямую, поэтому их термы не собираются.
+static int collectShared(const QueryNode& n, unordered_map<string, BatchGroup>& groups) {
+    BatchGroup& g = groups[to_string((int)n.type) + " " + describeQuery(n)];
+    g.nodes.push_back(&n);
+    if (g.nodes.size() > 1) return g.height;
+    g.term = n.type == QueryNode::TERM;
+    int h = 0;
+    if (n.type != QueryNode::PHRASE && n.type != QueryNode::NEAR) {
+        for (auto& c : n.children) h = max(h, collectShared(*c, groups) + 1);
+    }
+    g.height = h;
+    return h;
+}
+
+// Задержка по рангу: наименьшее значение, не меньше которого p% выборки.
+static int64_t percentile(const vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)ceil(p / 100 * (double)sorted.size());
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static double msSince(steady_clock::time_point start) {
+    return duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0;
+}
+
+// Пакетный режим: все запросы файла разбираются и планируются заранее,
+// подзапросы и термы, встречающиеся в нескольких планах, вычисляются
+// один раз (по высоте узла, каждая высота — параллельно), затем
+// запросы выполняются параллельно над общими результатами.
+static int runBatch(BooleanSearch& searcher, WorkStealingPool* pool, const string& batch_file,
+                    const string& output_file, int limit, int top_k) {
+    ifstream in(batch_file);
+    if (!in) {
+        cerr << "Не удалось открыть файл запросов: " << batch_file << "\n";
+        return 1;
+    }
+    vector<BatchQuery> queries;
+    string line;
+    for (size_t no = 1; getline(in, line); ++no) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        queries.emplace_back();
+        queries.back().line = no;
+        queries.back().text = line;
+    }
+
+    ofstream file;
+    if (!output_file.empty()) {
+        file.open(output_file);
+        if (!file) {
+            cerr << "Не удалось создать файл результатов: " << output_file << "\n";
+            return 1;
+        }
+    }
+    ostream& out = output_file.empty() ? cout : file;
+    ostream& report = output_file.empty() ? cerr : cout;
+
+    auto start = steady_clock::now();
+    forAll(pool, queries.size(), [&](size_t i) {
+        BatchQuery& q = queries[i];
+        auto t = steady_clock::now();
+        q.plan = searcher.plan(q.text, q.error);
+        q.plan_ns = duration_cast<nanoseconds>(steady_clock::now() - t).count();
+    });
+    double plan_ms = msSince(start);
+
+    auto shared_start = steady_clock::now();
+    unordered_map<string, BatchGroup> groups;
+    for (auto& q : queries) {
+        if (q.plan && searcher.evaluatesPlan(*q.plan)) collectShared(*q.plan, groups);
+    }
+    size_t terms = 0, shared_terms = 0, uses = 0;
+    vector<const BatchGroup*> shared;
+    for (auto& g : groups) {
+        if (g.second.term) ++terms;
+        if (g.second.nodes.size() < 2) continue;
+        shared.push_back(&g.second);
+        if (g.second.term) ++shared_terms;
+        uses += g.second.nodes.size();
+    }
+    sort(shared.begin(), shared.end(), [](const BatchGroup* a, const BatchGroup* b) { return a->height < b->height; });
+    for (const BatchGroup* g : shared) searcher.prepareShared(g->nodes);
+    for (size_t from = 0; from < shared.size();) {
+        size_t to = from;
+        while (to < shared.size() && shared[to]->height == shared[from]->height) ++to;
+        forAll(pool, to - from, [&](size_t i) { searcher.computeShared(shared[from + i]->nodes); });
+        from = to;
+    }
+    double shared_ms = msSince(shared_start);
+
+    auto eval_start = steady_clock::now();
+    forAll(pool, queries.size(), [&](size_t i) {
+        BatchQuery& q = queries[i];
+        if (!q.plan) return;
+        auto t = steady_clock::now();
+        if (top_k > 0) {
+            BooleanSearch::RankStats stats;
+            vector<ScoredDoc> docs = searcher.rankPlanned(*q.plan, top_k, stats);
+            q.found = stats.matched;
+            char score[32];
+            for (size_t j = 0; j < docs.size(); ++j) {
+                snprintf(score, sizeof(score), "%.4f", docs[j].score);
+                q.results += (j ? "," : "") + to_string(docs[j].doc) + ":" + score;
+            }
+        } else {
+            QueryCache::Value docs = searcher.evaluatePlan(*q.plan);
+            q.found = (int64_t)docs->size();
+            for (size_t j = 0; j < docs->size() && (int)j < limit; ++j) {
+                q.results += (j ? "," : "") + to_string((*docs)[j]);
+            }
+        }
+        q.eval_ns = duration_cast<nanoseconds>(steady_clock::now() - t).count();
+    });
+    double eval_ms = msSince(eval_start);
+    double total_ms = msSince(start);
+    searcher.clearShared();
+
+    out << "# line\tfound\tlatency_us\tresults\tquery\n";
+    size_t errors = 0;
+    vector<int64_t> latency;
+    for (auto& q : queries) {
+        int64_t us = (q.plan_ns + q.eval_ns) / 1000;
+        latency.push_back(us);
+        out << q.line << "\t";
+        if (!q.error.empty()) {
+            ++errors;
+            out << "error\t" << us << "\t" << q.error;
+        } else {
+            out << (q.found >= 0 ? to_string(q.found) : string("-")) << "\t" << us << "\t" << q.results;
+        }
+        out << "\t" << q.text << "\n";
+    }
+    out.flush();
+    sort(latency.begin(), latency.end());
+
+    report << "Запросов: " << queries.size() << " (ошибок: " << errors << "), потоков: "
+           << (pool ? pool->workers() + 1 : 1) << "\n";
+    report << "Различных термов: " << terms << ", общих подзапросов: " << shared.size() << " (из них термов: "
+           << shared_terms << ", использований: " << uses << ")\n";
+    report << fixed << setprecision(1) << "Планирование: " << plan_ms << " мс, общие подзапросы: " << shared_ms
+           << " мс, выполнение: " << eval_ms << " мс, всего: " << total_ms << " мс ("
+           << (total_ms > 0 ? queries.size() * 1000.0 / total_ms : 0.0) << " запросов/с)\n" << defaultfloat;
+    report << "Задержка запроса, мкс: p50 " << percentile(latency, 50) << ", p90 " << percentile(latency, 90)
+           << ", p99 " << percentile(latency, 99) << ", max " << (latency.empty() ? 0 : latency.back()) << "\n";
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     BooleanSearch searcher;
     string index_file = "data/boolean_index.idx";
+    string query;
+    int top_k = 0;
+    string serve_address;
+    int workers = max(1, (int)thread::hardware_concurrency());
+    int threads = workers;
+    int cache_mb = 64;
+    string batch_file;
+    string output_file;
+    int limit = 5;
 
-    if (argc >= 2) {
-        if (string(argv[1]) == "--index" && argc >= 3) {
-            index_file = argv[2];
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--index" && i + 1 < argc) {
+            index_file = argv[++i];
+        } else if (arg == "--ranked") {
+            if (!top_k) top_k = 10;
+        } else if (arg == "--top" && i + 1 < argc) {
+            top_k = atoi(argv[++i]);
+            if (top_k <= 0) {
+                cerr << "--top ожидает положительное число\n";
+                return 1;
+            }
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            cache_mb = atoi(argv[++i]);
+            if (cache_mb < 0) {
+                cerr << "--cache-mb ожидает неотрицательное число\n";
+                return 1;
+            }
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_address = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            if (workers <= 0) {
+                cerr << "--workers ожидает положительное число\n";
+                return 1;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads <= 0) {
+                cerr << "--threads ожидает положительное число\n";
+                return 1;
+            }
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch_file = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_file = argv[++i];
+        } else if (arg == "--limit" && i + 1 < argc) {
+            limit = atoi(argv[++i]);
+            if (limit <= 0) {
+                cerr << "--limit ожидает положительное число\n";
+                return 1;
+            }
+        } else if (arg.rfind("--", 0) != 0 && query.empty()) {
+            query = arg;
+        } else {
+            cerr << "Неизвестный параметр: " << arg << "\n";
+            cerr << "Использование: " << argv[0] << " [--index <файл>] [--ranked] [--top K] [--threads N] [\"запрос\"]\n";
+            cerr << "       " << argv[0] << " [--index <файл>] [--top K] --batch <файл> [--output <файл>] [--limit N] [--threads N]\n";
+            cerr << "       " << argv[0] << " [--index <файл>] --serve unix:<путь>|tcp:<порт> [--workers N]\n";
+            cerr << "  --ranked  ранжировать результат по BM25 (top-10)\n";
+            cerr << "  --top K   ранжировать и показать K лучших\n";
+            cerr << "  --serve   сервер запросов (строка запроса -> строка JSON), SIGHUP перечитывает индекс\n";
+            cerr << "  --cache-mb N  бюджет кэша результатов и пересечений (по умолчанию 64, 0 — без кэша)\n";
+            cerr << "  --threads N   потоков на запрос к шардированному индексу и на пакет (по умолчанию — число ядер)\n";
+            cerr << "  --batch       выполнить запросы файла (строка — запрос) пакетом с общими подзапросами\n";
+            cerr << "  --output      файл результатов пакета (TSV, по умолчанию stdout)\n";
+            cerr << "  --limit N     doc_id в результате булева запроса (по умолчанию 5)\n";
+            return 1;
         }
     }
 
-    ifstream index_check(index_file.c_str());
-    if (!index_check) {
+    struct stat index_check;
+    if (stat(index_file.c_str(), &index_check) != 0) {
         cerr << "Индекс не найден: " << index_file << "\n";
         cerr << "Сначала постройте индекс вашим index_builder.\n";
         return 1;
     }
 
-    if (!searcher.init(index_file)) {
+    size_t cache_bytes = (size_t)cache_mb << 20;
+    if (!serve_address.empty()) return serve(index_file, serve_address, workers, cache_bytes, threads);
+
+    // Результаты пакета могут идти в stdout: сводка загрузки — в stderr.
+    streambuf* stdout_buf = batch_file.empty() ? nullptr : cout.rdbuf(cerr.rdbuf());
+    bool loaded = searcher.init(index_file);
+    if (stdout_buf) cout.rdbuf(stdout_buf);
+    if (!loaded) {
         cerr << "Ошибка загрузки индекса!\n";
         return 1;
     }
 
-    if (argc == 2 && string(argv[1]).rfind("--", 0) != 0) {
-        string query = argv[1];
-        vector<int> results = searcher.executeQuery(query);
-        searcher.printResults(results, 5);
+    searcher.setRanking(top_k);
+    QueryCaches cache(cache_bytes);
+    searcher.setCache(&cache, 0);
+    unique_ptr<WorkStealingPool> pool;
+    if ((searcher.isSharded() || !batch_file.empty()) && threads > 1) {
+        pool.reset(new WorkStealingPool((size_t)threads - 1));
+        // Пакет параллелится по запросам, шарды запроса обходятся по
+        // очереди: иначе поток, ждущий свои шарды, выполнял бы чужие
+        // запросы, и их время попадало бы в его задержку.
+        if (batch_file.empty()) searcher.setPool(pool.get());
+    }
+
+    if (!batch_file.empty()) return runBatch(searcher, pool.get(), batch_file, output_file, limit, top_k);
+
+    if (!query.empty()) {
+        searcher.runQuery(query, limit);
         return 0;
     }
 
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <sstream>
+
+#include "index_format.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Сравнивает сжатые posting-листы с текстовым форматом индекса
+// (term|doc1,doc2,...) и с несжатым массивом int32 по размеру и
+// скорости декодирования.
+
+static size_t decimalLength(int v) {
+    size_t n = 1;
+    while (v >= 10) { v /= 10; ++n; }
+    return n;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        cerr << "Использование: " << argv[0] << " <файл_индекса>" << endl;
+        return 1;
+    }
+
+    MappedIndex index;
+    if (isBinaryIndexFile(argv[1])) {
+        if (!index.open(argv[1])) return 1;
+    } else {
+        string image;
+        if (!convertTextIndex(argv[1], image) || !index.openBuffer(std::move(image))) return 1;
+    }
+
+    vector<vector<int>> lists;
+    vector<EncodedPostings> encoded;
+    lists.reserve(index.termCount());
+    encoded.reserve(index.termCount());
+
+    uint64_t postings = 0, text_bytes = 0, compressed_bytes = 0;
+    for (uint32_t t = 0; t < index.termCount(); ++t) {
+        const TermEntry* e = index.termAt(t);
+        encoded.push_back(index.postings(e));
+        lists.push_back(decodeAll(PostingCursor(encoded.back())));
+        const vector<int>& l = lists.back();
+        postings += l.size();
+        compressed_bytes += e->postings_size;
+        for (size_t i = 0; i < l.size(); ++i) text_bytes += decimalLength(l[i]) + (i ? 1 : 0);
+    }
+    uint64_t raw_bytes = postings * sizeof(int);
+
+    string text;
+    text.reserve(text_bytes + lists.size());
+    for (auto& l : lists) {
+        for (size_t i = 0; i < l.size(); ++i) {
+            if (i) text += ',';
+            text += to_string(l[i]);
+        }
+        text += '\n';
+    }
+
+    auto start = high_resolution_clock::now();
+    uint64_t checksum_text = 0;
+    {
+        stringstream all(text);
+        string line, tok;
+        while (getline(all, line)) {
+            stringstream ss(line);
+            while (getline(ss, tok, ',')) checksum_text += atoi(tok.c_str());
+        }
+    }
+    double text_sec = duration<double>(high_resolution_clock::now() - start).count();
+
+    start = high_resolution_clock::now();
+    uint64_t checksum_raw = 0;
+    for (auto& l : lists) {
+        for (int d : l) checksum_raw += d;
+    }
+    double raw_sec = duration<double>(high_resolution_clock::now() - start).count();
+
+    const int rounds = 5;
+    start = high_resolution_clock::now();
+    uint64_t checksum_codec = 0;
+    for (int r = 0; r < rounds; ++r) {
+        for (auto& p : encoded) {
+            for (PostingCursor c(p); c.valid(); c.next()) checksum_codec += c.doc();
+        }
+    }
+    double codec_sec = duration<double>(high_resolution_clock::now() - start).count() / rounds;
+
+    if (checksum_text != checksum_raw || checksum_codec != checksum_raw * rounds) {
+        cerr << "Ошибка: контрольные суммы декодирования не совпадают" << endl;
+        return 2;
+    }
+
+    auto mps = [&](double sec) { return sec > 0 ? postings / sec / 1e6 : 0.0; };
+
+    cout << "======= POSTING CODEC =======" << endl;
+    cout << "Терминов: " << index.termCount() << endl;
+    cout << "Постингов: " << postings << endl;
+    cout << "Размер (текст):   " << text_bytes << " байт, "
+         << (postings ? (double)text_bytes * 8 / postings : 0) << " бит/постинг" << endl;
+    cout << "Размер (int32):   " << raw_bytes << " байт, 32 бит/постинг" << endl;
+    cout << "Размер (блоки):   " << compressed_bytes << " байт, "
+         << (postings ? (double)compressed_bytes * 8 / postings : 0) << " бит/постинг" << endl;
+    cout << "Сжатие относительно текста: " << (compressed_bytes ? (double)text_bytes / compressed_bytes : 0) << "x" << endl;
+    cout << "Декодирование (текст):  " << mps(text_sec) << " млн постингов/сек" << endl;
+    cout << "Чтение (int32):         " << mps(raw_sec) << " млн постингов/сек" << endl;
+    cout << "Декодирование (блоки):  " << mps(codec_sec) << " млн постингов/сек" << endl;
+    cout << "=============================" << endl;
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <sstream>
+#include <string>
+
+#include "index_format.h"
+#include "term_dictionary.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Сравнивает словари термов на словаре из frequencies.csv:
+//  - прежнюю цепочечную таблицу (1 000 000 корзин, узел и ключ на
+//    отдельных выделениях) с TermDictionary — подсчёт частот по потоку
+//    токенов с распределением Ципфа из того же файла и поиск;
+//  - бинарный поиск по TermEntry бинарного индекса с поиском по
+//    массиву префиксов SEC_TERM_PREFIXES.
+
+struct ChainNode {
+    char* word;
+    int frequency;
+    ChainNode* next;
+};
+
+// Таблица, которая раньше стояла в tokenizer и index_builder.
+class ChainedTable {
+    static const int TABLE_SIZE = 1000000;
+    ChainNode** table;
+    size_t nodes = 0;
+    size_t key_bytes = 0;
+
+    static unsigned int hash(string_view str) {
+        unsigned int h = 5381;
+        for (unsigned char c : str) h = ((h << 5) + h) + c;
+        return h % TABLE_SIZE;
+    }
+
+public:
+    ChainedTable() { table = new ChainNode*[TABLE_SIZE](); }
+
+    ~ChainedTable() {
+        for (int i = 0; i < TABLE_SIZE; ++i) {
+            ChainNode* node = table[i];
+            while (node) {
+                ChainNode* tmp = node;
+                node = node->next;
+                free(tmp->word);
+                delete tmp;
+            }
+        }
+        delete[] table;
+    }
+
+    int& operator[](string_view w) {
+        unsigned int h = hash(w);
+        for (ChainNode* node = table[h]; node; node = node->next) {
+            if (strncmp(node->word, w.data(), w.size()) == 0 && node->word[w.size()] == '\0') return node->frequency;
+        }
+        ChainNode* n = new ChainNode;
+        n->word = (char*)malloc(w.size() + 1);
+        memcpy(n->word, w.data(), w.size());
+        n->word[w.size()] = '\0';
+        n->frequency = 0;
+        n->next = table[h];
+        table[h] = n;
+        ++nodes;
+        key_bytes += w.size() + 1;
+        return n->frequency;
+    }
+
+    const int* find(string_view w) const {
+        for (ChainNode* node = table[hash(w)]; node; node = node->next) {
+            if (strncmp(node->word, w.data(), w.size()) == 0 && node->word[w.size()] == '\0') return &node->frequency;
+        }
+        return nullptr;
+    }
+
+    // Корзины, узлы и ключи; malloc добавляет к каждому выделению ещё ~16 байт.
+    size_t memoryBytes() const {
+        return (size_t)TABLE_SIZE * sizeof(ChainNode*) + nodes * (sizeof(ChainNode) + 16) + key_bytes + nodes * 16;
+    }
+};
+
+static double secondsSince(high_resolution_clock::time_point t) {
+    return duration<double>(high_resolution_clock::now() - t).count();
+}
+
+int main(int argc, char* argv[]) {
+    string csv = argc > 1 ? argv[1] : "results/frequencies.csv";
+    size_t stream_len = argc > 2 ? (size_t)atoll(argv[2]) : 5000000;
+
+    ifstream in(csv);
+    if (!in) {
+        cerr << "Использование: " << argv[0] << " [frequencies.csv] [токенов в потоке]" << endl;
+        cerr << "Не удалось открыть " << csv << " (сначала запустите tokenizer)" << endl;
+        return 1;
+    }
+    vector<string> words;
+    vector<double> cumulative;
+    string line;
+    getline(in, line);
+    double total = 0;
+    while (getline(in, line)) {
+        size_t a = line.find(','), b = line.find(',', a + 1);
+        if (a == string::npos || b == string::npos) continue;
+        total += atof(line.substr(a + 1, b - a - 1).c_str());
+        words.push_back(line.substr(b + 1));
+        cumulative.push_back(total);
+    }
+    if (words.empty()) {
+        cerr << "Пустой словарь: " << csv << endl;
+        return 1;
+    }
+
+    // Поток токенов с частотами из файла (детерминированный LCG).
+    vector<uint32_t> stream(stream_len);
+    uint64_t seed = 88172645463325252ull;
+    for (auto& id : stream) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        double x = (double)(seed >> 11) / (double)(1ull << 53) * total;
+        id = (uint32_t)(upper_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin());
+        if (id >= words.size()) id = (uint32_t)words.size() - 1;
+    }
+    vector<string> misses;
+    for (size_t i = 0; i < words.size(); ++i) misses.push_back(words[i] + "#");
+
+    cout << "======= СЛОВАРЬ ТЕРМОВ =======" << endl;
+    cout << "Термов: " << words.size() << ", токенов в потоке: " << stream.size() << endl;
+    auto mops = [](size_t n, double sec) { return sec > 0 ? n / sec / 1e6 : 0.0; };
+
+    uint64_t check_old = 0, check_new = 0;
+    double old_count, old_hit, old_miss, new_count, new_hit, new_miss;
+    size_t old_mem, new_mem;
+    {
+        auto t = high_resolution_clock::now();
+        ChainedTable table;
+        for (uint32_t id : stream) table[words[id]]++;
+        old_count = secondsSince(t);
+        t = high_resolution_clock::now();
+        for (uint32_t id : stream) check_old += *table.find(words[id]);
+        old_hit = secondsSince(t);
+        t = high_resolution_clock::now();
+        for (auto& w : misses) check_old += table.find(w) != nullptr;
+        old_miss = secondsSince(t);
+        old_mem = table.memoryBytes();
+    }
+    {
+        auto t = high_resolution_clock::now();
+        TermDictionary<int> table;
+        for (uint32_t id : stream) table[words[id]]++;
+        new_count = secondsSince(t);
+        t = high_resolution_clock::now();
+        for (uint32_t id : stream) check_new += table.value(table.find(words[id]));
+        new_hit = secondsSince(t);
+        t = high_resolution_clock::now();
+        for (auto& w : misses) check_new += table.find(w) != TermDictionary<int>::NOT_FOUND;
+        new_miss = secondsSince(t);
+        new_mem = table.memoryBytes();
+    }
+    if (check_old != check_new) {
+        cerr << "Ошибка: результаты таблиц не совпадают" << endl;
+        return 2;
+    }
+
+    cout << "Подсчёт частот (цепочки):    " << mops(stream.size(), old_count) << " млн токенов/сек" << endl;
+    cout << "Подсчёт частот (открытая):   " << mops(stream.size(), new_count) << " млн токенов/сек" << endl;
+    cout << "Поиск, попадания (цепочки):  " << mops(stream.size(), old_hit) << " млн/сек" << endl;
+    cout << "Поиск, попадания (открытая): " << mops(stream.size(), new_hit) << " млн/сек" << endl;
+    cout << "Поиск, промахи (цепочки):    " << mops(misses.size(), old_miss) << " млн/сек" << endl;
+    cout << "Поиск, промахи (открытая):   " << mops(misses.size(), new_miss) << " млн/сек" << endl;
+    cout << "Память (цепочки):  " << old_mem / 1024 << " КБ" << endl;
+    cout << "Память (открытая): " << new_mem / 1024 << " КБ" << endl;
+
+    // Бинарный индекс с этим словарём (по одному постингу на терм).
+    BinaryIndexWriter::TermList terms;
+    for (auto& w : words) {
+        terms.emplace_back(w, PostingList());
+        terms.back().second.docs.push_back(0);
+    }
+    ostringstream image;
+    if (!BinaryIndexWriter::write(image, {"doc"}, {""}, terms)) return 1;
+    MappedIndex index;
+    if (!index.openBuffer(image.str())) return 1;
+
+    auto t = high_resolution_clock::now();
+    uint64_t found_old = 0, found_new = 0;
+    const TermEntry* first = index.termAt(0);
+    const TermEntry* last = first + index.termCount();
+    for (uint32_t id : stream) {
+        string_view k = words[id];
+        const TermEntry* it = lower_bound(first, last, k,
+            [&index](const TermEntry& e, string_view key) { return index.termKey(e) < key; });
+        found_old += it != last && index.termKey(*it) == k;
+    }
+    double sorted_old = secondsSince(t);
+    t = high_resolution_clock::now();
+    for (uint32_t id : stream) found_new += index.findTerm(words[id]) != nullptr;
+    double sorted_new = secondsSince(t);
+    if (found_old != stream.size() || found_new != stream.size()) {
+        cerr << "Ошибка: не все термы найдены в индексе" << endl;
+        return 2;
+    }
+    cout << "Поиск в индексе (TermEntry): " << mops(stream.size(), sorted_old) << " млн/сек" << endl;
+    cout << "Поиск в индексе (префиксы):  " << mops(stream.size(), sorted_new) << " млн/сек" << endl;
+    cout << "==============================" << endl;
+    return 0;
+}
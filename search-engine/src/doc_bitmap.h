@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "doc_iterator.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define DOC_BITMAP_X86 1
+#include <immintrin.h>
+#endif
+
+// Битовые карты документов для плотных термов и плотных подзапросов:
+// бит d — документ d. AND, OR, NOT и ANDNOT над ними — проход по словам
+// (AVX2 по 256 бит, если процессор умеет, иначе по 64), число документов —
+// popcount (AVX2: подсчёт по полубайтам через pshufb и сумма через sad).
+// Стоимость таких операций определяется пропускной способностью памяти,
+// а не числом документов и ветвлений на каждый.
+//
+// Терм с doc_freq не меньше doc_count / BITMAP_DENSITY (порог контейнеров
+// roaring: 4096 из 65536) index_builder дополнительно пишет битовой
+// картой; сжатый posting-лист остаётся — по нему читаются частоты и позиции.
+
+static const uint32_t BITMAP_DENSITY = 16;
+
+static inline size_t bitmapWords(size_t bits) { return (bits + 63) / 64; }
+
+static inline void bitmapAndScalar(uint64_t* dst, const uint64_t* src, size_t from, size_t n) {
+    for (size_t i = from; i < n; ++i) dst[i] &= src[i];
+}
+
+static inline void bitmapOrScalar(uint64_t* dst, const uint64_t* src, size_t from, size_t n) {
+    for (size_t i = from; i < n; ++i) dst[i] |= src[i];
+}
+
+static inline void bitmapAndNotScalar(uint64_t* dst, const uint64_t* src, size_t from, size_t n) {
+    for (size_t i = from; i < n; ++i) dst[i] &= ~src[i];
+}
+
+static inline uint64_t bitmapCountScalar(const uint64_t* w, size_t from, size_t n) {
+    uint64_t c = 0;
+    for (size_t i = from; i < n; ++i) c += (uint64_t)__builtin_popcountll(w[i]);
+    return c;
+}
+
+#ifdef DOC_BITMAP_X86
+static inline bool bitmapHasAvx2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+
+// Операция op над 4 словами за шаг; возвращает число обработанных слов.
+#define DOC_BITMAP_AVX2_KERNEL(name, expr)                                          \
+    __attribute__((target("avx2")))                                                 \
+    static inline size_t name(uint64_t* dst, const uint64_t* src, size_t n) {       \
+        size_t i = 0;                                                               \
+        for (; i + 4 <= n; i += 4) {                                                \
+            __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));              \
+            __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));              \
+            _mm256_storeu_si256((__m256i*)(dst + i), expr);                         \
+        }                                                                           \
+        return i;                                                                   \
+    }
+
+DOC_BITMAP_AVX2_KERNEL(bitmapAndAvx2, _mm256_and_si256(a, b))
+DOC_BITMAP_AVX2_KERNEL(bitmapOrAvx2, _mm256_or_si256(a, b))
+DOC_BITMAP_AVX2_KERNEL(bitmapAndNotAvx2, _mm256_andnot_si256(b, a))
+#undef DOC_BITMAP_AVX2_KERNEL
+
+// Popcount Мулы: число бит каждого полубайта — из таблицы через pshufb,
+// суммы байтов — через sad с нулём.
+__attribute__((target("avx2")))
+static inline uint64_t bitmapCountAvx2(const uint64_t* w, size_t n, size_t& done) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(w + i));
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low));
+        __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+    done = i;
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, total);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+static inline void bitmapAnd(uint64_t* dst, const uint64_t* src, size_t n) {
+    size_t done = 0;
+#ifdef DOC_BITMAP_X86
+    if (bitmapHasAvx2()) done = bitmapAndAvx2(dst, src, n);
+#endif
+    bitmapAndScalar(dst, src, done, n);
+}
+
+static inline void bitmapOr(uint64_t* dst, const uint64_t* src, size_t n) {
+    size_t done = 0;
+#ifdef DOC_BITMAP_X86
+    if (bitmapHasAvx2()) done = bitmapOrAvx2(dst, src, n);
+#endif
+    bitmapOrScalar(dst, src, done, n);
+}
+
+static inline void bitmapAndNot(uint64_t* dst, const uint64_t* src, size_t n) {
+    size_t done = 0;
+#ifdef DOC_BITMAP_X86
+    if (bitmapHasAvx2()) done = bitmapAndNotAvx2(dst, src, n);
+#endif
+    bitmapAndNotScalar(dst, src, done, n);
+}
+
+static inline uint64_t bitmapCount(const uint64_t* w, size_t n) {
+    size_t done = 0;
+    uint64_t c = 0;
+#ifdef DOC_BITMAP_X86
+    if (bitmapHasAvx2()) c = bitmapCountAvx2(w, n, done);
+#endif
+    return c + bitmapCountScalar(w, done, n);
+}
+
+// Битовая карта на bits документов.
+class DocBitmap {
+private:
+    std::vector<uint64_t> words;
+    size_t bits;
+
+public:
+    explicit DocBitmap(size_t n) : words(bitmapWords(n), 0), bits(n) {}
+
+    size_t size() const { return bits; }
+    size_t wordCount() const { return words.size(); }
+    const uint64_t* data() const { return words.data(); }
+    uint64_t* data() { return words.data(); }
+
+    void set(uint32_t d) { words[d >> 6] |= 1ull << (d & 63); }
+    void reset(uint32_t d) { words[d >> 6] &= ~(1ull << (d & 63)); }
+
+    // Документы [begin, end).
+    void setRange(uint32_t begin, uint32_t end) {
+        for (; begin < end && (begin & 63); ++begin) set(begin);
+        for (; begin + 64 <= end; begin += 64) words[begin >> 6] = ~0ull;
+        for (; begin < end; ++begin) set(begin);
+    }
+
+    // Слова другой карты (лишние отбрасываются, недостающие считаются нулями).
+    void andWith(const uint64_t* src, size_t n) {
+        size_t m = std::min(n, words.size());
+        bitmapAnd(words.data(), src, m);
+        std::fill(words.begin() + m, words.end(), 0);
+    }
+    void orWith(const uint64_t* src, size_t n) { bitmapOr(words.data(), src, std::min(n, words.size())); }
+    void andNotWith(const uint64_t* src, size_t n) { bitmapAndNot(words.data(), src, std::min(n, words.size())); }
+
+    void andWith(const DocBitmap& o) { andWith(o.data(), o.wordCount()); }
+    void orWith(const DocBitmap& o) { orWith(o.data(), o.wordCount()); }
+    void andNotWith(const DocBitmap& o) { andNotWith(o.data(), o.wordCount()); }
+
+    // ИЛИ с картой src из src_bits документов, сдвинутой на base
+    // (сегмент каталога индекса в глобальных doc_id).
+    void orShifted(const uint64_t* src, size_t src_bits, uint32_t base) {
+        size_t n = bitmapWords(src_bits);
+        unsigned shift = base & 63;
+        size_t at = base >> 6;
+        if (at >= words.size()) return;
+        if (!shift) {
+            bitmapOr(words.data() + at, src, std::min(n, words.size() - at));
+            return;
+        }
+        for (size_t i = 0; i < n && at + i < words.size(); ++i) {
+            words[at + i] |= src[i] << shift;
+            if (at + i + 1 < words.size()) words[at + i + 1] |= src[i] >> (64 - shift);
+        }
+    }
+
+    // Сбрасывает биты за пределами size().
+    void trim() {
+        if (bits & 63) words.back() &= (1ull << (bits & 63)) - 1;
+    }
+
+    uint64_t count() const { return bitmapCount(words.data(), words.size()); }
+
+    // doc_id всех установленных бит по возрастанию.
+    void appendDocs(std::vector<int>& out) const {
+        out.reserve(out.size() + (size_t)count());
+        for (size_t i = 0; i < words.size(); ++i) {
+            for (uint64_t w = words[i]; w; w &= w - 1) out.push_back((int)(i * 64 + (size_t)__builtin_ctzll(w)));
+        }
+    }
+};
+
+// Итератор по битовой карте: своей (owned) или отображённой из индекса.
+// advance() — переход сразу к слову target, без просмотра промежуточных.
+class BitmapIterator : public DocIterator {
+private:
+    std::unique_ptr<DocBitmap> owned;
+    const uint64_t* words;
+    size_t n;
+    uint64_t total;
+
+    void seek(size_t from) {
+        size_t i = from >> 6;
+        if (i >= n) {
+            current = DOC_END;
+            return;
+        }
+        uint64_t w = words[i] & (~0ull << (from & 63));
+        while (!w) {
+            if (++i >= n) {
+                current = DOC_END;
+                return;
+            }
+            w = words[i];
+        }
+        current = (int)(i * 64 + (size_t)__builtin_ctzll(w));
+    }
+
+public:
+    explicit BitmapIterator(std::unique_ptr<DocBitmap> b)
+        : owned(std::move(b)), words(owned->data()), n(owned->wordCount()), total(owned->count()) {
+        seek(0);
+    }
+
+    // count — число документов карты, если известно заранее.
+    BitmapIterator(const uint64_t* w, size_t bits, uint64_t count)
+        : words(w), n(bitmapWords(bits)), total(count) {
+        seek(0);
+    }
+
+    void next() override { seek((size_t)current + 1); }
+
+    void advance(int target) override {
+        if (target > current) seek((size_t)target);
+    }
+
+    uint64_t cost() const override { return total; }
+};
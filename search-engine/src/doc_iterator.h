@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "posting_codec.h"
+
+// Ленивые итераторы по возрастающим doc_id. Запрос собирается в дерево
+// итераторов, и результат получается одним проходом по корню: операторы
+// не заводят промежуточных списков, а advance() у листьев пропускает
+// целые блоки posting-листов.
+//
+// Итератор сразу после создания стоит на первом документе; DOC_END —
+// итератор исчерпан, next() после этого не вызывается.
+
+static const int DOC_END = INT_MAX;
+
+class DocIterator {
+protected:
+    int current = DOC_END;
+
+public:
+    virtual ~DocIterator() {}
+
+    int doc() const { return current; }
+    virtual void next() = 0;
+    // Первый документ >= target; если текущий не меньше target — ничего.
+    virtual void advance(int target) = 0;
+    // Оценка числа документов сверху.
+    virtual uint64_t cost() const = 0;
+};
+
+typedef std::unique_ptr<DocIterator> DocIteratorPtr;
+
+class CursorIterator : public DocIterator {
+private:
+    PostingCursor cursor;
+
+    void sync() { current = cursor.valid() ? cursor.doc() : DOC_END; }
+
+public:
+    explicit CursorIterator(const PostingCursor& c) : cursor(c) { sync(); }
+
+    void next() override {
+        cursor.next();
+        sync();
+    }
+
+    void advance(int target) override {
+        cursor.advance(target);
+        sync();
+    }
+
+    uint64_t cost() const override { return cursor.size(); }
+};
+
+// Готовый список, которым итератор владеет совместно (например, с кэшем).
+class SharedListIterator : public CursorIterator {
+private:
+    std::shared_ptr<const std::vector<int>> list;
+
+public:
+    explicit SharedListIterator(std::shared_ptr<const std::vector<int>> l)
+        : CursorIterator(PostingCursor(*l)), list(std::move(l)) {}
+};
+
+// Пересечение: самый короткий список ведёт, остальные догоняют его
+// через advance(); при расхождении ведущий прыгает к большему doc_id.
+// Виртуальный advance() вызывается, только если ребёнок отстал.
+class AndIterator : public DocIterator {
+private:
+    std::vector<DocIteratorPtr> kids;
+
+    void align() {
+        DocIterator* lead = kids[0].get();
+        int target = lead->doc();
+        size_t i = 1;
+        while (target != DOC_END && i < kids.size()) {
+            DocIterator* c = kids[i].get();
+            if (c->doc() < target) c->advance(target);
+            if (c->doc() == target) {
+                ++i;
+                continue;
+            }
+            target = c->doc();
+            if (target == DOC_END) break;
+            lead->advance(target);
+            target = lead->doc();
+            i = 1;
+        }
+        current = target;
+    }
+
+public:
+    explicit AndIterator(std::vector<DocIteratorPtr> k) : kids(std::move(k)) {
+        std::stable_sort(kids.begin(), kids.end(), [](const DocIteratorPtr& a, const DocIteratorPtr& b) {
+            return a->cost() < b->cost();
+        });
+        align();
+    }
+
+    void next() override {
+        kids[0]->next();
+        align();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        kids[0]->advance(target);
+        align();
+    }
+
+    uint64_t cost() const override { return kids[0]->cost(); }
+};
+
+// Объединение. До HEAP_FROM детей минимум ищется линейным проходом,
+// для больших дизъюнкций (раскрытые шаблоны) — через min-кучу по
+// текущему doc_id.
+class OrIterator : public DocIterator {
+private:
+    static const size_t HEAP_FROM = 8;
+
+    std::vector<DocIteratorPtr> kids;
+    std::vector<DocIterator*> heap;
+    bool use_heap;
+
+    static bool later(const DocIterator* a, const DocIterator* b) { return a->doc() > b->doc(); }
+
+    // Сдвигает вершину кучи; исчерпанные дети из кучи уходят.
+    template <class Step>
+    void stepTop(Step step) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        DocIterator* c = heap.back();
+        step(c);
+        if (c->doc() == DOC_END) {
+            heap.pop_back();
+        } else {
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+
+    void settle() {
+        if (use_heap) {
+            current = heap.empty() ? DOC_END : heap.front()->doc();
+            return;
+        }
+        int m = DOC_END;
+        for (DocIterator* c : heap) m = std::min(m, c->doc());
+        current = m;
+    }
+
+public:
+    explicit OrIterator(std::vector<DocIteratorPtr> k) : kids(std::move(k)), use_heap(kids.size() >= HEAP_FROM) {
+        for (auto& c : kids) {
+            if (c->doc() != DOC_END) heap.push_back(c.get());
+        }
+        if (use_heap) std::make_heap(heap.begin(), heap.end(), later);
+        settle();
+    }
+
+    void next() override {
+        int d = current;
+        if (use_heap) {
+            while (!heap.empty() && heap.front()->doc() == d) stepTop([](DocIterator* c) { c->next(); });
+        } else {
+            for (DocIterator* c : heap) {
+                if (c->doc() == d) c->next();
+            }
+        }
+        settle();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        if (use_heap) {
+            while (!heap.empty() && heap.front()->doc() < target) {
+                stepTop([target](DocIterator* c) { c->advance(target); });
+            }
+        } else {
+            for (DocIterator* c : heap) {
+                if (c->doc() < target) c->advance(target);
+            }
+        }
+        settle();
+    }
+
+    uint64_t cost() const override {
+        uint64_t n = 0;
+        for (auto& c : kids) n += c->cost();
+        return n;
+    }
+};
+
+// Документы base, которых нет ни в одном из вычитаемых. NOT x — это
+// разность всех живых документов и x.
+class AndNotIterator : public DocIterator {
+private:
+    DocIteratorPtr base;
+    std::vector<DocIteratorPtr> subtract;
+
+    void skip() {
+        for (int d = base->doc(); d != DOC_END; base->next(), d = base->doc()) {
+            bool excluded = false;
+            for (auto& s : subtract) {
+                if (s->doc() < d) s->advance(d);
+                if (s->doc() == d) { excluded = true; break; }
+            }
+            if (!excluded) {
+                current = d;
+                return;
+            }
+        }
+        current = DOC_END;
+    }
+
+public:
+    AndNotIterator(DocIteratorPtr b, std::vector<DocIteratorPtr> s) : base(std::move(b)), subtract(std::move(s)) {
+        skip();
+    }
+
+    void next() override {
+        base->next();
+        skip();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        base->advance(target);
+        skip();
+    }
+
+    uint64_t cost() const override { return base->cost(); }
+};
+
+// Все документы итератора в один список — единственная материализация
+// при выполнении запроса.
+static inline std::vector<int> drainIterator(DocIterator& it, uint64_t limit) {
+    std::vector<int> r;
+    r.reserve((size_t)std::min(it.cost(), limit));
+    for (; it.doc() != DOC_END; it.next()) r.push_back(it.doc());
+    return r;
+}
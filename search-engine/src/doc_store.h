@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Хранилище документов бинарного индекса: заголовок (external_id),
+// превью и, с index_builder --store-text, полный текст документа лежат
+// блоками примерно по DOC_BLOCK_BYTES байт, каждый сжат в формате блока
+// LZ4. Таблица DocBlock упорядочена по первому doc_id блока и
+// заканчивается записью-ограничителем {размер секции, doc_count, 0}:
+// документ находится бинарным поиском, и распаковывается только его блок.
+//
+// Несжатый блок — документы подряд: varint длины заголовка, превью и
+// текста, затем сами строки.
+
+static const size_t DOC_BLOCK_BYTES = 16 << 10;
+
+struct DocBlock {
+    uint64_t offset;
+    uint32_t first_doc;
+    uint32_t raw_size;
+};
+
+struct StoredDocument {
+    std::string title;
+    std::string preview;
+    // Пусто, если индекс построен без --store-text.
+    std::string text;
+};
+
+// Последний распакованный блок. Читатель, которому нужно несколько
+// документов подряд (слияние сегментов, выдача по соседним doc_id),
+// передаёт кэш, и общий блок распаковывается один раз.
+struct DocBlockCache {
+    const void* owner = nullptr;
+    uint32_t block = UINT32_MAX;
+    std::string raw;
+};
+
+// ---- LZ4 ----
+//
+// Последовательность: токен (старшие 4 бита — число литералов, младшие —
+// длина совпадения минус 4, значение 15 продолжается байтами до первого
+// не 255), литералы, смещение совпадения (2 байта, little-endian).
+// Последняя последовательность — только литералы. Как того требует
+// формат, совпадение начинается не ближе 12 байт к концу блока, а
+// последние 5 байт всегда литералы. Кандидаты ищутся по хэш-таблице
+// 4-байтовых последовательностей (быстрый режим LZ4); на несжимаемых
+// участках шаг поиска растёт.
+
+static const size_t LZ4_MIN_MATCH = 4;
+static const size_t LZ4_MF_LIMIT = 12;
+static const size_t LZ4_LAST_LITERALS = 5;
+static const unsigned LZ4_HASH_BITS = 12;
+
+static inline uint32_t lz4Load32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void lz4PutLength(std::string& out, size_t n) {
+    for (; n >= 255; n -= 255) out += (char)255;
+    out += (char)n;
+}
+
+// match_len == 0 — последняя последовательность без совпадения.
+static inline void lz4Sequence(std::string& out, const char* lit, size_t lit_len, size_t match_len, size_t offset) {
+    size_t ml = match_len ? match_len - LZ4_MIN_MATCH : 0;
+    out += (char)((std::min<size_t>(lit_len, 15) << 4) | std::min<size_t>(ml, 15));
+    if (lit_len >= 15) lz4PutLength(out, lit_len - 15);
+    out.append(lit, lit_len);
+    if (!match_len) return;
+    out += (char)(offset & 0xff);
+    out += (char)(offset >> 8);
+    if (ml >= 15) lz4PutLength(out, ml - 15);
+}
+
+// Дописывает сжатые n байт src в out.
+static inline void lz4Compress(const char* src, size_t n, std::string& out) {
+    size_t anchor = 0;
+    if (n > LZ4_MF_LIMIT) {
+        uint32_t table[1u << LZ4_HASH_BITS];
+        memset(table, 0, sizeof(table));
+        size_t limit = n - LZ4_MF_LIMIT;
+        size_t match_limit = n - LZ4_LAST_LITERALS;
+        for (size_t i = 0; i < limit;) {
+            uint32_t seq = lz4Load32(src + i);
+            uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+            // В таблице позиция + 1: ноль — пустая ячейка.
+            size_t cand = table[h];
+            table[h] = (uint32_t)(i + 1);
+            if (cand && i - (cand - 1) <= 0xffff && lz4Load32(src + cand - 1) == seq) {
+                size_t m = cand - 1;
+                size_t len = LZ4_MIN_MATCH;
+                while (i + len < match_limit && src[m + len] == src[i + len]) ++len;
+                lz4Sequence(out, src + anchor, i - anchor, len, i - m);
+                i += len;
+                anchor = i;
+                continue;
+            }
+            i += 1 + ((i - anchor) >> 6);
+        }
+    }
+    lz4Sequence(out, src + anchor, n - anchor, 0, 0);
+}
+
+static inline bool lz4GetLength(const uint8_t*& p, const uint8_t* end, size_t& n) {
+    uint8_t b;
+    do {
+        if (p == end) return false;
+        b = *p++;
+        n += b;
+    } while (b == 255);
+    return true;
+}
+
+// Распаковывает ровно raw байт в dst; false — данные повреждены.
+static inline bool lz4Decompress(const char* src, size_t n, char* dst, size_t raw) {
+    const uint8_t* p = (const uint8_t*)src;
+    const uint8_t* end = p + n;
+    size_t o = 0;
+    while (p < end) {
+        uint8_t token = *p++;
+        size_t lit = token >> 4;
+        if (lit == 15 && !lz4GetLength(p, end, lit)) return false;
+        if (lit > (size_t)(end - p) || lit > raw - o) return false;
+        memcpy(dst + o, p, lit);
+        p += lit;
+        o += lit;
+        if (p == end) break;
+        if (end - p < 2) return false;
+        size_t offset = (size_t)p[0] | (size_t)p[1] << 8;
+        p += 2;
+        size_t len = token & 15;
+        if (len == 15 && !lz4GetLength(p, end, len)) return false;
+        len += LZ4_MIN_MATCH;
+        if (!offset || offset > o || len > raw - o) return false;
+        char* d = dst + o;
+        const char* s = d - offset;
+        // Перекрывающееся совпадение повторяет последние offset байт.
+        if (offset >= len) memcpy(d, s, len);
+        else for (size_t k = 0; k < len; ++k) d[k] = s[k];
+        o += len;
+    }
+    return o == raw;
+}
+
+// ---- Записи блока ----
+
+static inline void storePutVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += (char)(v | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+static inline bool storeGetVarint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = (uint8_t)*p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static inline void appendStoredDoc(std::string& block, std::string_view title, std::string_view preview,
+                                   std::string_view text) {
+    storePutVarint(block, title.size());
+    storePutVarint(block, preview.size());
+    storePutVarint(block, text.size());
+    block.append(title.data(), title.size());
+    block.append(preview.data(), preview.size());
+    block.append(text.data(), text.size());
+}
+
+// Документ номер index в несжатом блоке; false — блок повреждён.
+static inline bool readStoredDoc(std::string_view block, uint32_t index, StoredDocument& out, bool with_text) {
+    const char* p = block.data();
+    const char* end = p + block.size();
+    for (uint32_t i = 0;; ++i) {
+        uint64_t len[3];
+        for (uint64_t& l : len) {
+            if (!storeGetVarint(p, end, l)) return false;
+        }
+        if (len[0] > (uint64_t)(end - p) || len[1] > (uint64_t)(end - p) - len[0] ||
+            len[2] > (uint64_t)(end - p) - len[0] - len[1]) {
+            return false;
+        }
+        if (i == index) {
+            out.title.assign(p, (size_t)len[0]);
+            out.preview.assign(p + len[0], (size_t)len[1]);
+            if (with_text) out.text.assign(p + len[0] + len[1], (size_t)len[2]);
+            else out.text.clear();
+            return true;
+        }
+        p += len[0] + len[1] + len[2];
+    }
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+// Разбор дампа прямо из отображённого в память файла (mapped_file.h).
+// Маркеры ищутся memmem/memchr, текст документов не копируется: наружу
+// отдаются string_view на исходные байты.
+//
+//   ==DOC_START==
+//   <external_id>            первая непустая строка после ==DOC_START==
+//   ...                      игнорируется до ==CONTENT_START==
+//   ==CONTENT_START==
+//   <текст>
+//   ==DOC_END==
+//
+// Маркер распознаётся, только если занимает всю строку (после trim).
+// ==DOC_START== в любом месте начинает документ заново. Документ без
+// непустых строк текста пропускается.
+
+static const char DUMP_DOC_START[] = "==DOC_START==";
+static const char DUMP_CONTENT_START[] = "==CONTENT_START==";
+static const char DUMP_DOC_END[] = "==DOC_END==";
+
+struct DumpDocument {
+    std::string_view ext;
+    // Сырые строки текста вместе с переводами строк и отступами.
+    std::string_view body;
+};
+
+// BOM в начале строки, пробелы/табы по краям, \r\n справа.
+static inline std::string_view trimDumpLine(std::string_view s) {
+    if (s.size() >= 3 && (unsigned char)s[0] == 0xEF && (unsigned char)s[1] == 0xBB &&
+        (unsigned char)s[2] == 0xBF) {
+        s.remove_prefix(3);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r' || s.back() == '\n')) {
+        s.remove_suffix(1);
+    }
+    size_t i = 0;
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t')) ++i;
+    s.remove_prefix(i);
+    return s;
+}
+
+// Непустые строки текста после trim, по порядку. f возвращает false,
+// чтобы остановить обход.
+template <class F>
+static inline void forEachContentLine(std::string_view body, F f) {
+    const char* p = body.data();
+    const char* end = p + body.size();
+    while (p < end) {
+        const char* nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (!nl) nl = end;
+        std::string_view line = trimDumpLine(std::string_view(p, (size_t)(nl - p)));
+        if (!line.empty() && !f(line)) return;
+        p = nl + 1;
+    }
+}
+
+static inline bool hasContent(std::string_view body) {
+    bool found = false;
+    forEachContentLine(body, [&](std::string_view) {
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+class DumpScanner {
+private:
+    const char* begin;
+    const char* p;
+    const char* end;
+    bool at_end;
+    double busy = 0;
+
+    const char* lineStart(const char* q) const {
+        while (q > begin && q[-1] != '\n') --q;
+        return q;
+    }
+
+    const char* lineEnd(const char* q) const {
+        const char* nl = (const char*)memchr(q, '\n', (size_t)(end - q));
+        return nl ? nl : end;
+    }
+
+    const char* after(const char* le) const { return le < end ? le + 1 : end; }
+
+    // Ищет строку marker, начиная с p; ставит p за неё.
+    bool skipTo(std::string_view marker) {
+        while (p < end) {
+            const char* q = (const char*)memmem(p, (size_t)(end - p), marker.data(), marker.size());
+            if (!q) break;
+            const char* ls = lineStart(q);
+            const char* le = lineEnd(q);
+            p = after(le);
+            if (trimDumpLine(std::string_view(ls, (size_t)(le - ls))) == marker) return true;
+        }
+        p = end;
+        return false;
+    }
+
+    bool scan(DumpDocument& doc) {
+        if (!skipTo(DUMP_DOC_START)) return false;
+        for (;;) {
+            // Заголовок: external_id и строки до ==CONTENT_START==.
+            doc.ext = std::string_view();
+            bool content = false;
+            while (!content && p < end) {
+                const char* le = lineEnd(p);
+                std::string_view line = trimDumpLine(std::string_view(p, (size_t)(le - p)));
+                p = after(le);
+                if (line.empty()) continue;
+                if (line == DUMP_DOC_START) doc.ext = std::string_view();
+                else if (doc.ext.empty()) doc.ext = line;
+                else content = line == DUMP_CONTENT_START;
+            }
+            if (!content) return false;
+
+            // Текст: до строки ==DOC_END== или ==DOC_START==. Обе
+            // начинаются с "==DOC_", поэтому достаточно одного memmem.
+            const char* body = p;
+            bool restart = false;
+            for (;;) {
+                const char* q = (const char*)memmem(p, (size_t)(end - p), "==DOC_", 6);
+                if (!q) {
+                    // Недописанный последний документ попадает в индекс
+                    // только в конце всего дампа, а не диапазона.
+                    p = end;
+                    doc.body = std::string_view(body, (size_t)(end - body));
+                    return at_end && hasContent(doc.body);
+                }
+                const char* ls = lineStart(q);
+                const char* le = lineEnd(q);
+                std::string_view line = trimDumpLine(std::string_view(ls, (size_t)(le - ls)));
+                if (line == DUMP_DOC_END || line == DUMP_DOC_START) {
+                    doc.body = std::string_view(body, (size_t)(ls - body));
+                    p = after(le);
+                    restart = line == DUMP_DOC_START;
+                    break;
+                }
+                p = le;
+            }
+            if (restart) continue;
+            if (hasContent(doc.body)) return true;
+            if (!skipTo(DUMP_DOC_START)) return false;
+        }
+    }
+
+public:
+    // is_last — диапазон заканчивается концом дампа.
+    DumpScanner(const char* data, size_t size, bool is_last = true)
+        : begin(data), p(data), end(data + size), at_end(is_last) {}
+
+    bool next(DumpDocument& doc) {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = scan(doc);
+        busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    }
+
+    // Сколько байт диапазона уже разобрано.
+    size_t offset() const { return (size_t)(p - begin); }
+
+    // Время, проведённое в разборе (без обработки документов).
+    double seconds() const { return busy; }
+};
+
+// Смещение начала первой строки "==DOC_START==" не раньше pos.
+static inline size_t nextDumpDocStart(const char* data, size_t size, size_t pos) {
+    while (pos < size) {
+        const char* q = (const char*)memmem(data + pos, size - pos, DUMP_DOC_START, sizeof(DUMP_DOC_START) - 1);
+        if (!q) break;
+        const char* ls = q;
+        while (ls > data && ls[-1] != '\n') --ls;
+        const char* le = (const char*)memchr(q, '\n', size - (size_t)(q - data));
+        if (!le) le = data + size;
+        if ((size_t)(ls - data) >= pos &&
+            trimDumpLine(std::string_view(ls, (size_t)(le - ls))) == DUMP_DOC_START) {
+            return (size_t)(ls - data);
+        }
+        pos = (size_t)(le - data);
+    }
+    return size;
+}
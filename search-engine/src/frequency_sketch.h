@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "term_dictionary.h"
+
+// Приближённый подсчёт частот потока токенов в ограниченной памяти
+// (tokenizer --approx). Все структуры получают готовый hashTerm токена.
+//
+//  - CountMinSketch: rows строк по width счётчиков, оценка — минимум по
+//    строкам. Обновление консервативное (растут только минимальные
+//    счётчики), поэтому оценка не меньше истинной частоты и с
+//    вероятностью 1 - e^-rows завышена не больше чем на e / width * N.
+//  - SpaceSaving: k отслеживаемых слов. Новое слово при заполненной
+//    структуре вытесняет слово с наименьшим счётчиком и наследует его
+//    (этот счётчик — наибольшее завышение нового слова). Любое слово
+//    с частотой больше N / k гарантированно остаётся в структуре.
+//  - HyperLogLog: 2^p регистров по байту, стандартная ошибка числа
+//    уникальных слов 1.04 / sqrt(2^p).
+
+class CountMinSketch {
+private:
+    size_t width;
+    size_t rows;
+    std::vector<uint32_t> counters;
+
+    size_t slot(uint64_t h, size_t row) const {
+        // Двойное хэширование: строки — разные линейные комбинации половин хэша.
+        uint64_t h2 = (h >> 32) | 1;
+        return row * width + (size_t)((h + row * h2) & (width - 1));
+    }
+
+public:
+    // width — степень двойки.
+    CountMinSketch(size_t w, size_t r) : width(w), rows(r), counters(w * r, 0) {}
+
+    // Увеличивает частоту и возвращает новую оценку.
+    uint32_t add(uint64_t h) {
+        uint32_t m = estimate(h);
+        if (m == UINT32_MAX) return m;
+        for (size_t r = 0; r < rows; ++r) {
+            uint32_t& c = counters[slot(h, r)];
+            if (c == m) c = m + 1;
+        }
+        return m + 1;
+    }
+
+    uint32_t estimate(uint64_t h) const {
+        uint32_t m = UINT32_MAX;
+        for (size_t r = 0; r < rows; ++r) m = std::min(m, counters[slot(h, r)]);
+        return m;
+    }
+
+    // Завышение оценки, которое превышается с вероятностью не больше
+    // failureProbability(), для потока из total токенов.
+    double errorBound(uint64_t total) const { return std::exp(1.0) / (double)width * (double)total; }
+    double failureProbability() const { return std::exp(-(double)rows); }
+
+    size_t memoryBytes() const { return counters.size() * sizeof(uint32_t); }
+};
+
+class SpaceSaving {
+public:
+    struct Counter {
+        std::string word;
+        uint64_t count;
+        // Наибольшее завышение count: count - error <= частота <= count.
+        uint64_t error;
+    };
+
+private:
+    size_t capacity;
+    std::vector<Counter> counters;
+    // Мин-куча номеров счётчиков по count и положение счётчика в куче.
+    std::vector<uint32_t> heap;
+    std::vector<uint32_t> heap_pos;
+    // Открытая адресация, как в TermDictionary: 0 — пусто, иначе старшие
+    // 32 бита хэша и номер счётчика + 1. Заполнение не больше половины;
+    // удаление сдвигает хвост кластера назад, без надгробий.
+    std::vector<uint64_t> slots;
+    std::vector<uint64_t> hashes;
+
+    size_t mask() const { return slots.size() - 1; }
+
+    size_t probe(std::string_view w, uint64_t h) const {
+        uint64_t tag = h & 0xffffffff00000000ull;
+        for (size_t i = h & mask();; i = (i + 1) & mask()) {
+            uint64_t s = slots[i];
+            if (!s || ((s & 0xffffffff00000000ull) == tag && counters[(uint32_t)s - 1].word == w)) return i;
+        }
+    }
+
+    void erase(size_t i) {
+        for (size_t j = (i + 1) & mask(); slots[j]; j = (j + 1) & mask()) {
+            size_t home = hashes[(uint32_t)slots[j] - 1] & mask();
+            // slots[j] может занять дыру i, если i лежит на пути от home к j.
+            if (((j - home) & mask()) >= ((j - i) & mask())) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i] = 0;
+    }
+
+    void place(size_t i, uint32_t c) {
+        heap[i] = c;
+        heap_pos[c] = (uint32_t)i;
+    }
+
+    void siftDown(size_t i) {
+        uint32_t c = heap[i];
+        for (;;) {
+            size_t child = 2 * i + 1;
+            if (child >= heap.size()) break;
+            if (child + 1 < heap.size() && counters[heap[child + 1]].count < counters[heap[child]].count) ++child;
+            if (counters[heap[child]].count >= counters[c].count) break;
+            place(i, heap[child]);
+            i = child;
+        }
+        place(i, c);
+    }
+
+    void siftUp(size_t i) {
+        uint32_t c = heap[i];
+        while (i > 0 && counters[heap[(i - 1) / 2]].count > counters[c].count) {
+            place(i, heap[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+        place(i, c);
+    }
+
+public:
+    explicit SpaceSaving(size_t k) : capacity(std::max<size_t>(k, 1)) {
+        counters.reserve(capacity);
+        heap.reserve(capacity);
+        heap_pos.reserve(capacity);
+        hashes.reserve(capacity);
+        size_t n = 16;
+        while (n < capacity * 2) n *= 2;
+        slots.assign(n, 0);
+    }
+
+    // h — hashTerm(w).
+    void add(std::string_view w, uint64_t h) {
+        size_t i = probe(w, h);
+        if (slots[i]) {
+            uint32_t c = (uint32_t)slots[i] - 1;
+            counters[c].count++;
+            siftDown(heap_pos[c]);
+            return;
+        }
+        if (counters.size() < capacity) {
+            uint32_t c = (uint32_t)counters.size();
+            counters.push_back(Counter{std::string(w), 1, 0});
+            hashes.push_back(h);
+            slots[i] = (h & 0xffffffff00000000ull) | (c + 1);
+            heap.push_back(c);
+            heap_pos.push_back(0);
+            siftUp(heap.size() - 1);
+            return;
+        }
+        uint32_t c = heap[0];
+        Counter& victim = counters[c];
+        erase(probe(victim.word, hashes[c]));
+        victim.word.assign(w.data(), w.size());
+        victim.error = victim.count;
+        victim.count++;
+        hashes[c] = h;
+        slots[probe(w, h)] = (h & 0xffffffff00000000ull) | (c + 1);
+        siftDown(0);
+    }
+
+    // Наименьший счётчик: завышение для слов, вошедших позже всех.
+    uint64_t minCount() const { return counters.size() < capacity ? 0 : counters[heap[0]].count; }
+    const std::vector<Counter>& entries() const { return counters; }
+    size_t size() const { return counters.size(); }
+
+    size_t memoryBytes() const {
+        size_t bytes = counters.capacity() * sizeof(Counter) + (heap.capacity() + heap_pos.capacity()) * 4 +
+                       (slots.size() + hashes.capacity()) * 8;
+        for (auto& c : counters) bytes += c.word.capacity() > 15 ? c.word.capacity() + 1 : 0;
+        return bytes;
+    }
+};
+
+class HyperLogLog {
+private:
+    unsigned precision;
+    std::vector<uint8_t> registers;
+
+    static double sigma(double x) {
+        if (x == 1) return HUGE_VAL;
+        double y = 1, z = x, prev;
+        do {
+            x *= x;
+            prev = z;
+            z += x * y;
+            y += y;
+        } while (z != prev);
+        return z;
+    }
+
+    static double tau(double x) {
+        if (x == 0 || x == 1) return 0;
+        double y = 1, z = 1 - x, prev;
+        do {
+            x = std::sqrt(x);
+            prev = z;
+            y *= 0.5;
+            z -= (1 - x) * (1 - x) * y;
+        } while (z != prev);
+        return z / 3;
+    }
+
+public:
+    explicit HyperLogLog(unsigned p) : precision(p), registers((size_t)1 << p, 0) {}
+
+    void add(uint64_t h) {
+        size_t r = (size_t)(h >> (64 - precision));
+        uint64_t rest = h << precision | (uint64_t)1 << (precision - 1);
+        uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+        if (rank > registers[r]) registers[r] = rank;
+    }
+
+    // Улучшенная оценка Эртла (2017) по гистограмме регистров: без
+    // смещения классической формулы при мощностях порядка 2.5 * 2^p и без
+    // таблиц поправок HyperLogLog++.
+    double estimate() const {
+        unsigned q = 64 - precision;
+        std::vector<double> hist(q + 2, 0);
+        for (uint8_t v : registers) hist[v] += 1;
+        double m = (double)registers.size();
+        double z = m * tau(1 - hist[q + 1] / m);
+        for (unsigned k = q; k >= 1; --k) z = 0.5 * (z + hist[k]);
+        z += m * sigma(hist[0] / m);
+        return m * m / (2 * std::log(2.0)) / z;
+    }
+
+    double standardError() const { return 1.04 / std::sqrt((double)registers.size()); }
+    size_t memoryBytes() const { return registers.size(); }
+};
@@ -0,0 +1,771 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "doc_bitmap.h"
+#include "doc_store.h"
+#include "mapped_file.h"
+#include "posting_codec.h"
+#include "term_dictionary.h"
+
+// Бинарный формат индекса. Все секции выровнены по 8 байт и читаются прямо
+// из отображённого в память файла, без разбора и копирования.
+//
+//   IndexHeader
+//   SEC_TERMS     TermEntry[term_count], отсортированы по терму
+//   SEC_TERM_BLOB байты термов
+//   SEC_POSTINGS  сжатые posting-листы (posting_codec.h), каждый выровнен по 4 байта
+//   SEC_DOC_STORE   сжатые блоки документов (doc_store.h)
+//   SEC_DOC_BLOCKS  DocBlock[блоков + 1], по возрастанию первого doc_id
+//   SEC_DOC_LENGTHS  uint32[doc_count], длины документов в токенах (INDEX_FLAG_FREQS)
+//   SEC_POSITIONS    позиции термов (PositionEncoder), каждый терм выровнен по 4 байта
+//   SEC_POSITION_OFFSETS  uint64[term_count], смещения термов в SEC_POSITIONS
+//   SEC_TERM_PREFIXES     uint64[term_count], первые 8 байт термов (termPrefix)
+//   SEC_BITMAPS           битовые карты плотных термов, uint64[ceil(doc_count / 64)] каждая
+//   SEC_BITMAP_TERMS      BitmapRef[], по возрастанию номера терма
+//
+// По SEC_TERM_PREFIXES терм ищется бинарным поиском по плотному массиву
+// (term_dictionary.h); в индексах без этой секции — по SEC_TERMS.
+//
+// Позиции (INDEX_FLAG_POSITIONS, index_builder --positions) лежат
+// отдельными секциями: булевы запросы их не читают.
+//
+// С флагом INDEX_FLAG_FREQS posting-листы хранят частоты термов, а
+// TermEntry — оценки для верхней границы BM25 (max_tf, min_doc_len).
+// Индекс, сконвертированный из текстового формата, частот не имеет.
+//
+// С флагом INDEX_FLAG_STEMMED (index_builder --stem) термы индекса —
+// основы stemInPlace (stemmer.h), и search так же стеммит термы запроса.
+//
+// С флагом INDEX_FLAG_TEXT (index_builder --store-text) в хранилище
+// документов лежит и полный текст: по нему search строит сниппеты.
+//
+// Индексы версии 3 хранили заголовки и превью несжатыми: SEC_DOCS
+// (DocEntry[doc_count]) и SEC_DOC_BLOB; они читаются как раньше.
+//
+// Терм не реже чем в каждом BITMAP_DENSITY-м документе (doc_bitmap.h)
+// дополнительно хранится битовой картой: по ней search считает AND, OR и
+// NOT с такими термами словами по 64 бита. Сжатый лист остаётся — частоты
+// и позиции адресуются номером постинга. Индексы без этих секций читаются
+// как раньше.
+
+static const char INDEX_MAGIC[8] = {'B', 'I', 'D', 'X', 'B', 'I', 'N', '\0'};
+static const uint32_t INDEX_VERSION = 4;
+// Самая старая версия, которую умеет читать MappedIndex.
+static const uint32_t INDEX_MIN_VERSION = 3;
+static const uint32_t INDEX_FLAG_FREQS = 1;
+static const uint32_t INDEX_FLAG_POSITIONS = 2;
+static const uint32_t INDEX_FLAG_STEMMED = 4;
+static const uint32_t INDEX_FLAG_TEXT = 8;
+
+enum IndexSectionId : uint32_t {
+    SEC_TERMS = 1,
+    SEC_TERM_BLOB = 2,
+    SEC_POSTINGS = 3,
+    SEC_DOCS = 4,
+    SEC_DOC_BLOB = 5,
+    SEC_DOC_LENGTHS = 6,
+    SEC_POSITIONS = 7,
+    SEC_POSITION_OFFSETS = 8,
+    SEC_TERM_PREFIXES = 9,
+    SEC_BITMAPS = 10,
+    SEC_BITMAP_TERMS = 11,
+    SEC_DOC_STORE = 12,
+    SEC_DOC_BLOCKS = 13,
+    SEC_MAX = 16
+};
+
+struct IndexSection {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t doc_count;
+    uint32_t term_count;
+    uint64_t file_size;
+    uint64_t total_length;
+    IndexSection sections[SEC_MAX];
+};
+
+struct TermEntry {
+    uint32_t key_offset;
+    uint32_t key_len;
+    uint32_t doc_freq;
+    uint32_t max_tf;
+    uint64_t postings_offset;
+    uint32_t postings_size;
+    // Длина самого короткого документа с этим термом.
+    uint32_t min_doc_len;
+};
+
+struct BitmapRef {
+    uint32_t term;
+    uint32_t reserved;
+    uint64_t offset;
+};
+
+struct DocEntry {
+    uint64_t offset;
+    uint32_t title_len;
+    uint32_t preview_len;
+};
+
+static inline uint64_t alignUp8(uint64_t x) { return (x + 7) & ~uint64_t(7); }
+static inline uint64_t alignUp4(uint64_t x) { return (x + 3) & ~uint64_t(3); }
+
+static inline bool isBinaryIndexFile(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    char magic[8];
+    if (!f.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, INDEX_MAGIC, sizeof(magic)) == 0;
+}
+
+// Содержимое одной секции во время записи: в памяти или, для индексов
+// больше ОЗУ, во временном файле.
+class SectionBuffer {
+private:
+    std::string mem;
+    FILE* file = nullptr;
+    uint64_t length = 0;
+
+public:
+    explicit SectionBuffer(bool on_disk) {
+        if (on_disk) file = tmpfile();
+    }
+    SectionBuffer(const SectionBuffer&) = delete;
+    SectionBuffer& operator=(const SectionBuffer&) = delete;
+    ~SectionBuffer() {
+        if (file) fclose(file);
+    }
+
+    bool ok(bool on_disk) const { return !on_disk || file != nullptr; }
+    uint64_t size() const { return length; }
+
+    void write(const void* p, size_t n) {
+        if (file) fwrite(p, 1, n, file);
+        else mem.append((const char*)p, n);
+        length += n;
+    }
+
+    void pad(uint64_t align) {
+        static const char zeros[8] = {0};
+        write(zeros, (size_t)((align - length % align) % align));
+    }
+
+    bool copyTo(std::ostream& out) {
+        if (!file) {
+            out.write(mem.data(), (std::streamsize)mem.size());
+            return (bool)out;
+        }
+        if (fflush(file) != 0 || fseek(file, 0, SEEK_SET) != 0) return false;
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0) out.write(buf, (std::streamsize)n);
+        return (bool)out && !ferror(file);
+    }
+};
+
+// Потоковая запись бинарного индекса: документы и термы добавляются по
+// одному (термы — в порядке возрастания), секции копятся отдельно и
+// склеиваются в finish(). При on_disk секции лежат во временных файлах,
+// и память не зависит от размера индекса.
+class IndexFileWriter {
+private:
+    bool on_disk;
+    bool with_freqs;
+    bool with_positions;
+    bool stemmed;
+    bool with_text;
+    SectionBuffer terms, term_blob, postings, doc_store, doc_blocks, doc_lengths, positions, position_offsets,
+        term_prefixes, bitmaps, bitmap_terms;
+    uint32_t doc_count = 0;
+    uint32_t term_count = 0;
+    uint64_t total_length = 0;
+    // Длины документов нужны для min_doc_len термов.
+    std::vector<uint32_t> lengths;
+    std::string last_key;
+    std::string buf;
+    std::vector<uint64_t> bitmap;
+    // Незаполненный блок хранилища документов и его первый doc_id.
+    std::string block;
+    std::string packed;
+    uint32_t block_first = 0;
+
+    void flushBlock() {
+        if (block.empty()) return;
+        DocBlock b = {doc_store.size(), block_first, (uint32_t)block.size()};
+        doc_blocks.write(&b, sizeof(b));
+        packed.clear();
+        lz4Compress(block.data(), block.size(), packed);
+        doc_store.write(packed.data(), packed.size());
+        block.clear();
+        block_first = doc_count;
+    }
+
+public:
+    // freqs — писать частоты термов и длины документов; pos — ещё и
+    // позиции (только вместе с частотами); stem — термы прошли стемминг;
+    // text — хранить полный текст документов.
+    explicit IndexFileWriter(bool spill = false, bool freqs = true, bool pos = false, bool stem = false,
+                             bool text = false)
+        : on_disk(spill), with_freqs(freqs), with_positions(freqs && pos), stemmed(stem), with_text(text),
+          terms(spill), term_blob(spill), postings(spill), doc_store(spill), doc_blocks(spill), doc_lengths(spill),
+          positions(spill), position_offsets(spill), term_prefixes(spill), bitmaps(spill), bitmap_terms(spill) {}
+
+    bool ok() const {
+        return terms.ok(on_disk) && term_blob.ok(on_disk) && postings.ok(on_disk) &&
+               doc_store.ok(on_disk) && doc_blocks.ok(on_disk) && doc_lengths.ok(on_disk) &&
+               positions.ok(on_disk) && position_offsets.ok(on_disk) && term_prefixes.ok(on_disk) &&
+               bitmaps.ok(on_disk) && bitmap_terms.ok(on_disk);
+    }
+
+    // text сохраняется, только если писатель создан с text.
+    void addDocument(std::string_view title, std::string_view preview, uint32_t length = 0,
+                     std::string_view text = std::string_view()) {
+        if (with_freqs) {
+            doc_lengths.write(&length, sizeof(length));
+            lengths.push_back(length);
+            total_length += length;
+        }
+        appendStoredDoc(block, title, preview, with_text ? text : std::string_view());
+        ++doc_count;
+        if (block.size() >= DOC_BLOCK_BYTES) flushBlock();
+    }
+
+    // freqs обязательны, если писатель создан с частотами, pos — если с
+    // позициями (sum(freqs) позиций подряд). Все документы должны быть
+    // добавлены раньше термов: от их числа зависит, какие термы плотные.
+    bool addTerm(std::string_view key, const int* list, const int* freqs, size_t n,
+                 const uint32_t* pos = nullptr) {
+        if (term_count && key <= last_key) {
+            std::cerr << "Термы должны добавляться по возрастанию: " << key << "\n";
+            return false;
+        }
+        if (with_freqs && !freqs) {
+            std::cerr << "Нет частот для терма: " << key << "\n";
+            return false;
+        }
+        if (with_positions && !pos) {
+            std::cerr << "Нет позиций для терма: " << key << "\n";
+            return false;
+        }
+        last_key = key;
+
+        buf.clear();
+        PostingEncoder::encode(list, with_freqs ? freqs : nullptr, n, buf);
+
+        TermEntry e;
+        memset(&e, 0, sizeof(e));
+        e.key_offset = (uint32_t)term_blob.size();
+        e.key_len = (uint32_t)key.size();
+        e.doc_freq = (uint32_t)n;
+        e.postings_offset = postings.size();
+        e.postings_size = (uint32_t)buf.size();
+        if (with_freqs) {
+            e.min_doc_len = UINT32_MAX;
+            for (size_t i = 0; i < n; ++i) {
+                e.max_tf = std::max(e.max_tf, (uint32_t)freqs[i]);
+                if ((size_t)list[i] < lengths.size()) e.min_doc_len = std::min(e.min_doc_len, lengths[list[i]]);
+            }
+        }
+        terms.write(&e, sizeof(e));
+        uint64_t prefix = termPrefix(key);
+        term_prefixes.write(&prefix, sizeof(prefix));
+        term_blob.write(key.data(), key.size());
+        postings.write(buf.data(), buf.size());
+        if (with_positions) {
+            positions.pad(4);
+            uint64_t off = positions.size();
+            position_offsets.write(&off, sizeof(off));
+            buf.clear();
+            PositionEncoder::encode(freqs, pos, n, buf);
+            positions.write(buf.data(), buf.size());
+        }
+        if (n && (uint64_t)n * BITMAP_DENSITY >= doc_count && list[0] >= 0 && (uint32_t)list[n - 1] < doc_count) {
+            bitmap.assign(bitmapWords(doc_count), 0);
+            for (size_t i = 0; i < n; ++i) bitmap[(uint32_t)list[i] >> 6] |= 1ull << (list[i] & 63);
+            BitmapRef r = {term_count, 0, bitmaps.size()};
+            bitmap_terms.write(&r, sizeof(r));
+            bitmaps.write(bitmap.data(), bitmap.size() * sizeof(uint64_t));
+        }
+        postings.pad(4);
+        ++term_count;
+        return true;
+    }
+
+    bool finish(std::ostream& out) {
+        static const char tail[POSTING_TAIL_PADDING] = {0};
+        postings.write(tail, sizeof(tail));
+        flushBlock();
+        DocBlock end = {doc_store.size(), doc_count, 0};
+        doc_blocks.write(&end, sizeof(end));
+
+        IndexHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+        h.version = INDEX_VERSION;
+        h.flags = (with_freqs ? INDEX_FLAG_FREQS : 0) | (with_positions ? INDEX_FLAG_POSITIONS : 0) |
+                  (stemmed ? INDEX_FLAG_STEMMED : 0) | (with_text ? INDEX_FLAG_TEXT : 0);
+        h.doc_count = doc_count;
+        h.term_count = term_count;
+        h.total_length = total_length;
+
+        std::vector<SectionBuffer*> order = {&terms, &term_blob, &postings, &doc_store, &doc_blocks};
+        std::vector<IndexSectionId> ids = {SEC_TERMS, SEC_TERM_BLOB, SEC_POSTINGS, SEC_DOC_STORE, SEC_DOC_BLOCKS};
+        if (with_freqs) {
+            order.push_back(&doc_lengths);
+            ids.push_back(SEC_DOC_LENGTHS);
+        }
+        if (with_positions) {
+            order.insert(order.end(), {&positions, &position_offsets});
+            ids.insert(ids.end(), {SEC_POSITIONS, SEC_POSITION_OFFSETS});
+        }
+        order.push_back(&term_prefixes);
+        ids.push_back(SEC_TERM_PREFIXES);
+        if (bitmap_terms.size()) {
+            order.insert(order.end(), {&bitmaps, &bitmap_terms});
+            ids.insert(ids.end(), {SEC_BITMAPS, SEC_BITMAP_TERMS});
+        }
+        int sections = (int)order.size();
+
+        uint64_t pos = alignUp8(sizeof(IndexHeader));
+        for (int i = 0; i < sections; ++i) {
+            h.sections[ids[i]].offset = pos;
+            h.sections[ids[i]].size = order[i]->size();
+            pos = alignUp8(pos + order[i]->size());
+        }
+        h.file_size = pos;
+
+        static const char zeros[8] = {0};
+        out.write((const char*)&h, sizeof(h));
+        out.write(zeros, (std::streamsize)(alignUp8(sizeof(h)) - sizeof(h)));
+        for (int i = 0; i < sections; ++i) {
+            if (!order[i]->copyTo(out)) return false;
+            uint64_t n = order[i]->size();
+            out.write(zeros, (std::streamsize)(alignUp8(n) - n));
+        }
+        return (bool)out;
+    }
+};
+
+// Posting-лист терма при записи: doc_id по возрастанию, частоты (пусто,
+// если частоты неизвестны) и позиции всех постингов подряд (пусто, если
+// индекс без позиций).
+struct PostingList {
+    std::vector<int> docs;
+    std::vector<int> freqs;
+    std::vector<uint32_t> positions;
+};
+
+// Записывает индекс в бинарном формате из структур в памяти.
+// Термы сортируются на месте. Без lengths индекс пишется без частот,
+// позиции пишутся при with_positions.
+class BinaryIndexWriter {
+public:
+    typedef std::vector<std::pair<std::string, PostingList>> TermList;
+
+    static bool write(std::ostream& out,
+                      const std::vector<std::string>& titles,
+                      const std::vector<std::string>& previews,
+                      TermList& terms,
+                      const std::vector<uint32_t>* lengths = nullptr,
+                      bool with_positions = false) {
+        std::sort(terms.begin(), terms.end(),
+                  [](const TermList::value_type& a, const TermList::value_type& b) {
+                      return a.first < b.first;
+                  });
+
+        IndexFileWriter w(false, lengths != nullptr, with_positions);
+        static const std::string empty;
+        for (size_t i = 0; i < titles.size(); ++i) {
+            uint32_t len = lengths && i < lengths->size() ? (*lengths)[i] : 0;
+            w.addDocument(titles[i], i < previews.size() ? previews[i] : empty, len);
+        }
+        for (auto& t : terms) {
+            const PostingList& l = t.second;
+            if (!w.addTerm(t.first, l.docs.data(), l.freqs.empty() ? nullptr : l.freqs.data(), l.docs.size(),
+                           with_positions ? l.positions.data() : nullptr)) {
+                return false;
+            }
+        }
+        return w.finish(out);
+    }
+};
+
+// Разбирает текстовый индекс (секции DOCS/TERMS) и строит по нему образ
+// бинарного индекса в памяти.
+static inline bool convertTextIndex(const std::string& filename, std::string& image, int* text_terms = nullptr) {
+    std::ifstream file(filename.c_str());
+    if (!file) {
+        std::cerr << "Ошибка открытия файла индекса: " << filename << "\n";
+        return false;
+    }
+
+    std::string line;
+
+    if (!getline(file, line) || line != "DOCS") {
+        std::cerr << "Bad index format: missing DOCS\n";
+        return false;
+    }
+
+    if (!getline(file, line)) return false;
+    int doc_count = atoi(line.c_str());
+    std::vector<std::string> doc_titles(doc_count), doc_preview(doc_count);
+
+    for (int i = 0; i < doc_count; ++i) {
+        if (!getline(file, line)) return false;
+        size_t p1 = line.find('|');
+        size_t p2 = line.find('|', p1 + 1);
+        if (p1 == std::string::npos || p2 == std::string::npos) return false;
+
+        int doc_id = atoi(line.substr(0, p1).c_str());
+        if (doc_id >= 0 && doc_id < doc_count) {
+            doc_titles[doc_id] = line.substr(p1 + 1, p2 - p1 - 1);
+            doc_preview[doc_id] = line.substr(p2 + 1);
+        }
+    }
+
+    if (!getline(file, line) || line != "TERMS") {
+        std::cerr << "Bad index format: missing TERMS\n";
+        return false;
+    }
+
+    if (!getline(file, line)) return false;
+    int term_count = atoi(line.c_str());
+    if (text_terms) *text_terms = term_count;
+    BinaryIndexWriter::TermList terms;
+    terms.reserve(term_count);
+
+    for (int i = 0; i < term_count; ++i) {
+        if (!getline(file, line)) return false;
+        size_t p = line.find('|');
+        if (p == std::string::npos) continue;
+
+        terms.emplace_back(line.substr(0, p), PostingList());
+        std::vector<int>& docs = terms.back().second.docs;
+
+        std::stringstream ss(line.substr(p + 1));
+        std::string tok;
+        while (getline(ss, tok, ',')) {
+            if (tok.empty()) continue;
+            int doc_id = atoi(tok.c_str());
+            if (docs.empty() || docs.back() != doc_id) docs.push_back(doc_id);
+        }
+    }
+
+    std::ostringstream out;
+    if (!BinaryIndexWriter::write(out, doc_titles, doc_preview, terms)) return false;
+    image = out.str();
+    return true;
+}
+
+// Только читающее представление бинарного индекса: либо mmap файла,
+// либо буфер в памяти (для индекса, сконвертированного из текстового формата).
+class MappedIndex {
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+    MappedFile file;
+    std::string owned;
+
+    const IndexHeader* header = nullptr;
+    const TermEntry* terms = nullptr;
+    const char* term_blob = nullptr;
+    const char* postings_base = nullptr;
+    const char* doc_store = nullptr;
+    const DocBlock* doc_blocks = nullptr;
+    uint32_t block_count = 0;
+    // Версия 3: несжатые заголовки и превью.
+    const DocEntry* docs = nullptr;
+    const char* doc_blob = nullptr;
+    const uint32_t* doc_lengths = nullptr;
+    const char* positions_base = nullptr;
+    const uint64_t* position_offsets = nullptr;
+    const uint64_t* term_prefixes = nullptr;
+    const uint64_t* bitmaps_base = nullptr;
+    const BitmapRef* bitmap_refs = nullptr;
+    uint32_t bitmap_count = 0;
+
+    bool sectionOk(IndexSectionId id) const {
+        const IndexSection& s = header->sections[id];
+        return s.offset <= length && s.size <= length - s.offset;
+    }
+
+    bool attach() {
+        if (length < sizeof(IndexHeader)) {
+            std::cerr << "Бинарный индекс повреждён: файл слишком короткий\n";
+            return false;
+        }
+        header = (const IndexHeader*)base;
+        if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+            std::cerr << "Bad index format: wrong magic\n";
+            return false;
+        }
+        if (header->version < INDEX_MIN_VERSION || header->version > INDEX_VERSION) {
+            std::cerr << "Неподдерживаемая версия индекса: " << header->version << " (ожидается "
+                      << INDEX_MIN_VERSION << "-" << INDEX_VERSION << "), пересоберите индекс\n";
+            return false;
+        }
+        if (header->file_size > length) {
+            std::cerr << "Бинарный индекс повреждён: файл обрезан\n";
+            return false;
+        }
+        bool flat_docs = header->version == 3;
+        std::vector<IndexSectionId> required = {SEC_TERMS, SEC_TERM_BLOB, SEC_POSTINGS};
+        if (flat_docs) required.insert(required.end(), {SEC_DOCS, SEC_DOC_BLOB});
+        else required.insert(required.end(), {SEC_DOC_STORE, SEC_DOC_BLOCKS});
+        for (IndexSectionId id : required) {
+            if (!sectionOk(id)) {
+                std::cerr << "Бинарный индекс повреждён: секция " << id << "\n";
+                return false;
+            }
+        }
+        terms = (const TermEntry*)(base + header->sections[SEC_TERMS].offset);
+        term_blob = base + header->sections[SEC_TERM_BLOB].offset;
+        postings_base = base + header->sections[SEC_POSTINGS].offset;
+        docs = nullptr;
+        doc_blob = nullptr;
+        doc_store = nullptr;
+        doc_blocks = nullptr;
+        block_count = 0;
+        if (flat_docs) {
+            docs = (const DocEntry*)(base + header->sections[SEC_DOCS].offset);
+            doc_blob = base + header->sections[SEC_DOC_BLOB].offset;
+        } else {
+            // Блоки проверяются при чтении, здесь — только ограничитель.
+            const IndexSection& t = header->sections[SEC_DOC_BLOCKS];
+            doc_store = base + header->sections[SEC_DOC_STORE].offset;
+            doc_blocks = (const DocBlock*)(base + t.offset);
+            if (t.size % sizeof(DocBlock) || t.size < sizeof(DocBlock) ||
+                doc_blocks[t.size / sizeof(DocBlock) - 1].offset != header->sections[SEC_DOC_STORE].size ||
+                doc_blocks[t.size / sizeof(DocBlock) - 1].first_doc != header->doc_count) {
+                std::cerr << "Бинарный индекс повреждён: секция " << SEC_DOC_BLOCKS << "\n";
+                return false;
+            }
+            block_count = (uint32_t)(t.size / sizeof(DocBlock) - 1);
+        }
+        doc_lengths = nullptr;
+        if (header->flags & INDEX_FLAG_FREQS) {
+            if (!sectionOk(SEC_DOC_LENGTHS) ||
+                header->sections[SEC_DOC_LENGTHS].size < (uint64_t)header->doc_count * sizeof(uint32_t)) {
+                std::cerr << "Бинарный индекс повреждён: секция " << SEC_DOC_LENGTHS << "\n";
+                return false;
+            }
+            doc_lengths = (const uint32_t*)(base + header->sections[SEC_DOC_LENGTHS].offset);
+        }
+        positions_base = nullptr;
+        position_offsets = nullptr;
+        if (header->flags & INDEX_FLAG_POSITIONS) {
+            if (!doc_lengths || !sectionOk(SEC_POSITIONS) || !sectionOk(SEC_POSITION_OFFSETS) ||
+                header->sections[SEC_POSITION_OFFSETS].size < (uint64_t)header->term_count * sizeof(uint64_t)) {
+                std::cerr << "Бинарный индекс повреждён: секция " << SEC_POSITIONS << "\n";
+                return false;
+            }
+            positions_base = base + header->sections[SEC_POSITIONS].offset;
+            position_offsets = (const uint64_t*)(base + header->sections[SEC_POSITION_OFFSETS].offset);
+        }
+        term_prefixes = nullptr;
+        if (sectionOk(SEC_TERM_PREFIXES) &&
+            header->sections[SEC_TERM_PREFIXES].size == (uint64_t)header->term_count * sizeof(uint64_t)) {
+            term_prefixes = (const uint64_t*)(base + header->sections[SEC_TERM_PREFIXES].offset);
+        }
+        bitmaps_base = nullptr;
+        bitmap_refs = nullptr;
+        bitmap_count = 0;
+        if (sectionOk(SEC_BITMAPS) && sectionOk(SEC_BITMAP_TERMS) && header->sections[SEC_BITMAP_TERMS].size) {
+            uint64_t words = bitmapWords(header->doc_count);
+            uint64_t count = header->sections[SEC_BITMAP_TERMS].size / sizeof(BitmapRef);
+            if (header->sections[SEC_BITMAPS].size != count * words * sizeof(uint64_t)) {
+                std::cerr << "Бинарный индекс повреждён: секция " << SEC_BITMAPS << "\n";
+                return false;
+            }
+            bitmaps_base = (const uint64_t*)(base + header->sections[SEC_BITMAPS].offset);
+            bitmap_refs = (const BitmapRef*)(base + header->sections[SEC_BITMAP_TERMS].offset);
+            bitmap_count = (uint32_t)count;
+        }
+        return true;
+    }
+
+public:
+    MappedIndex() {}
+    MappedIndex(const MappedIndex&) = delete;
+    MappedIndex& operator=(const MappedIndex&) = delete;
+    ~MappedIndex() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        if (!file.open(path)) {
+            std::cerr << "Ошибка открытия файла индекса: " << path << "\n";
+            return false;
+        }
+        if (file.size() == 0) {
+            std::cerr << "Ошибка чтения файла индекса: " << path << "\n";
+            return false;
+        }
+        base = file.data();
+        length = file.size();
+        if (!attach()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool openBuffer(std::string&& buf) {
+        close();
+        owned = std::move(buf);
+        base = owned.data();
+        length = owned.size();
+        if (!attach()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        file.close();
+        base = nullptr;
+        length = 0;
+        owned.clear();
+        header = nullptr;
+        doc_store = nullptr;
+        doc_blocks = nullptr;
+        block_count = 0;
+        docs = nullptr;
+        doc_blob = nullptr;
+        doc_lengths = nullptr;
+        positions_base = nullptr;
+        position_offsets = nullptr;
+        term_prefixes = nullptr;
+        bitmaps_base = nullptr;
+        bitmap_refs = nullptr;
+        bitmap_count = 0;
+    }
+
+    bool isOpen() const { return header != nullptr; }
+    uint32_t docCount() const { return header ? header->doc_count : 0; }
+    uint32_t termCount() const { return header ? header->term_count : 0; }
+    bool hasFreqs() const { return doc_lengths != nullptr; }
+    bool hasPositions() const { return position_offsets != nullptr; }
+    bool stemmed() const { return header && (header->flags & INDEX_FLAG_STEMMED); }
+    bool hasText() const { return header && (header->flags & INDEX_FLAG_TEXT); }
+    uint64_t totalLength() const { return header ? header->total_length : 0; }
+
+    // Длина документа в токенах; 0, если в индексе нет частот.
+    uint32_t docLength(int doc_id) const {
+        if (!doc_lengths || doc_id < 0 || (uint32_t)doc_id >= header->doc_count) return 0;
+        return doc_lengths[doc_id];
+    }
+
+    const TermEntry* termAt(uint32_t i) const {
+        return (header && i < header->term_count) ? terms + i : nullptr;
+    }
+
+    std::string_view termKey(const TermEntry& e) const {
+        return std::string_view(term_blob + e.key_offset, e.key_len);
+    }
+
+    // Номер первого терма не меньше key (term_count, если такого нет).
+    uint32_t lowerBound(std::string_view key) const {
+        if (!header) return 0;
+        if (term_prefixes) {
+            return frozenLowerBound(term_prefixes, header->term_count, key,
+                                    [this](uint32_t i) { return termKey(terms[i]); });
+        }
+        const TermEntry* it = std::lower_bound(terms, terms + header->term_count, key,
+            [this](const TermEntry& e, std::string_view k) { return termKey(e) < k; });
+        return (uint32_t)(it - terms);
+    }
+
+    const TermEntry* findTerm(std::string_view key) const {
+        uint32_t i = lowerBound(key);
+        if (i < termCount() && termKey(terms[i]) == key) return terms + i;
+        return nullptr;
+    }
+
+    EncodedPostings postings(const TermEntry* e) const {
+        if (!e) return EncodedPostings();
+        return EncodedPostings((const uint8_t*)(postings_base + e->postings_offset), e->doc_freq, hasFreqs());
+    }
+
+    EncodedPostings postings(std::string_view key) const { return postings(findTerm(key)); }
+
+    // Позиции терма; пустой читатель, если индекс построен без позиций.
+    PositionReader positions(const TermEntry* e) const {
+        if (!e || !position_offsets) return PositionReader();
+        return PositionReader((const uint8_t*)(positions_base + position_offsets[e - terms]), e->doc_freq);
+    }
+
+    PostingCursor cursor(std::string_view key) const { return PostingCursor(postings(key)); }
+
+    // Битовая карта терма (bitmapWords(docCount()) слов) или nullptr, если
+    // терм хранится только posting-листом.
+    const uint64_t* bitmap(const TermEntry* e) const {
+        if (!e || !bitmap_count) return nullptr;
+        uint32_t t = (uint32_t)(e - terms);
+        const BitmapRef* it = std::lower_bound(bitmap_refs, bitmap_refs + bitmap_count, t,
+            [](const BitmapRef& r, uint32_t v) { return r.term < v; });
+        if (it == bitmap_refs + bitmap_count || it->term != t) return nullptr;
+        uint64_t words = bitmapWords(header->doc_count);
+        if (it->offset % sizeof(uint64_t) || it->offset / sizeof(uint64_t) > (uint64_t)(bitmap_count - 1) * words) {
+            return nullptr;
+        }
+        return bitmaps_base + it->offset / sizeof(uint64_t);
+    }
+
+    // Заголовок, превью и (при with_text) текст документа. Распаковывается
+    // только блок документа; cache позволяет не распаковывать его снова
+    // для следующего документа того же блока. false — нет такого
+    // документа или блок повреждён (out пуст).
+    bool document(int doc_id, StoredDocument& out, bool with_text = false, DocBlockCache* cache = nullptr) const {
+        out.title.clear();
+        out.preview.clear();
+        out.text.clear();
+        if (!header || doc_id < 0 || (uint32_t)doc_id >= header->doc_count) return false;
+        if (docs) {
+            const DocEntry& d = docs[doc_id];
+            out.title.assign(doc_blob + d.offset, d.title_len);
+            out.preview.assign(doc_blob + d.offset + d.title_len, d.preview_len);
+            return true;
+        }
+        const DocBlock* b = std::upper_bound(doc_blocks, doc_blocks + block_count, (uint32_t)doc_id,
+            [](uint32_t d, const DocBlock& x) { return d < x.first_doc; });
+        if (b == doc_blocks) return false;
+        --b;
+        uint32_t i = (uint32_t)(b - doc_blocks);
+        DocBlockCache local;
+        DocBlockCache& c = cache ? *cache : local;
+        if (c.owner != this || c.block != i) {
+            c.owner = nullptr;
+            if (b->offset > b[1].offset || b[1].offset > header->sections[SEC_DOC_STORE].size) return false;
+            c.raw.resize(b->raw_size);
+            if (!lz4Decompress(doc_store + b->offset, (size_t)(b[1].offset - b->offset), &c.raw[0], b->raw_size)) {
+                return false;
+            }
+            c.owner = this;
+            c.block = i;
+        }
+        if (readStoredDoc(c.raw, (uint32_t)doc_id - b->first_doc, out, with_text)) return true;
+        out.title.clear();
+        out.preview.clear();
+        return false;
+    }
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Файл, отображённый в память только для чтения. Канал, FIFO или
+// /dev/stdin отобразить нельзя (fstat даёт у них размер 0): такие входы
+// читаются целиком в память, и наружу они выглядят так же.
+class MappedFile {
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+    size_t released = 0;
+    bool mapped = false;
+    std::string owned;
+
+    bool readAll(int fd) {
+        char chunk[1 << 16];
+        for (;;) {
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) break;
+            owned.append(chunk, (size_t)n);
+        }
+        base = owned.data();
+        length = owned.size();
+        return true;
+    }
+
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // sequential — подсказка ядру о последовательном чтении (дампы).
+    bool open(const std::string& path, bool sequential = false) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            bool ok = readAll(fd);
+            ::close(fd);
+            if (!ok) close();
+            return ok;
+        }
+        if (st.st_size == 0) {
+            ::close(fd);
+            return true;
+        }
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        base = (const char*)p;
+        length = (size_t)st.st_size;
+        mapped = true;
+        if (sequential) madvise(p, length, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    void close() {
+        if (mapped) munmap((void*)base, length);
+        mapped = false;
+        owned.clear();
+        owned.shrink_to_fit();
+        base = nullptr;
+        length = 0;
+        released = 0;
+    }
+
+    // Отдаёт ядру уже прочитанные страницы [0, upto): резидентная часть
+    // отображения не растёт вместе с файлом.
+    void release(size_t upto) {
+        if (!mapped) return;
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        upto = std::min(upto, length) / page * page;
+        if (upto <= released) return;
+        madvise((void*)(base + released), upto - released, MADV_DONTNEED);
+        released = upto;
+    }
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+};
@@ -0,0 +1,787 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <csignal>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "mapped_file.h"
+#include "segment_index.h"
+#include "text_tokenizer.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Бенчмарк всего пайплайна на синтетическом корпусе:
+//  - корпус и журнал запросов генерируются по закону Ципфа–Мандельброта
+//    с параметрами, которые подогнал zipf_analyzer.py;
+//  - токенизация (МБ/с ядра text_tokenizer.h);
+//  - построение индекса bin/index_builder: время и пиковая память процесса;
+//  - открытие индекса и готовность сервера bin/search;
+//  - пропускная способность операторов AND/OR/NOT/ANDNOT на итераторах
+//    и по словам битовых карт плотных термов;
+//  - задержки запросов журнала через сервер (без кэша): p50/p95/p99.
+// Результат — строка JSON, которую удобно дописывать в историю прогонов;
+// с --baseline метрики сравниваются с последним прогоном с теми же
+// параметрами из файла истории.
+
+static const size_t TOKENIZE_CHUNK = 1 << 20;
+// Сколько времени гоняется каждый оператор в одном повторе.
+static const double OPERATOR_SECONDS = 0.1;
+static const size_t OPERATOR_PAIRS = 256;
+
+struct BenchParams {
+    size_t docs = 20000;
+    size_t doc_len = 200;
+    size_t vocab = 100000;
+    size_t queries = 2000;
+    double zipf_a = 1.0;
+    double zipf_b = 0.0;
+    uint64_t seed = 1;
+    bool positions = false;
+    int build_threads = 1;
+
+    string json() const {
+        ostringstream s;
+        s << "{\"docs\":" << docs << ",\"doc_len\":" << doc_len << ",\"vocab\":" << vocab
+          << ",\"queries\":" << queries << ",\"zipf_a\":" << zipf_a << ",\"zipf_b\":" << zipf_b
+          << ",\"seed\":" << seed << ",\"positions\":" << (positions ? "true" : "false")
+          << ",\"build_threads\":" << build_threads << "}";
+        return s.str();
+    }
+};
+
+struct Metric {
+    string key;
+    string title;
+    string unit;
+    double value;
+    // +1 — больше лучше, -1 — меньше лучше, 0 — справочно.
+    int better;
+};
+
+// Детерминированный LCG, как в dict_bench: корпус одинаков на всех платформах.
+struct Lcg {
+    uint64_t state;
+
+    explicit Lcg(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 88172645463325252ull) {}
+
+    double unit() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return (double)(state >> 11) / (double)(1ull << 53);
+    }
+
+    uint32_t below(uint32_t n) { return min(n - 1, (uint32_t)(unit() * n)); }
+};
+
+// Ранг слова по частоте с весом 1 / (r + 1 + b)^a.
+class ZipfSampler {
+private:
+    vector<double> cumulative;
+
+public:
+    ZipfSampler(size_t n, double a, double b) {
+        cumulative.reserve(n);
+        double total = 0;
+        for (size_t r = 0; r < n; ++r) {
+            total += pow((double)r + 1 + b, -a);
+            cumulative.push_back(total);
+        }
+    }
+
+    uint32_t operator()(Lcg& rng) const {
+        double x = rng.unit() * cumulative.back();
+        size_t r = (size_t)(upper_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin());
+        return (uint32_t)min(r, cumulative.size() - 1);
+    }
+};
+
+static string trimText(const string& s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    size_t e = s.find_last_not_of(" \t\r");
+    return b == string::npos ? string() : s.substr(b, e - b + 1);
+}
+
+// Параметры из results/zipf_analysis.txt (zipf_analyzer.py): a и B закона
+// Мандельброта, а если его нет — a обобщённого Ципфа и B = 0.
+static bool loadZipfFit(const string& path, double& a, double& b) {
+    ifstream in(path);
+    if (!in) return false;
+    string line, section;
+    bool zipf = false, mandelbrot = false;
+    double zipf_a = 0, mand_a = 0, mand_b = 0;
+    while (getline(in, line)) {
+        if (line.rfind("ZIPF", 0) == 0) section = "zipf";
+        else if (line.rfind("MANDELBROT", 0) == 0) section = "mandelbrot";
+        else if (line.empty()) section.clear();
+        size_t eq = line.find('=');
+        if (section.empty() || eq == string::npos) continue;
+        string key = trimText(line.substr(0, eq));
+        double v = atof(line.c_str() + eq + 1);
+        if (section == "zipf" && key == "a") {
+            zipf_a = v;
+            zipf = true;
+        } else if (section == "mandelbrot" && key == "a") {
+            mand_a = v;
+            mandelbrot = true;
+        } else if (section == "mandelbrot" && key == "B") {
+            mand_b = v;
+        }
+    }
+    if (mandelbrot && mand_a > 0) {
+        a = mand_a;
+        b = mand_b;
+        return true;
+    }
+    if (zipf && zipf_a > 0) {
+        a = zipf_a;
+        b = 0;
+        return true;
+    }
+    return false;
+}
+
+// Словарь по рангам: биективная запись n в алфавите a..z, начиная с
+// двухбуквенных слов, — частые слова короче, как в естественном языке.
+// Ключевые слова языка запросов пропускаются.
+static vector<string> makeVocabulary(size_t n) {
+    vector<string> words;
+    words.reserve(n);
+    for (uint64_t k = 27; words.size() < n; ++k) {
+        string w;
+        for (uint64_t v = k; v > 0; v = (v - 1) / 26) w += (char)('a' + (v - 1) % 26);
+        reverse(w.begin(), w.end());
+        if (w == "and" || w == "or" || w == "not" || w == "near") continue;
+        words.push_back(std::move(w));
+    }
+    return words;
+}
+
+// Дамп в формате DumpScheduler (dump_scanner.h): предложения по 6–20 слов,
+// длина документа равномерна в [doc_len / 2, 3 * doc_len / 2].
+static bool writeCorpus(const string& path, const BenchParams& p, const vector<string>& words,
+                        const ZipfSampler& zipf) {
+    ofstream out(path, ios::binary);
+    if (!out) return false;
+    Lcg rng(p.seed);
+    string doc;
+    for (size_t i = 0; i < p.docs; ++i) {
+        size_t len = p.doc_len / 2 + rng.below((uint32_t)p.doc_len + 1);
+        doc = "==DOC_START==\nbench-" + to_string(i) + "\n==CONTENT_START==\n";
+        size_t in_sentence = 0, sentence = 6 + rng.below(15);
+        for (size_t k = 0; k < len; ++k) {
+            const string& w = words[zipf(rng)];
+            if (in_sentence) doc += ' ';
+            doc += w;
+            if (!in_sentence) doc[doc.size() - w.size()] = (char)toupper(w[0]);
+            if (++in_sentence == sentence || k + 1 == len) {
+                doc += ".\n";
+                in_sentence = 0;
+                sentence = 6 + rng.below(15);
+            }
+        }
+        doc += "==DOC_END==\n";
+        out.write(doc.data(), (streamsize)doc.size());
+    }
+    return (bool)out;
+}
+
+// Журнал запросов: термы с тем же распределением, что и в корпусе, смесь
+// одиночных термов, конъюнкций, дизъюнкций, исключений и шаблонов (и фраз
+// для индекса с позициями).
+static bool writeQueries(const string& path, const BenchParams& p, const vector<string>& words,
+                         const ZipfSampler& zipf) {
+    ofstream out(path);
+    if (!out) return false;
+    Lcg rng(p.seed + 1);
+    for (size_t i = 0; i < p.queries; ++i) {
+        uint32_t kind = rng.below(100);
+        const string& a = words[zipf(rng)];
+        const string& b = words[zipf(rng)];
+        const string& c = words[zipf(rng)];
+        if (kind < 30) out << a;
+        else if (kind < 55) out << a << " AND " << b;
+        else if (kind < 65) out << a << " AND " << b << " AND " << c;
+        else if (kind < 80) out << a << " OR " << b;
+        else if (kind < 88) out << a << " AND NOT " << b;
+        else if (kind < 93) out << "(" << a << " OR " << b << ") AND " << c;
+        else if (kind < 97) out << (a.size() > 3 ? a.substr(0, 3) + "*" : a);
+        else if (p.positions) out << "\"" << a << " " << b << "\"";
+        else out << a << " AND " << b;
+        out << "\n";
+    }
+    return (bool)out;
+}
+
+static string readFile(const string& path) {
+    ifstream in(path, ios::binary);
+    stringstream s;
+    s << in.rdbuf();
+    return s.str();
+}
+
+static bool writeFile(const string& path, const string& data) {
+    ofstream out(path, ios::binary);
+    out << data;
+    return (bool)out;
+}
+
+// Лучшее из трёх проходов ядра токенизатора по корпусу, кусками по
+// границам токенов, как в tokenizer.
+static double tokenizeMbPerSec(string_view text, uint64_t& tokens) {
+    TokenScratch scratch;
+    double best = 0;
+    for (int round = 0; round < 3; ++round) {
+        auto start = steady_clock::now();
+        uint64_t n = 0;
+        for (size_t pos = 0; pos < text.size();) {
+            size_t end = tokenBoundary(text, min(text.size(), pos + TOKENIZE_CHUNK));
+            n += tokenBounds(text.substr(pos, end - pos), scratch);
+            pos = end;
+        }
+        double sec = duration<double>(steady_clock::now() - start).count();
+        tokens = n;
+        if (sec > 0) best = max(best, text.size() / sec / 1e6);
+    }
+    return best;
+}
+
+static pid_t spawn(const vector<string>& args) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+    vector<char*> argv;
+    for (auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    cerr << "Не удалось запустить " << args[0] << ": " << strerror(errno) << endl;
+    _exit(127);
+}
+
+// Время работы программы и её пиковая резидентная память (МБ).
+static bool runMeasured(const vector<string>& args, double& seconds, double& peak_mb) {
+    auto start = steady_clock::now();
+    pid_t pid = spawn(args);
+    if (pid < 0) return false;
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) return false;
+    seconds = duration<double>(steady_clock::now() - start).count();
+#ifdef __APPLE__
+    peak_mb = usage.ru_maxrss / 1048576.0;  // байты
+#else
+    peak_mb = usage.ru_maxrss / 1024.0;  // килобайты
+#endif
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Клиент строкового протокола сервера запросов (query_server.h).
+class ServerClient {
+private:
+    int fd = -1;
+    string buffer;
+
+public:
+    ~ServerClient() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool connectUnix(const string& path) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) return false;
+        memcpy(addr.sun_path, path.c_str(), path.size());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) return true;
+        if (fd >= 0) close(fd);
+        fd = -1;
+        return false;
+    }
+
+    bool request(const string& line, string& reply) {
+        string msg = line + "\n";
+        for (size_t sent = 0; sent < msg.size();) {
+            ssize_t n = write(fd, msg.data() + sent, msg.size() - sent);
+            if (n <= 0) return false;
+            sent += (size_t)n;
+        }
+        size_t nl;
+        while ((nl = buffer.find('\n')) == string::npos) {
+            char chunk[65536];
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) return false;
+            buffer.append(chunk, (size_t)n);
+        }
+        reply = buffer.substr(0, nl);
+        buffer.erase(0, nl + 1);
+        return true;
+    }
+};
+
+static int64_t percentile(const vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)ceil(p / 100 * (double)sorted.size());
+    return sorted[rank ? rank - 1 : 0];
+}
+
+// Прогон журнала через сервер: задержка клиента (запрос — ответ) в мкс.
+// prefix — команда режима ("!top 10 " для BM25). Журнал проходится
+// repeat раз, каждая метрика — лучшая по проходам.
+static bool runQueryLog(ServerClient& client, const vector<string>& queries, const string& prefix, int repeat,
+                        const string& key, const string& title, vector<Metric>& metrics) {
+    double qps = 0, p50 = 0, p95 = 0, p99 = 0, worst = 0;
+    vector<int64_t> latency;
+    size_t errors = 0;
+    string reply;
+    for (int pass = 0; pass < repeat; ++pass) {
+        latency.clear();
+        errors = 0;
+        auto start = steady_clock::now();
+        for (auto& q : queries) {
+            auto t0 = steady_clock::now();
+            if (!client.request(prefix + q, reply)) return false;
+            latency.push_back(duration_cast<nanoseconds>(steady_clock::now() - t0).count() / 1000);
+            if (reply.rfind("{\"error\"", 0) == 0) ++errors;
+        }
+        double sec = duration<double>(steady_clock::now() - start).count();
+        sort(latency.begin(), latency.end());
+        auto best = [pass](double& m, double v) { m = pass ? min(m, v) : v; };
+        qps = max(qps, sec > 0 ? queries.size() / sec : 0);
+        best(p50, (double)percentile(latency, 50));
+        best(p95, (double)percentile(latency, 95));
+        best(p99, (double)percentile(latency, 99));
+        best(worst, latency.empty() ? 0.0 : (double)latency.back());
+    }
+    metrics.push_back({key + "_qps", title + ", пропускная способность", "запросов/с", qps, 1});
+    metrics.push_back({key + "_p50_us", title + ", p50", "мкс", p50, -1});
+    metrics.push_back({key + "_p95_us", title + ", p95", "мкс", p95, -1});
+    metrics.push_back({key + "_p99_us", title + ", p99", "мкс", p99, -1});
+    // Одиночный выброс планировщика — справочно, не регрессия.
+    metrics.push_back({key + "_max_us", title + ", максимум", "мкс", worst, 0});
+    if (errors) cerr << title << ": ошибок в ответах: " << errors << endl;
+    return true;
+}
+
+// Оператор над парами термов гоняется по кругу не меньше OPERATOR_SECONDS
+// в каждом из repeat повторов; результат — миллионы входных doc_id (длины
+// операндов) в секунду, лучший по повторам.
+template <class Op>
+static double operatorThroughput(const vector<pair<string, string>>& pairs, int repeat, Op op, uint64_t& sink) {
+    // Прогревочный проход: страницы индекса и кэши процессора.
+    for (auto& pr : pairs) op(pr.first, pr.second, sink);
+    double best = 0;
+    for (int r = 0; r < repeat; ++r) {
+        uint64_t input = 0;
+        size_t done = 0;
+        auto start = steady_clock::now();
+        double sec = 0;
+        while (sec < OPERATOR_SECONDS || done < pairs.size()) {
+            auto& pr = pairs[done++ % pairs.size()];
+            input += op(pr.first, pr.second, sink);
+            sec = duration<double>(steady_clock::now() - start).count();
+        }
+        best = max(best, input / sec / 1e6);
+    }
+    return best;
+}
+
+// Контрольная сумма проходов, чтобы компилятор их не выбросил.
+static volatile uint64_t operator_sink;
+
+static void benchOperators(const SegmentedIndex& index, const vector<string>& words, const ZipfSampler& zipf,
+                           uint64_t seed, int repeat, vector<Metric>& metrics) {
+    Lcg rng(seed + 2);
+    vector<pair<string, string>> pairs, dense_pairs;
+    for (size_t tries = 0; pairs.size() < OPERATOR_PAIRS && tries < OPERATOR_PAIRS * 16; ++tries) {
+        const string& a = words[zipf(rng)];
+        const string& b = words[zipf(rng)];
+        if (a != b && index.docFreq(a) && index.docFreq(b)) pairs.push_back(make_pair(a, b));
+    }
+    // Пары плотных термов: первые ранги, пока у терма есть карта в индексе.
+    uint64_t count;
+    for (size_t r = 0; r < words.size() && dense_pairs.size() < OPERATOR_PAIRS; ++r) {
+        if (!index.directBitmap(words[r], count)) break;
+        for (size_t q = 0; q < r && dense_pairs.size() < OPERATOR_PAIRS; ++q) {
+            dense_pairs.push_back(make_pair(words[q], words[r]));
+        }
+    }
+    if (pairs.empty()) {
+        cerr << "Нет пар термов для операторов" << endl;
+        return;
+    }
+
+    uint64_t sink = 0;
+    auto drain = [](DocIterator& it, uint64_t& s) {
+        for (; it.doc() != DOC_END; it.next()) s += (uint64_t)it.doc();
+    };
+    auto docs = [&index](const string& t) { return index.docFreq(t); };
+    double and_rate = operatorThroughput(pairs, repeat, [&](const string& a, const string& b, uint64_t& s) {
+        vector<DocIteratorPtr> kids;
+        kids.push_back(index.iterator(a));
+        kids.push_back(index.iterator(b));
+        AndIterator it(std::move(kids));
+        drain(it, s);
+        return docs(a) + docs(b);
+    }, sink);
+    double or_rate = operatorThroughput(pairs, repeat, [&](const string& a, const string& b, uint64_t& s) {
+        vector<DocIteratorPtr> kids;
+        kids.push_back(index.iterator(a));
+        kids.push_back(index.iterator(b));
+        OrIterator it(std::move(kids));
+        drain(it, s);
+        return docs(a) + docs(b);
+    }, sink);
+    double not_rate = operatorThroughput(pairs, repeat, [&](const string& a, const string&, uint64_t& s) {
+        vector<DocIteratorPtr> kids;
+        kids.push_back(index.iterator(a));
+        AndNotIterator it(index.liveDocs(), std::move(kids));
+        drain(it, s);
+        return index.docCount() + docs(a);
+    }, sink);
+    double andnot_rate = operatorThroughput(pairs, repeat, [&](const string& a, const string& b, uint64_t& s) {
+        vector<DocIteratorPtr> kids;
+        kids.push_back(index.iterator(b));
+        AndNotIterator it(index.iterator(a), std::move(kids));
+        drain(it, s);
+        return docs(a) + docs(b);
+    }, sink);
+    metrics.push_back({"op_and_mdocs_s", "AND (итераторы)", "млн doc_id/с", and_rate, 1});
+    metrics.push_back({"op_or_mdocs_s", "OR (итераторы)", "млн doc_id/с", or_rate, 1});
+    metrics.push_back({"op_not_mdocs_s", "NOT (итераторы)", "млн doc_id/с", not_rate, 1});
+    metrics.push_back({"op_andnot_mdocs_s", "ANDNOT (итераторы)", "млн doc_id/с", andnot_rate, 1});
+
+    if (dense_pairs.empty()) return;
+    // Как bitmapOf в search: копия карты первого операнда, затем операция по словам.
+    size_t n = index.docCount();
+    auto wordwise = [&](int kind) {
+        return operatorThroughput(dense_pairs, repeat, [&, kind](const string& a, const string& b, uint64_t& s) {
+            // В dense_pairs только термы с картой (цикл выше обрывается на
+            // первом терме без неё), так что wa и wb не nullptr.
+            uint64_t ca = 0, cb = 0;
+            const uint64_t* wa = index.directBitmap(a, ca);
+            const uint64_t* wb = index.directBitmap(b, cb);
+            DocBitmap out(n);
+            if (kind == 2) {
+                index.liveBitmap(out);
+                out.andNotWith(wa, bitmapWords(n));
+                s += out.count();
+                return (uint64_t)n + ca;
+            }
+            out.orWith(wa, bitmapWords(n));
+            if (kind == 0) out.andWith(wb, bitmapWords(n));
+            else out.orWith(wb, bitmapWords(n));
+            s += out.count();
+            return ca + cb;
+        }, sink);
+    };
+    metrics.push_back({"op_and_words_mdocs_s", "AND (битовые карты)", "млн doc_id/с", wordwise(0), 1});
+    metrics.push_back({"op_or_words_mdocs_s", "OR (битовые карты)", "млн doc_id/с", wordwise(1), 1});
+    metrics.push_back({"op_not_words_mdocs_s", "NOT (битовые карты)", "млн doc_id/с", wordwise(2), 1});
+    operator_sink = sink;
+}
+
+static string jsonEscape(const string& s) {
+    string r;
+    for (char c : s) {
+        if (c == '"' || c == '\\') r += '\\';
+        if ((unsigned char)c >= 0x20) r += c;
+    }
+    return r;
+}
+
+static string toJson(const string& label, const BenchParams& p, const vector<Metric>& metrics) {
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    ostringstream s;
+    s << "{\"label\":\"" << jsonEscape(label) << "\",\"date\":\"" << date << "\",\"index_version\":" << INDEX_VERSION
+      << ",\"params\":" << p.json() << ",\"metrics\":{";
+    s << setprecision(10);
+    for (size_t i = 0; i < metrics.size(); ++i) {
+        s << (i ? "," : "") << "\"" << metrics[i].key << "\":" << metrics[i].value;
+    }
+    s << "}}";
+    return s.str();
+}
+
+// Значение "key":число из объекта "metrics" строки JSON прошлого прогона.
+static bool baselineValue(const string& json, const string& key, double& v) {
+    size_t m = json.find("\"metrics\":{");
+    if (m == string::npos) return false;
+    size_t k = json.find("\"" + key + "\":", m);
+    if (k == string::npos) return false;
+    v = atof(json.c_str() + k + key.size() + 3);
+    return true;
+}
+
+static string baselineLabel(const string& json) {
+    size_t b = json.find("\"label\":\"");
+    size_t e = json.find('"', b + 9);
+    return b == string::npos || e == string::npos ? string() : json.substr(b + 9, e - b - 9);
+}
+
+static string baselineParams(const string& json) {
+    size_t b = json.find("\"params\":");
+    size_t e = json.find('}', b);
+    return b == string::npos || e == string::npos ? string() : json.substr(b + 9, e - b - 8);
+}
+
+static string formatValue(double v) {
+    ostringstream s;
+    s << fixed << setprecision(fabs(v) < 100 && v != floor(v) ? 2 : 0) << v;
+    return s.str();
+}
+
+static void printMetrics(const vector<Metric>& metrics, const string& baseline, double threshold) {
+    size_t regressions = 0;
+    for (auto& m : metrics) {
+        cout << "  " << m.title << ": " << formatValue(m.value) << (m.unit.empty() ? "" : " ") << m.unit;
+        double old;
+        if (!baseline.empty() && baselineValue(baseline, m.key, old) && old != 0) {
+            double change = (m.value - old) / old * 100;
+            cout << " (было " << formatValue(old) << ", " << (change >= 0 ? "+" : "") << formatValue(change) << "%)";
+            if (m.better && change * m.better < -threshold) {
+                cout << " РЕГРЕССИЯ";
+                ++regressions;
+            }
+        }
+        cout << "\n";
+    }
+    if (!baseline.empty()) cout << "Регрессий (хуже больше чем на " << threshold << "%): " << regressions << "\n";
+}
+
+static void usage(const char* self) {
+    cerr << "Использование: " << self << " [параметры]\n"
+         << "  --docs N         документов в корпусе (по умолчанию 20000)\n"
+         << "  --doc-len N      средняя длина документа в токенах (200)\n"
+         << "  --vocab N        размер словаря (100000)\n"
+         << "  --queries N      запросов в журнале (2000)\n"
+         << "  --zipf-from F    взять a и B из отчёта zipf_analyzer.py (results/zipf_analysis.txt)\n"
+         << "  --zipf-a A, --zipf-b B  параметры закона f ~ 1 / (r + B)^a вместо отчёта\n"
+         << "  --seed N         зерно генератора (1)\n"
+         << "  --positions      строить индекс с позициями и добавить фразы в журнал\n"
+         << "  --build-threads N  потоков index_builder (1)\n"
+         << "  --work DIR       каталог корпуса, индекса и журнала (data/bench)\n"
+         << "  --bin DIR        каталог программ (bin)\n"
+         << "  --json F         записать результат строкой JSON (results/bench.json)\n"
+         << "  --label S        метка прогона (например, коммит)\n"
+         << "  --baseline F     сравнить с последним прогоном с теми же параметрами из истории (строки JSON)\n"
+         << "  --threshold P    отмечать ухудшение метрики больше чем на P% (10)\n"
+         << "  --repeat N       повторов построения, операторов и журнала; берётся лучший (3)\n";
+}
+
+int main(int argc, char* argv[]) {
+    BenchParams p;
+    string zipf_file = "results/zipf_analysis.txt";
+    string work = "data/bench", bin = "bin", json_file = "results/bench.json", label, baseline_file;
+    bool explicit_a = false, explicit_b = false;
+    int repeat = 3;
+    // Изменение метрики в худшую сторону больше чем на threshold % помечается.
+    double threshold = 10.0;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--docs" && has_value) p.docs = (size_t)atoll(argv[++i]);
+        else if (arg == "--doc-len" && has_value) p.doc_len = (size_t)atoll(argv[++i]);
+        else if (arg == "--vocab" && has_value) p.vocab = (size_t)atoll(argv[++i]);
+        else if (arg == "--queries" && has_value) p.queries = (size_t)atoll(argv[++i]);
+        else if (arg == "--zipf-from" && has_value) zipf_file = argv[++i];
+        else if (arg == "--zipf-a" && has_value) {
+            p.zipf_a = atof(argv[++i]);
+            explicit_a = true;
+        } else if (arg == "--zipf-b" && has_value) {
+            p.zipf_b = atof(argv[++i]);
+            explicit_b = true;
+        } else if (arg == "--seed" && has_value) p.seed = (uint64_t)atoll(argv[++i]);
+        else if (arg == "--positions") p.positions = true;
+        else if (arg == "--build-threads" && has_value) p.build_threads = atoi(argv[++i]);
+        else if (arg == "--work" && has_value) work = argv[++i];
+        else if (arg == "--bin" && has_value) bin = argv[++i];
+        else if (arg == "--json" && has_value) json_file = argv[++i];
+        else if (arg == "--label" && has_value) label = argv[++i];
+        else if (arg == "--baseline" && has_value) baseline_file = argv[++i];
+        else if (arg == "--repeat" && has_value) repeat = atoi(argv[++i]);
+        else if (arg == "--threshold" && has_value) threshold = atof(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!p.docs || !p.doc_len || p.vocab < 16 || !p.queries || p.build_threads <= 0 || repeat <= 0 || threshold <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    double fit_a = p.zipf_a, fit_b = p.zipf_b;
+    if (loadZipfFit(zipf_file, fit_a, fit_b)) {
+        if (!explicit_a) p.zipf_a = fit_a;
+        if (!explicit_b) p.zipf_b = fit_b;
+    } else if (!explicit_a) {
+        cerr << "Нет отчёта " << zipf_file << ", закон Ципфа с a = " << p.zipf_a << endl;
+    }
+    if (p.zipf_a <= 0 || p.zipf_b < 0) {
+        cerr << "Ожидается a > 0 и B >= 0" << endl;
+        return 1;
+    }
+
+    mkdir(work.c_str(), 0755);
+    string corpus = work + "/corpus.txt", queries_file = work + "/queries.txt", index_file = work + "/index.idx";
+    string socket_path = work + "/search.sock";
+
+    cout << "======= БЕНЧМАРК ПАЙПЛАЙНА =======" << endl;
+    cout << "Корпус: " << p.docs << " документов по ~" << p.doc_len << " токенов, словарь " << p.vocab
+         << ", Ципф–Мандельброт a = " << p.zipf_a << ", B = " << p.zipf_b << endl;
+
+    // Корпус и журнал пересоздаются, только если изменились параметры.
+    vector<string> words = makeVocabulary(p.vocab);
+    ZipfSampler zipf(words.size(), p.zipf_a, p.zipf_b);
+    string params = p.json();
+    struct stat st;
+    if (readFile(work + "/params.json") != params || stat(corpus.c_str(), &st) != 0 ||
+        stat(queries_file.c_str(), &st) != 0) {
+        auto start = steady_clock::now();
+        if (!writeCorpus(corpus, p, words, zipf) || !writeQueries(queries_file, p, words, zipf) ||
+            !writeFile(work + "/params.json", params)) {
+            cerr << "Не удалось записать корпус в " << work << endl;
+            return 1;
+        }
+        cout << "Корпус сгенерирован за " << fixed << setprecision(1)
+             << duration<double>(steady_clock::now() - start).count() << " с" << endl;
+        cout.unsetf(ios::fixed);
+    }
+
+    vector<Metric> metrics;
+    MappedFile text;
+    if (!text.open(corpus, true)) {
+        cerr << "Не удалось открыть " << corpus << endl;
+        return 1;
+    }
+    uint64_t tokens = 0;
+    double corpus_mb = text.size() / 1e6;
+    double tokenize = tokenizeMbPerSec(string_view(text.data(), text.size()), tokens);
+    metrics.push_back({"corpus_mb", "Размер корпуса", "МБ", corpus_mb, 0});
+    metrics.push_back({"corpus_tokens", "Токенов в корпусе", "", (double)tokens, 0});
+    metrics.push_back({"tokenize_mb_s", string("Токенизация (ядро ") + tokenKernelName() + ")", "МБ/с", tokenize, 1});
+    text.close();
+
+    vector<string> build = {bin + "/index_builder", "--binary"};
+    if (p.positions) build.push_back("--positions");
+    if (p.build_threads > 1) {
+        build.push_back("--threads");
+        build.push_back(to_string(p.build_threads));
+    }
+    build.push_back(corpus);
+    build.push_back(index_file);
+    double build_sec = 0, build_mb = 0;
+    for (int r = 0; r < repeat; ++r) {
+        double sec, mb;
+        if (!runMeasured(build, sec, mb) || stat(index_file.c_str(), &st) != 0) {
+            cerr << "Построение индекса не удалось" << endl;
+            return 1;
+        }
+        build_sec = r ? min(build_sec, sec) : sec;
+        build_mb = max(build_mb, mb);
+    }
+    metrics.push_back({"build_s", "Построение индекса", "с", build_sec, -1});
+    metrics.push_back({"build_mb_s", "Скорость построения", "МБ/с", build_sec > 0 ? corpus_mb / build_sec : 0, 1});
+    metrics.push_back({"build_peak_rss_mb", "Пиковая память index_builder", "МБ", build_mb, -1});
+    metrics.push_back({"index_mb", "Размер индекса", "МБ", st.st_size / 1e6, -1});
+
+    // Открытие отображённого индекса — медиана пяти попыток.
+    vector<int64_t> opens;
+    SegmentedIndex index;
+    for (int i = 0; i < 5; ++i) {
+        auto start = steady_clock::now();
+        if (!index.openFile(index_file)) {
+            cerr << "Не удалось открыть индекс " << index_file << endl;
+            return 1;
+        }
+        opens.push_back(duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000);
+    }
+    sort(opens.begin(), opens.end());
+    metrics.push_back({"open_us", "Открытие индекса (mmap)", "мкс", (double)percentile(opens, 50), -1});
+
+    benchOperators(index, words, zipf, p.seed, repeat, metrics);
+
+    vector<string> queries;
+    {
+        ifstream in(queries_file);
+        string line;
+        while (getline(in, line)) {
+            if (!line.empty()) queries.push_back(line);
+        }
+    }
+    unlink(socket_path.c_str());
+    auto start = steady_clock::now();
+    pid_t server = spawn({bin + "/search", "--index", index_file, "--serve", "unix:" + socket_path, "--workers", "1",
+                          "--cache-mb", "0"});
+    if (server < 0) {
+        cerr << "Не удалось запустить сервер" << endl;
+        return 1;
+    }
+    ServerClient client;
+    bool connected = false;
+    int status;
+    while (!connected && duration<double>(steady_clock::now() - start).count() < 60) {
+        connected = client.connectUnix(socket_path);
+        if (!connected) {
+            if (waitpid(server, &status, WNOHANG) == server) break;
+            usleep(1000);
+        }
+    }
+    bool served = connected;
+    if (connected) {
+        metrics.push_back({"server_ready_ms", "Запуск сервера до готовности", "мс",
+                           duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0, -1});
+        served = runQueryLog(client, queries, "", repeat, "query", "Булевы запросы", metrics) &&
+                 runQueryLog(client, queries, "!top 10 ", repeat, "ranked", "BM25 top-10", metrics);
+    }
+    kill(server, SIGTERM);
+    waitpid(server, &status, 0);
+    if (!served) {
+        cerr << "Сервер запросов не ответил" << endl;
+        return 1;
+    }
+
+    // Последний прогон истории с теми же параметрами.
+    string baseline;
+    if (!baseline_file.empty()) {
+        ifstream in(baseline_file);
+        string line;
+        while (getline(in, line)) {
+            if (baselineParams(line) == params) baseline = line;
+        }
+        if (baseline.empty()) cout << "В " << baseline_file << " нет прогона с такими параметрами" << endl;
+        else cout << "Сравнение с прогоном " << baselineLabel(baseline) << endl;
+    }
+    cout << "Результаты:" << endl;
+    printMetrics(metrics, baseline, threshold);
+
+    string json = toJson(label, p, metrics);
+    if (!json_file.empty()) {
+        if (!writeFile(json_file, json + "\n")) {
+            cerr << "Не удалось записать " << json_file << endl;
+            return 1;
+        }
+        cout << "JSON: " << json_file << endl;
+    }
+    cout << "==================================" << endl;
+    return 0;
+}
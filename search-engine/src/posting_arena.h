@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+// Posting-листы на время построения индекса без отдельного выделения
+// памяти на каждый терм. Постинги терма пишутся в цепочку блоков внутри
+// больших плит (slab) по 256 КБ: первый блок — 8 слов, каждый следующий
+// вдвое больше (до 1024 слов), последнее слово блока — смещение
+// следующего. Редкие термы занимают несколько десятков байт, частые —
+// крупные блоки, а плиты освобождаются все разом.
+//
+// Запись постинга — слова uint32: doc_id, tf и, для позиционного
+// индекса, tf позиций. Смещения 32-битные (до 16 ГБ постингов).
+
+// Голова и хвост цепочки одного терма.
+struct PostingChain {
+    uint32_t head = 0;   // первый блок; 0 — постингов нет
+    uint32_t pos = 0;    // следующее свободное слово
+    uint32_t end = 0;    // слово со ссылкой на следующий блок
+    uint32_t count = 0;  // постингов
+    uint32_t level = 0;  // номер текущего блока в цепочке
+};
+
+class PostingArena {
+private:
+    static const unsigned SLAB_BITS = 16;
+    static const uint32_t SLAB_WORDS = 1u << SLAB_BITS;
+    static const unsigned MAX_LEVEL = 7;
+
+    std::vector<std::unique_ptr<uint32_t[]>> slabs;
+    // Слово 0 занято: смещение 0 означает «нет блока».
+    uint64_t used = 1;
+
+    static uint32_t blockWords(uint32_t level) { return 8u << (level < MAX_LEVEL ? level : MAX_LEVEL); }
+
+    uint32_t allocate(uint32_t words) {
+        uint64_t in_slab = used & (SLAB_WORDS - 1);
+        if (in_slab + words > SLAB_WORDS) used += SLAB_WORDS - in_slab;
+        if ((used >> SLAB_BITS) >= slabs.size()) {
+            if (slabs.size() >= (1u << (32 - SLAB_BITS))) throw std::bad_alloc();
+            slabs.emplace_back(new uint32_t[SLAB_WORDS]);
+        }
+        uint32_t off = (uint32_t)used;
+        used += words;
+        return off;
+    }
+
+    void newBlock(PostingChain& c) {
+        if (c.head) ++c.level;
+        uint32_t words = blockWords(c.level);
+        uint32_t off = allocate(words);
+        if (c.head) word(c.end) = off;
+        else c.head = off;
+        c.pos = off;
+        c.end = off + words - 1;
+    }
+
+public:
+    uint32_t& word(uint32_t off) { return slabs[off >> SLAB_BITS][off & (SLAB_WORDS - 1)]; }
+    uint32_t word(uint32_t off) const { return slabs[off >> SLAB_BITS][off & (SLAB_WORDS - 1)]; }
+
+    void append(PostingChain& c, uint32_t w) {
+        if (c.pos == c.end) newBlock(c);
+        word(c.pos++) = w;
+    }
+
+    // Последовательное чтение слов цепочки.
+    class Reader {
+    private:
+        const PostingArena& arena;
+        uint32_t pos, end, level = 0;
+
+    public:
+        Reader(const PostingArena& a, const PostingChain& c)
+            : arena(a), pos(c.head), end(c.head + blockWords(0) - 1) {}
+
+        uint32_t next() {
+            if (pos == end) {
+                pos = arena.word(end);
+                end = pos + blockWords(++level) - 1;
+            }
+            return arena.word(pos++);
+        }
+    };
+
+    // Занятая часть плит.
+    size_t memoryBytes() const { return (size_t)used * sizeof(uint32_t); }
+
+    // Освобождает все плиты; цепочки, выданные до этого, недействительны.
+    void clear() {
+        slabs.clear();
+        used = 1;
+    }
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Сжатые posting-листы. Список разбит на блоки по POSTING_BLOCK doc_id;
+// в каждом блоке хранятся разности (gap - 1) соседних doc_id, упакованные
+// фиксированным числом бит. Перед данными лежит таблица заголовков блоков
+// с последним doc_id блока: по ней курсор пропускает блоки, не распаковывая их.
+// Если у списка есть частоты термов, за doc_id блока тем же способом
+// упакованы значения (tf - 1); их распаковывают только при ранжировании.
+//
+//   PostingBlockHeader[ceil(n / POSTING_BLOCK)]
+//   для каждого блока: uint8 ширина в битах, затем упакованные значения
+//                      [uint8 ширина, упакованные tf - 1]
+
+static const int POSTING_BLOCK = 128;
+static const int POSTING_TAIL_PADDING = 8;
+
+struct PostingBlockHeader {
+    int32_t last_doc;
+    uint32_t offset;
+};
+
+static inline uint32_t postingBlockCount(uint32_t n) {
+    return (n + POSTING_BLOCK - 1) / POSTING_BLOCK;
+}
+
+static inline int bitWidth(uint32_t v) {
+    int w = 0;
+    while (v) { ++w; v >>= 1; }
+    return w;
+}
+
+class PostingEncoder {
+private:
+    static uint64_t packedSize(size_t n, uint32_t mx) {
+        return 1 + (n * bitWidth(mx) + 7) / 8;
+    }
+
+    static void pack(const uint32_t* v, size_t n, uint32_t mx, std::string& out) {
+        int w = bitWidth(mx);
+        out.push_back((char)w);
+        size_t bytes = (n * w + 7) / 8;
+        size_t pos = out.size();
+        out.resize(pos + bytes, 0);
+        uint64_t bit = 0;
+        for (size_t i = 0; i < n; ++i, bit += w) {
+            uint64_t x = (uint64_t)v[i] << (bit & 7);
+            for (size_t k = bit >> 3; x; ++k, x >>= 8) out[pos + k] |= (char)(x & 0xFF);
+        }
+    }
+
+public:
+    // freqs может быть nullptr: тогда частоты не пишутся.
+    static uint64_t encodedSize(const int* docs, const int* freqs, size_t n) {
+        uint64_t size = postingBlockCount((uint32_t)n) * sizeof(PostingBlockHeader);
+        int prev = -1;
+        for (size_t b = 0; b < n; b += POSTING_BLOCK) {
+            size_t e = std::min(n, b + POSTING_BLOCK);
+            uint32_t mx = 0, mf = 0;
+            for (size_t i = b; i < e; ++i) {
+                mx = std::max(mx, (uint32_t)(docs[i] - prev - 1));
+                prev = docs[i];
+                if (freqs) mf = std::max(mf, (uint32_t)(freqs[i] - 1));
+            }
+            size += packedSize(e - b, mx);
+            if (freqs) size += packedSize(e - b, mf);
+        }
+        return size;
+    }
+
+    static void encode(const int* docs, const int* freqs, size_t n, std::string& out) {
+        size_t start = out.size();
+        uint32_t blocks = postingBlockCount((uint32_t)n);
+        out.resize(start + blocks * sizeof(PostingBlockHeader));
+        size_t data_start = out.size();
+
+        int prev = -1;
+        uint32_t gaps[POSTING_BLOCK], tfs[POSTING_BLOCK];
+        for (uint32_t blk = 0; blk < blocks; ++blk) {
+            size_t b = (size_t)blk * POSTING_BLOCK;
+            size_t e = std::min(n, b + POSTING_BLOCK);
+            uint32_t mx = 0, mf = 0;
+            for (size_t i = b; i < e; ++i) {
+                gaps[i - b] = (uint32_t)(docs[i] - prev - 1);
+                mx = std::max(mx, gaps[i - b]);
+                prev = docs[i];
+                if (freqs) {
+                    tfs[i - b] = (uint32_t)(freqs[i] - 1);
+                    mf = std::max(mf, tfs[i - b]);
+                }
+            }
+
+            PostingBlockHeader h;
+            h.last_doc = docs[e - 1];
+            h.offset = (uint32_t)(out.size() - data_start);
+            memcpy(&out[start + blk * sizeof(PostingBlockHeader)], &h, sizeof(h));
+
+            pack(gaps, e - b, mx, out);
+            if (freqs) pack(tfs, e - b, mf, out);
+        }
+    }
+};
+
+// Распаковывает n значений ширины w и восстанавливает doc_id от base.
+// Читает по 8 байт, поэтому после секции postings должен идти
+// POSTING_TAIL_PADDING байт запаса.
+static inline void unpackBlock(const uint8_t* data, int n, int* out, int base) {
+    int w = data[0];
+    const uint8_t* p = data + 1;
+    if (w == 0) {
+        for (int i = 0; i < n; ++i) out[i] = ++base;
+        return;
+    }
+    uint64_t mask = (w == 32) ? 0xFFFFFFFFull : ((1ull << w) - 1);
+    uint64_t bit = 0;
+    for (int i = 0; i < n; ++i, bit += w) {
+        uint64_t word;
+        memcpy(&word, p + (bit >> 3), sizeof(word));
+        base += (int)((word >> (bit & 7)) & mask) + 1;
+        out[i] = base;
+    }
+}
+
+// Распаковывает n частот блока; data указывает на байт ширины частот.
+static inline void unpackFreqs(const uint8_t* data, int n, int* out) {
+    int w = data[0];
+    const uint8_t* p = data + 1;
+    if (w == 0) {
+        for (int i = 0; i < n; ++i) out[i] = 1;
+        return;
+    }
+    uint64_t mask = (w == 32) ? 0xFFFFFFFFull : ((1ull << w) - 1);
+    uint64_t bit = 0;
+    for (int i = 0; i < n; ++i, bit += w) {
+        uint64_t word;
+        memcpy(&word, p + (bit >> 3), sizeof(word));
+        out[i] = (int)((word >> (bit & 7)) & mask) + 1;
+    }
+}
+
+// Экспоненциальный поиск: первый элемент в [p, end), для которого
+// before() ложно. Стоимость O(log d), где d — расстояние от p до ответа,
+// поэтому короткие шаги почти так же дёшевы, как линейный проход.
+template <class T, class Before>
+static inline const T* gallop(const T* p, const T* end, Before before) {
+    if (p == end || !before(*p)) return p;
+    size_t bound = 1;
+    while (bound < (size_t)(end - p) && before(p[bound])) bound <<= 1;
+    const T* lo = p + bound / 2 + 1;
+    const T* hi = bound < (size_t)(end - p) ? p + bound : end;
+    return std::partition_point(lo, hi, before);
+}
+
+struct EncodedPostings {
+    const uint8_t* data = nullptr;
+    uint32_t count = 0;
+    bool freqs = false;
+
+    EncodedPostings() {}
+    EncodedPostings(const uint8_t* d, uint32_t n, bool with_freqs = false)
+        : data(d), count(n), freqs(with_freqs) {}
+};
+
+// Последовательный доступ к posting-листу: сжатому (блок за блоком)
+// или к обычному массиву doc_id (промежуточные результаты запроса).
+// freq() — частота терма в текущем документе; без частот в списке — 1.
+class PostingCursor {
+private:
+    const PostingBlockHeader* headers = nullptr;
+    const uint8_t* blocks_data = nullptr;
+    uint32_t total = 0;
+    uint32_t block_count = 0;
+    uint32_t block = 0;
+    bool has_freqs = false;
+
+    const int* cur = nullptr;
+    const int* last = nullptr;
+    int buffer[POSTING_BLOCK];
+
+    // Частоты сжатого списка распаковываются лениво, для блока freq_block.
+    uint32_t freq_block = UINT32_MAX;
+    int freq_buffer[POSTING_BLOCK];
+    // Частоты обычного массива: freqs[i] для docs[i].
+    const int* plain_docs = nullptr;
+    const int* plain_freqs = nullptr;
+
+    bool loadBlock(uint32_t b) {
+        block = b;
+        if (b >= block_count) {
+            cur = last = nullptr;
+            return false;
+        }
+        int n = (int)std::min<uint32_t>(POSTING_BLOCK, total - b * POSTING_BLOCK);
+        int base = b ? headers[b - 1].last_doc : -1;
+        unpackBlock(blocks_data + headers[b].offset, n, buffer, base);
+        cur = buffer;
+        last = buffer + n;
+        return true;
+    }
+
+public:
+    PostingCursor() {}
+
+    explicit PostingCursor(EncodedPostings p) {
+        if (!p.data || !p.count) return;
+        has_freqs = p.freqs;
+        total = p.count;
+        block_count = postingBlockCount(total);
+        headers = (const PostingBlockHeader*)p.data;
+        blocks_data = p.data + block_count * sizeof(PostingBlockHeader);
+        loadBlock(0);
+    }
+
+    PostingCursor(const int* docs, size_t n, const int* freqs = nullptr) : total((uint32_t)n) {
+        if (n) {
+            cur = docs;
+            last = docs + n;
+            plain_docs = docs;
+            plain_freqs = freqs;
+        }
+    }
+
+    explicit PostingCursor(const std::vector<int>& v) : PostingCursor(v.data(), v.size()) {}
+
+    PostingCursor(const PostingCursor& o) { *this = o; }
+
+    PostingCursor& operator=(const PostingCursor& o) {
+        if (this == &o) return *this;
+        headers = o.headers;
+        blocks_data = o.blocks_data;
+        total = o.total;
+        block_count = o.block_count;
+        block = o.block;
+        has_freqs = o.has_freqs;
+        plain_docs = o.plain_docs;
+        plain_freqs = o.plain_freqs;
+        freq_block = UINT32_MAX;
+        if (o.headers && o.cur) {
+            memcpy(buffer, o.buffer, sizeof(buffer));
+            cur = buffer + (o.cur - o.buffer);
+            last = buffer + (o.last - o.buffer);
+        } else {
+            cur = o.cur;
+            last = o.last;
+        }
+        return *this;
+    }
+
+    bool valid() const { return cur != last; }
+    int doc() const { return *cur; }
+    uint32_t size() const { return total; }
+
+    // Порядковый номер текущего постинга в списке.
+    uint32_t ordinal() const {
+        return headers ? block * POSTING_BLOCK + (uint32_t)(cur - buffer) : (uint32_t)(cur - plain_docs);
+    }
+
+    int freq() {
+        if (!headers) return plain_freqs ? plain_freqs[cur - plain_docs] : 1;
+        if (!has_freqs) return 1;
+        if (freq_block != block) {
+            int n = (int)(last - buffer);
+            const uint8_t* data = blocks_data + headers[block].offset;
+            unpackFreqs(data + 1 + ((size_t)n * data[0] + 7) / 8, n, freq_buffer);
+            freq_block = block;
+        }
+        return freq_buffer[cur - buffer];
+    }
+
+    void next() {
+        if (++cur == last && headers) loadBlock(block + 1);
+    }
+
+    // Переходит к первому doc_id >= target: галопом по заголовкам блоков,
+    // затем галопом внутри распакованного блока.
+    void advance(int target) {
+        if (!valid() || *cur >= target) return;
+        if (headers && headers[block].last_doc < target) {
+            const PostingBlockHeader* h = gallop(headers + block + 1, headers + block_count,
+                [target](const PostingBlockHeader& x) { return x.last_doc < target; });
+            if (!loadBlock((uint32_t)(h - headers))) return;
+        }
+        cur = gallop(cur, last, [target](int d) { return d < target; });
+    }
+};
+
+static inline std::vector<int> decodeAll(PostingCursor c) {
+    std::vector<int> r;
+    r.reserve(c.size());
+    for (; c.valid(); c.next()) r.push_back(c.doc());
+    return r;
+}
+
+// Позиции терма (номера токенов в документе) — отдельный слой рядом с
+// posting-листом, тем же порядком постингов:
+//
+//   uint32 смещение блока[ceil(n / POSTING_BLOCK)]   от конца таблицы
+//   для каждого постинга: varint число позиций, varint разности позиций
+//
+// Таблица смещений позволяет прочитать позиции постинга, пропустив не
+// больше POSTING_BLOCK - 1 соседей, не трогая остальные блоки.
+class PositionEncoder {
+private:
+    static void putVarint(uint32_t v, std::string& out) {
+        while (v >= 0x80) {
+            out.push_back((char)(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((char)v);
+    }
+
+public:
+    // positions — позиции всех постингов подряд, freqs[i] штук на постинг.
+    static void encode(const int* freqs, const uint32_t* positions, size_t n, std::string& out) {
+        size_t start = out.size();
+        uint32_t blocks = postingBlockCount((uint32_t)n);
+        out.resize(start + blocks * sizeof(uint32_t));
+        size_t data_start = out.size();
+        for (size_t i = 0; i < n; ++i) {
+            if (i % POSTING_BLOCK == 0) {
+                uint32_t off = (uint32_t)(out.size() - data_start);
+                memcpy(&out[start + i / POSTING_BLOCK * sizeof(uint32_t)], &off, sizeof(off));
+            }
+            putVarint((uint32_t)freqs[i], out);
+            uint32_t prev = 0;
+            for (int k = 0; k < freqs[i]; ++k) {
+                putVarint(*positions - prev, out);
+                prev = *positions++;
+            }
+        }
+    }
+};
+
+// Чтение позиций по порядковому номеру постинга. Запросы по возрастанию
+// номеров внутри блока продолжают с места предыдущего чтения.
+class PositionReader {
+private:
+    const uint8_t* table = nullptr;
+    const uint8_t* data = nullptr;
+    uint32_t count = 0;
+    const uint8_t* p = nullptr;
+    uint32_t next_ordinal = UINT32_MAX;
+
+    uint32_t getVarint() {
+        uint32_t v = 0;
+        for (int shift = 0;; shift += 7) {
+            uint8_t b = *p++;
+            v |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+    }
+
+public:
+    PositionReader() {}
+    PositionReader(const uint8_t* d, uint32_t n)
+        : table(d), data(d + postingBlockCount(n) * sizeof(uint32_t)), count(n) {}
+
+    bool empty() const { return !table; }
+
+    void read(uint32_t ordinal, std::vector<uint32_t>& out) {
+        out.clear();
+        if (!table || ordinal >= count) return;
+        if (next_ordinal > ordinal || next_ordinal / POSTING_BLOCK != ordinal / POSTING_BLOCK) {
+            uint32_t off;
+            memcpy(&off, table + ordinal / POSTING_BLOCK * sizeof(uint32_t), sizeof(off));
+            p = data + off;
+            next_ordinal = ordinal / POSTING_BLOCK * POSTING_BLOCK;
+        }
+        for (; next_ordinal < ordinal; ++next_ordinal) {
+            for (uint32_t k = getVarint(); k; --k) getVarint();
+        }
+        uint32_t pos = 0;
+        for (uint32_t k = getVarint(); k; --k) {
+            pos += getVarint();
+            out.push_back(pos);
+        }
+        ++next_ordinal;
+    }
+};
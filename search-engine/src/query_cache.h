@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Кэш результатов запросов с бюджетом памяти. Ключ — каноническая запись
+// плана (describeQuery), значение — неизменяемый отсортированный список
+// doc_id, который разделяется между потоками без копирования.
+//
+// Вытеснение — LRU, допуск — TinyLFU: частоты обращений к ключам
+// приблизительно считает Count-Min sketch (4 строки байтовых счётчиков
+// с насыщением на 15; периодически делятся пополам, чтобы старая
+// популярность забывалась). Когда для новой записи нужно вытеснять,
+// она допускается, только если её ключ запрашивался чаще, чем ключ
+// вытесняемой записи: редкие запросы не вымывают из кэша частые.
+//
+// Все записи относятся к одному поколению индекса. get/put с другим
+// поколением промахиваются и ничего не сохраняют, setGeneration с новым
+// номером очищает кэш — запросы, начатые на старом поколении, не
+// смешивают свои результаты с новым.
+class QueryCache {
+public:
+    typedef std::shared_ptr<const std::vector<int>> Value;
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t rejected = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+private:
+    static const size_t SKETCH_WIDTH = 1 << 12;
+    static const size_t SKETCH_ROWS = 4;
+    static const uint8_t SKETCH_MAX = 15;
+    // Накладные расходы записи сверх ключа и doc_id: узел списка и хэш-таблицы.
+    static const size_t ENTRY_OVERHEAD = 96;
+
+    struct Entry {
+        std::string key;
+        Value value;
+        size_t bytes;
+    };
+
+    size_t budget;
+    uint64_t generation = 0;
+    std::list<Entry> lru;  // в начале — последняя использованная
+    std::unordered_map<std::string, std::list<Entry>::iterator> map;
+    size_t used = 0;
+    std::vector<uint8_t> sketch;
+    size_t sketch_events = 0;
+    Stats counters;
+    mutable std::mutex mu;
+
+    static size_t slot(size_t h, size_t row) {
+        h ^= row * 0x9e3779b97f4a7c15ull;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return row * SKETCH_WIDTH + (h & (SKETCH_WIDTH - 1));
+    }
+
+    void touch(size_t h) {
+        for (size_t r = 0; r < SKETCH_ROWS; ++r) {
+            uint8_t& c = sketch[slot(h, r)];
+            if (c < SKETCH_MAX) ++c;
+        }
+        if (++sketch_events >= SKETCH_WIDTH * 10) {
+            for (auto& c : sketch) c >>= 1;
+            sketch_events /= 2;
+        }
+    }
+
+    uint8_t frequency(size_t h) const {
+        uint8_t f = SKETCH_MAX;
+        for (size_t r = 0; r < SKETCH_ROWS; ++r) f = std::min(f, sketch[slot(h, r)]);
+        return f;
+    }
+
+    void clear() {
+        lru.clear();
+        map.clear();
+        used = 0;
+        counters.entries = 0;
+        counters.bytes = 0;
+    }
+
+public:
+    explicit QueryCache(size_t budget_bytes) : budget(budget_bytes), sketch(SKETCH_WIDTH * SKETCH_ROWS, 0) {}
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    bool enabled() const { return budget > 0; }
+
+    void setGeneration(uint64_t g) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (g == generation) return;
+        generation = g;
+        clear();
+    }
+
+    Value get(const std::string& key, uint64_t g) {
+        if (!budget) return nullptr;
+        std::lock_guard<std::mutex> lock(mu);
+        touch(std::hash<std::string>()(key));
+        auto it = g == generation ? map.find(key) : map.end();
+        if (it == map.end()) {
+            ++counters.misses;
+            return nullptr;
+        }
+        ++counters.hits;
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->value;
+    }
+
+    void put(const std::string& key, uint64_t g, Value value) {
+        size_t bytes = key.size() * 2 + value->size() * sizeof(int) + ENTRY_OVERHEAD;
+        if (!budget || bytes > budget) return;
+        std::lock_guard<std::mutex> lock(mu);
+        if (g != generation || map.count(key)) return;
+
+        uint8_t freq = frequency(std::hash<std::string>()(key));
+        size_t freed = 0;
+        auto victim = lru.end();
+        while (used - freed + bytes > budget && victim != lru.begin()) {
+            --victim;
+            if (frequency(std::hash<std::string>()(victim->key)) > freq) {
+                ++counters.rejected;
+                return;
+            }
+            freed += victim->bytes;
+        }
+        while (victim != lru.end()) {
+            map.erase(victim->key);
+            used -= victim->bytes;
+            victim = lru.erase(victim);
+        }
+
+        lru.push_front(Entry{key, std::move(value), bytes});
+        map[key] = lru.begin();
+        used += bytes;
+        counters.entries = map.size();
+        counters.bytes = used;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mu);
+        return counters;
+    }
+};
+
+// Два уровня: итоговые результаты запросов и пересечения пар термов,
+// с которых начинается AND (самые редкие термы конъюнкции). Второй
+// уровень полезен, когда разные запросы делят частую пару термов.
+struct QueryCaches {
+    QueryCache results;
+    QueryCache pairs;
+
+    // Четверть бюджета — пересечениям.
+    explicit QueryCaches(size_t budget_bytes) : results(budget_bytes - budget_bytes / 4), pairs(budget_bytes / 4) {}
+
+    void setGeneration(uint64_t g) {
+        results.setGeneration(g);
+        pairs.setGeneration(g);
+    }
+};
@@ -0,0 +1,517 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "text_tokenizer.h"
+
+// Разбор булевых запросов и план их выполнения.
+//
+//   or_expr  := and_expr ( OR and_expr )*
+//   and_expr := not_expr ( [AND] not_expr )*      соседние операнды — неявный AND
+//   not_expr := NOT not_expr | near_expr
+//   near_expr := primary ( NEAR/k primary )*         операнды NEAR/k — термы
+//   primary  := TERM | PATTERN | TERM~[N] | '"' TERM+ '"' | '(' or_expr ')'
+//
+// Приоритет: NEAR/k > NOT > AND > OR. Ключевые слова не зависят от регистра,
+// термы приводятся к нижнему регистру и режутся тем же токенизатором,
+// что и при построении индекса. Однобуквенные термы остаются в запросе
+// (в индексе их нет, поэтому они ничего не находят).
+//
+// "фраза" — термы подряд; внутри кавычек ключевые слова — обычные слова,
+// а однобуквенные токены пропускаются, как и при подсчёте позиций в
+// индексе. a NEAR/k b — термы на расстоянии не больше k позиций в любом
+// порядке; цепочка a NEAR/k b NEAR/m c означает (a NEAR/k b) AND
+// (b NEAR/m c). Слово near без /k — обычный терм.
+//
+// Шаблон — слово со звёздочками без пробелов (earthquak*, *quake,
+// ea*ke), '*' — любая подстрока. term~N — термы на расстоянии
+// Левенштейна не больше N (0..2) от term; term~ — N по длине терма:
+// 0 до 2 символов, 1 до 5, иначе 2. Шаблоны и нечёткие термы
+// раскрываются по словарю индекса в OR найденных термов.
+
+struct QueryNode {
+    enum Type { TERM, AND, OR, NOT, ANDNOT, PHRASE, NEAR, WILDCARD, FUZZY };
+
+    Type type;
+    // Терм; для WILDCARD — шаблон, для FUZZY — исходный терм.
+    std::string term;
+    // Для ANDNOT: children[0] — уменьшаемое, остальные — вычитаемые.
+    // Для PHRASE и NEAR — термы в порядке запроса. Для WILDCARD и FUZZY —
+    // найденные в словаре термы (заполняются перед планированием).
+    std::vector<std::unique_ptr<QueryNode>> children;
+    uint64_t cost = 0;
+    // Для NEAR: наибольшее расстояние между позициями термов; для FUZZY —
+    // наибольшее расстояние Левенштейна.
+    uint32_t distance = 0;
+
+    explicit QueryNode(Type t) : type(t) {}
+    QueryNode(Type t, const std::string& s) : type(t), term(s) {}
+};
+
+typedef std::unique_ptr<QueryNode> QueryPtr;
+
+// Каноническая запись узла: одинаковые после планирования запросы
+// дают одинаковую строку.
+static inline std::string describeQuery(const QueryNode& n) {
+    if (n.type == QueryNode::TERM || n.type == QueryNode::WILDCARD) return n.term;
+    if (n.type == QueryNode::FUZZY) return n.term + "~" + std::to_string(n.distance);
+    if (n.type == QueryNode::PHRASE) {
+        std::string s = "\"";
+        for (size_t i = 0; i < n.children.size(); ++i) s += (i ? " " : "") + n.children[i]->term;
+        return s + "\"";
+    }
+    if (n.type == QueryNode::NEAR) {
+        return "(NEAR/" + std::to_string(n.distance) + " " + n.children[0]->term + " " + n.children[1]->term + ")";
+    }
+    const char* op = n.type == QueryNode::AND ? "AND"
+                   : n.type == QueryNode::OR ? "OR"
+                   : n.type == QueryNode::NOT ? "NOT" : "ANDNOT";
+    std::string s = std::string("(") + op;
+    for (auto& c : n.children) s += " " + describeQuery(*c);
+    return s + ")";
+}
+
+class QueryParser {
+private:
+    enum TokenType { T_TERM, T_AND, T_OR, T_NOT, T_NEAR, T_QUOTE, T_LPAREN, T_RPAREN, T_STAR, T_TILDE,
+                     T_WILDCARD, T_FUZZY, T_END };
+
+    struct Token {
+        TokenType type;
+        std::string text;
+        uint32_t distance = 0;
+        // Байты запроса [start, end) — чтобы склеить слово с '*' и '~'.
+        size_t start = 0, end = 0;
+    };
+
+    std::vector<Token> tokens;
+    size_t pos = 0;
+    std::string error;
+
+    // Термы режет общий токенизатор (text_tokenizer.h), между ними ищутся
+    // скобки, кавычки, '*' и '~' шаблонов и "/" оператора NEAR/k.
+    static std::vector<Token> lex(const std::string& query) {
+        struct Word {
+            size_t start;
+            std::string text;
+        };
+        std::vector<Word> words;
+        TokenScratch scratch;
+        forEachToken(query, scratch, [&](std::string_view t) {
+            words.push_back({(size_t)(t.data() - scratch.lower.data()), std::string(t)});
+        }, 1);
+
+        std::vector<Token> r;
+        bool quoted = false;
+        size_t pos = 0;
+        auto gap = [&](size_t stop) {
+            for (; pos < stop; ++pos) {
+                char c = query[pos];
+                if (c == '"') {
+                    quoted = !quoted;
+                    r.push_back({T_QUOTE, "\""});
+                } else if (!quoted && c == '(') {
+                    r.push_back({T_LPAREN, "("});
+                } else if (!quoted && c == ')') {
+                    r.push_back({T_RPAREN, ")"});
+                } else if (!quoted && (c == '*' || c == '~')) {
+                    r.push_back({c == '*' ? T_STAR : T_TILDE, std::string(1, c), 0, pos, pos + 1});
+                }
+            }
+        };
+        for (size_t i = 0; i < words.size(); ++i) {
+            const Word& w = words[i];
+            gap(w.start);
+            pos += w.text.size();
+            const std::string& t = w.text;
+            size_t before = r.size();
+            if (quoted) {
+                if (t.size() >= MIN_TOKEN_LENGTH) r.push_back({T_TERM, t});
+            } else if (t == "near" && i + 1 < words.size() && words[i + 1].start == pos + 1 &&
+                       query[pos] == '/' && isNumber(words[i + 1].text)) {
+                Token near{T_NEAR, "near/" + words[i + 1].text};
+                near.distance = (uint32_t)std::stoul(words[i + 1].text);
+                r.push_back(near);
+                pos = words[i + 1].start + words[i + 1].text.size();
+                ++i;
+            } else if (t == "and") r.push_back({T_AND, t});
+            else if (t == "or") r.push_back({T_OR, t});
+            else if (t == "not") r.push_back({T_NOT, t});
+            else r.push_back({T_TERM, t});
+            if (r.size() > before) {
+                r.back().start = w.start;
+                r.back().end = pos;
+            }
+        }
+        gap(query.size());
+        r.push_back({T_END, ""});
+        return joinPatterns(r);
+    }
+
+    static bool isNumber(const std::string& t) {
+        return t.find_first_not_of("0123456789") == std::string::npos && t.size() <= 9;
+    }
+
+    static bool isWord(const Token& t) {
+        return t.type == T_TERM || t.type == T_AND || t.type == T_OR || t.type == T_NOT;
+    }
+
+    // Слова и '*' без пробелов между ними — один шаблон; слово, сразу за
+    // ним '~' и, возможно, число — нечёткий терм. Остальные '*' и '~'
+    // отбрасываются, как и прочие разделители.
+    static std::vector<Token> joinPatterns(const std::vector<Token>& in) {
+        std::vector<Token> r;
+        for (size_t i = 0; i < in.size(); ++i) {
+            const Token& t = in[i];
+            if (isWord(t) || t.type == T_STAR) {
+                size_t j = i;
+                bool star = t.type == T_STAR;
+                std::string text = t.text;
+                while (j + 1 < in.size() && (isWord(in[j + 1]) || in[j + 1].type == T_STAR) &&
+                       in[j + 1].start == in[j].end) {
+                    ++j;
+                    star = star || in[j].type == T_STAR;
+                    text += in[j].text;
+                }
+                if (star) {
+                    r.push_back({T_WILDCARD, text, 0, t.start, in[j].end});
+                    i = j;
+                    continue;
+                }
+            }
+            if (isWord(t) && i + 1 < in.size() && in[i + 1].type == T_TILDE && in[i + 1].start == t.end) {
+                Token f{T_FUZZY, t.text, 0, t.start, in[i + 1].end};
+                const Token* n = i + 2 < in.size() ? &in[i + 2] : nullptr;
+                if (n && n->type == T_TERM && n->start == f.end && isNumber(n->text)) {
+                    f.distance = (uint32_t)std::stoul(n->text);
+                    f.end = n->end;
+                    ++i;
+                } else {
+                    f.distance = t.text.size() <= 2 ? 0 : t.text.size() <= 5 ? 1 : 2;
+                }
+                r.push_back(f);
+                ++i;
+                continue;
+            }
+            if (t.type != T_STAR && t.type != T_TILDE) r.push_back(t);
+        }
+        return r;
+    }
+
+    const Token& peek() const { return tokens[pos]; }
+
+    bool fail(const std::string& msg) {
+        if (error.empty()) error = msg;
+        return false;
+    }
+
+    QueryPtr parseOr() {
+        QueryPtr left = parseAnd();
+        if (!left) return nullptr;
+        if (peek().type != T_OR) return left;
+        QueryPtr node(new QueryNode(QueryNode::OR));
+        node->children.push_back(std::move(left));
+        while (peek().type == T_OR) {
+            ++pos;
+            QueryPtr right = parseAnd();
+            if (!right) return nullptr;
+            node->children.push_back(std::move(right));
+        }
+        return node;
+    }
+
+    static bool startsOperand(TokenType t) {
+        return t == T_TERM || t == T_NOT || t == T_LPAREN || t == T_QUOTE || t == T_WILDCARD || t == T_FUZZY;
+    }
+
+    QueryPtr parseAnd() {
+        QueryPtr left = parseNot();
+        if (!left) return nullptr;
+        if (peek().type != T_AND && !startsOperand(peek().type)) return left;
+        QueryPtr node(new QueryNode(QueryNode::AND));
+        node->children.push_back(std::move(left));
+        while (peek().type == T_AND || startsOperand(peek().type)) {
+            if (peek().type == T_AND) ++pos;
+            QueryPtr right = parseNot();
+            if (!right) return nullptr;
+            node->children.push_back(std::move(right));
+        }
+        return node;
+    }
+
+    QueryPtr parseNot() {
+        if (peek().type == T_NOT) {
+            ++pos;
+            QueryPtr operand = parseNot();
+            if (!operand) return nullptr;
+            QueryPtr node(new QueryNode(QueryNode::NOT));
+            node->children.push_back(std::move(operand));
+            return node;
+        }
+        return parseNear();
+    }
+
+    QueryPtr parseNear() {
+        QueryPtr left = parsePrimary();
+        if (!left) return nullptr;
+        if (peek().type != T_NEAR) return left;
+        QueryPtr node(new QueryNode(QueryNode::AND));
+        while (peek().type == T_NEAR) {
+            uint32_t distance = peek().distance;
+            ++pos;
+            QueryPtr right = parsePrimary();
+            if (!right) return nullptr;
+            if (left->type != QueryNode::TERM || right->type != QueryNode::TERM) {
+                fail("операнды NEAR/k должны быть термами");
+                return nullptr;
+            }
+            QueryPtr near(new QueryNode(QueryNode::NEAR));
+            near->distance = distance;
+            near->children.push_back(QueryPtr(new QueryNode(QueryNode::TERM, left->term)));
+            near->children.push_back(std::move(right));
+            left.reset(new QueryNode(QueryNode::TERM, near->children[1]->term));
+            node->children.push_back(std::move(near));
+        }
+        if (node->children.size() == 1) return std::move(node->children[0]);
+        return node;
+    }
+
+    // Термы до закрывающей кавычки; фраза из одного терма — просто терм.
+    QueryPtr parsePhrase() {
+        QueryPtr node(new QueryNode(QueryNode::PHRASE));
+        while (peek().type == T_TERM) {
+            node->children.push_back(QueryPtr(new QueryNode(QueryNode::TERM, peek().text)));
+            ++pos;
+        }
+        if (peek().type != T_QUOTE) {
+            fail("ожидается '\"'");
+            return nullptr;
+        }
+        ++pos;
+        if (node->children.empty()) {
+            fail("пустая фраза");
+            return nullptr;
+        }
+        if (node->children.size() == 1) return std::move(node->children[0]);
+        return node;
+    }
+
+    QueryPtr parsePrimary() {
+        const Token& t = peek();
+        if (t.type == T_TERM) {
+            ++pos;
+            return QueryPtr(new QueryNode(QueryNode::TERM, t.text));
+        }
+        if (t.type == T_WILDCARD) {
+            ++pos;
+            if (t.text.find_first_not_of('*') == std::string::npos) {
+                fail("в шаблоне '" + t.text + "' нет ни одной буквы или цифры");
+                return nullptr;
+            }
+            return QueryPtr(new QueryNode(QueryNode::WILDCARD, t.text));
+        }
+        if (t.type == T_FUZZY) {
+            ++pos;
+            if (t.distance > 2) {
+                fail("расстояние в '" + t.text + "~" + std::to_string(t.distance) + "' — от 0 до 2");
+                return nullptr;
+            }
+            QueryPtr node(new QueryNode(QueryNode::FUZZY, t.text));
+            node->distance = t.distance;
+            return node;
+        }
+        if (t.type == T_QUOTE) {
+            ++pos;
+            return parsePhrase();
+        }
+        if (t.type == T_LPAREN) {
+            ++pos;
+            QueryPtr inner = parseOr();
+            if (!inner) return nullptr;
+            if (peek().type != T_RPAREN) {
+                fail("ожидается ')'");
+                return nullptr;
+            }
+            ++pos;
+            return inner;
+        }
+        if (t.type == T_END) fail("неожиданный конец запроса");
+        else fail("неожиданный токен '" + t.text + "'");
+        return nullptr;
+    }
+
+public:
+    // Возвращает nullptr для пустого запроса (error пуст) или при ошибке
+    // разбора (error содержит описание).
+    static QueryPtr parse(const std::string& query, std::string& error) {
+        QueryParser p;
+        p.tokens = lex(query);
+        error.clear();
+        if (p.peek().type == T_END) return nullptr;
+        QueryPtr root = p.parseOr();
+        if (root && p.peek().type != T_END) {
+            p.fail("неожиданный токен '" + p.peek().text + "'");
+            root.reset();
+        }
+        error = p.error;
+        return root;
+    }
+};
+
+// Переписывает дерево запроса в план выполнения:
+//  - NOT NOT x -> x;
+//  - вложенные AND/OR одного типа сливаются в n-арный узел, повторы термов убираются;
+//  - x AND NOT y AND NOT z -> ANDNOT(x, y, z): дополнение NOT не материализуется;
+//  - NOT a AND NOT b -> NOT (a OR b): одно дополнение вместо двух;
+//  - дети AND/OR сортируются по оценке размера результата (cost),
+//    для термов это длина posting-листа; для фразы и NEAR — длина самого
+//    короткого листа их термов, для раскрытого шаблона — сумма длин;
+//  - шаблон, раскрывшийся в один терм, заменяется этим термом.
+class QueryPlanner {
+public:
+    typedef std::function<uint64_t(const std::string&)> DocFreqFn;
+
+private:
+    DocFreqFn doc_freq;
+    uint64_t doc_count;
+
+    static void sortByCost(std::vector<QueryPtr>& v) {
+        std::stable_sort(v.begin(), v.end(), [](const QueryPtr& a, const QueryPtr& b) {
+            return a->cost < b->cost;
+        });
+    }
+
+    static void dedupTerms(std::vector<QueryPtr>& v) {
+        std::vector<QueryPtr> r;
+        for (auto& c : v) {
+            bool dup = false;
+            if (c->type == QueryNode::TERM) {
+                for (auto& x : r) {
+                    if (x->type == QueryNode::TERM && x->term == c->term) { dup = true; break; }
+                }
+            }
+            if (!dup) r.push_back(std::move(c));
+        }
+        v.swap(r);
+    }
+
+    QueryPtr planNot(QueryPtr n) {
+        QueryPtr child = plan(std::move(n->children[0]));
+        if (child->type == QueryNode::NOT) return std::move(child->children[0]);
+        n->children[0] = std::move(child);
+        n->cost = doc_count - std::min(doc_count, n->children[0]->cost);
+        return n;
+    }
+
+    QueryPtr planOr(QueryPtr n) {
+        std::vector<QueryPtr> kids;
+        for (auto& c : n->children) {
+            QueryPtr p = plan(std::move(c));
+            if (p->type == QueryNode::OR) {
+                for (auto& g : p->children) kids.push_back(std::move(g));
+            } else {
+                kids.push_back(std::move(p));
+            }
+        }
+        dedupTerms(kids);
+        if (kids.size() == 1) return std::move(kids[0]);
+        sortByCost(kids);
+        uint64_t cost = 0;
+        for (auto& k : kids) cost += k->cost;
+        n->children.swap(kids);
+        n->cost = std::min(cost, doc_count);
+        return n;
+    }
+
+    QueryPtr planAnd(QueryPtr n) {
+        std::vector<QueryPtr> positive, negative;
+        std::function<void(QueryPtr)> add = [&](QueryPtr p) {
+            if (p->type == QueryNode::AND) {
+                for (auto& g : p->children) add(std::move(g));
+            } else if (p->type == QueryNode::ANDNOT) {
+                add(std::move(p->children[0]));
+                for (size_t i = 1; i < p->children.size(); ++i) negative.push_back(std::move(p->children[i]));
+            } else if (p->type == QueryNode::NOT) {
+                negative.push_back(std::move(p->children[0]));
+            } else {
+                positive.push_back(std::move(p));
+            }
+        };
+        for (auto& c : n->children) add(plan(std::move(c)));
+        dedupTerms(positive);
+        dedupTerms(negative);
+        sortByCost(positive);
+        sortByCost(negative);
+
+        if (positive.empty()) {
+            QueryPtr any(new QueryNode(QueryNode::OR));
+            any->children.swap(negative);
+            QueryPtr r(new QueryNode(QueryNode::NOT));
+            r->children.push_back(std::move(any));
+            return plan(std::move(r));
+        }
+
+        QueryPtr base;
+        if (positive.size() == 1) {
+            base = std::move(positive[0]);
+        } else {
+            base.reset(new QueryNode(QueryNode::AND));
+            base->cost = positive[0]->cost;
+            base->children.swap(positive);
+        }
+        if (negative.empty()) return base;
+
+        QueryPtr r(new QueryNode(QueryNode::ANDNOT));
+        r->cost = base->cost;
+        r->children.push_back(std::move(base));
+        for (auto& c : negative) r->children.push_back(std::move(c));
+        return r;
+    }
+
+public:
+    QueryPlanner(DocFreqFn df, uint64_t docs) : doc_freq(df), doc_count(docs) {}
+
+    QueryPtr plan(QueryPtr n) {
+        switch (n->type) {
+            case QueryNode::TERM:
+                n->cost = doc_freq(n->term);
+                return n;
+            case QueryNode::NOT:
+                return planNot(std::move(n));
+            case QueryNode::OR:
+                return planOr(std::move(n));
+            case QueryNode::AND:
+                return planAnd(std::move(n));
+            case QueryNode::ANDNOT:
+                return n;
+            case QueryNode::WILDCARD:
+            case QueryNode::FUZZY: {
+                if (n->children.size() == 1) return plan(std::move(n->children[0]));
+                uint64_t cost = 0;
+                for (auto& c : n->children) {
+                    c->cost = doc_freq(c->term);
+                    cost += c->cost;
+                }
+                n->cost = std::min(cost, doc_count);
+                return n;
+            }
+            case QueryNode::PHRASE:
+            case QueryNode::NEAR: {
+                // Термы не переставляются: важен их порядок в запросе.
+                n->cost = UINT64_MAX;
+                for (auto& c : n->children) {
+                    c->cost = doc_freq(c->term);
+                    n->cost = std::min(n->cost, c->cost);
+                }
+                return n;
+            }
+        }
+        return n;
+    }
+};
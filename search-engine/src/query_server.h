@@ -0,0 +1,263 @@
+#pragma once
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Сервер запросов поверх Unix-сокета или TCP на 127.0.0.1. Протокол
+// строковый: каждая строка запроса (до '\n') — одна строка ответа, в
+// порядке запросов; "!quit" закрывает соединение.
+//
+// Главный поток ждёт в poll() новых соединений и данных от простаивающих
+// соединений. Соединение с данными уходит в очередь пула воркеров;
+// воркер читает, отвечает на все полные строки и возвращает соединение
+// в poll через self-pipe. Так фиксированное число потоков обслуживает
+// сколько угодно клиентов, а ответы одного клиента не перемешиваются.
+//
+// SIGHUP вызывает on_reload (в главном потоке), SIGINT/SIGTERM
+// останавливают сервер после обработки уже принятых запросов.
+class QueryServer {
+public:
+    typedef std::function<std::string(const std::string&)> Handler;
+
+private:
+    static const size_t MAX_LINE = 1 << 16;
+
+    struct Connection {
+        int fd;
+        std::string in;
+    };
+
+    Handler handler;
+    std::function<void()> on_reload;
+    int listen_fd = -1;
+    std::string unix_path;
+    int wake[2] = {-1, -1};
+
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<Connection*> ready;
+    std::vector<Connection*> returned;
+    bool stopping = false;
+
+    static int& signalPipe() {
+        static int fd = -1;
+        return fd;
+    }
+
+    static void onSignal(int sig) {
+        char c = sig == SIGHUP ? 'r' : 'q';
+        if (signalPipe() >= 0) (void)!write(signalPipe(), &c, 1);
+    }
+
+    static bool sendAll(int fd, const std::string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = send(fd, data.data() + done, data.size() - done, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += (size_t)n;
+        }
+        return true;
+    }
+
+    static void drop(Connection* c) {
+        close(c->fd);
+        delete c;
+    }
+
+    // Одно чтение и ответы на все полные строки. false — соединение закрыто.
+    bool serve(Connection* c) {
+        char buf[1 << 16];
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n <= 0) return false;
+        c->in.append(buf, (size_t)n);
+
+        size_t start = 0, nl;
+        while ((nl = c->in.find('\n', start)) != std::string::npos) {
+            std::string line = c->in.substr(start, nl - start);
+            start = nl + 1;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line == "!quit") return false;
+            if (!sendAll(c->fd, handler(line) + "\n")) return false;
+        }
+        c->in.erase(0, start);
+        if (c->in.size() > MAX_LINE) {
+            sendAll(c->fd, "{\"error\":\"слишком длинная строка запроса\"}\n");
+            return false;
+        }
+        return true;
+    }
+
+    void worker() {
+        for (;;) {
+            Connection* c;
+            {
+                std::unique_lock<std::mutex> lock(mu);
+                cv.wait(lock, [this] { return stopping || !ready.empty(); });
+                if (ready.empty()) return;
+                c = ready.front();
+                ready.pop_front();
+            }
+            if (!serve(c)) {
+                drop(c);
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mu);
+                returned.push_back(c);
+            }
+            char w = 'w';
+            (void)!write(wake[1], &w, 1);
+        }
+    }
+
+    bool makeWakePipe() {
+        if (pipe(wake) != 0) {
+            std::cerr << "Не удалось создать pipe: " << strerror(errno) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+public:
+    QueryServer(Handler h, std::function<void()> reload) : handler(std::move(h)), on_reload(std::move(reload)) {}
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    ~QueryServer() {
+        if (listen_fd >= 0) close(listen_fd);
+        if (!unix_path.empty()) unlink(unix_path.c_str());
+        if (wake[0] >= 0) close(wake[0]);
+        if (wake[1] >= 0) close(wake[1]);
+    }
+
+    bool listenUnix(const std::string& path) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        if (path.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Слишком длинный путь сокета: " << path << "\n";
+            return false;
+        }
+        // Удаляется только сокет, оставшийся от прежнего запуска: опечатка
+        // в пути не должна стирать обычный файл.
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                std::cerr << "Путь сокета занят и это не сокет: " << path << "\n";
+                return false;
+            }
+            unlink(path.c_str());
+        }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+            std::cerr << "Не удалось открыть сокет " << path << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        unix_path = path;
+        return makeWakePipe();
+    }
+
+    bool listenTcp(int port) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if (listen_fd >= 0) setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+            std::cerr << "Не удалось открыть порт 127.0.0.1:" << port << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        return makeWakePipe();
+    }
+
+    // Работает до SIGINT/SIGTERM.
+    void run(int workers) {
+        signalPipe() = wake[1];
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGHUP, onSignal);
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+
+        std::vector<std::thread> pool;
+        for (int i = 0; i < workers; ++i) pool.emplace_back([this] { worker(); });
+
+        std::vector<Connection*> idle;
+        std::vector<pollfd> fds;
+        bool quit = false;
+        while (!quit) {
+            fds.assign(1, pollfd{listen_fd, POLLIN, 0});
+            fds.push_back(pollfd{wake[0], POLLIN, 0});
+            for (Connection* c : idle) fds.push_back(pollfd{c->fd, POLLIN, 0});
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "poll: " << strerror(errno) << "\n";
+                break;
+            }
+
+            std::vector<Connection*> still_idle;
+            bool handed = false;
+            for (size_t i = 2; i < fds.size(); ++i) {
+                Connection* c = idle[i - 2];
+                if (!fds[i].revents) {
+                    still_idle.push_back(c);
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(mu);
+                ready.push_back(c);
+                handed = true;
+            }
+            idle.swap(still_idle);
+            if (handed) cv.notify_all();
+
+            if (fds[1].revents & POLLIN) {
+                char cmd[64];
+                ssize_t n = read(wake[0], cmd, sizeof(cmd));
+                for (ssize_t i = 0; i < n; ++i) {
+                    if (cmd[i] == 'r' && on_reload) on_reload();
+                    if (cmd[i] == 'q') quit = true;
+                }
+                std::lock_guard<std::mutex> lock(mu);
+                idle.insert(idle.end(), returned.begin(), returned.end());
+                returned.clear();
+            }
+
+            if (fds[0].revents & POLLIN) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd >= 0) idle.push_back(new Connection{fd, std::string()});
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : pool) t.join();
+        signalPipe() = -1;
+        for (Connection* c : idle) drop(c);
+        for (Connection* c : returned) drop(c);
+        returned.clear();
+    }
+};
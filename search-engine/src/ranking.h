@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "posting_codec.h"
+
+// Ранжирование BM25:
+//
+//   score(d) = sum_t idf(t) * tf * (k1 + 1) / (tf + k1 * (1 - b + b * |d| / avgdl))
+//   idf(t)   = ln(1 + (N - df + 0.5) / (df + 0.5))
+//
+// Вклад терма растёт с tf и убывает с длиной документа, поэтому
+// max_tf и min_doc_len из TermEntry дают верхнюю границу вклада терма
+// в любой документ. По этим границам WAND пропускает документы, которые
+// заведомо не попадут в top-k.
+
+struct Bm25 {
+    double k1 = 1.2;
+    double b = 0.75;
+    double doc_count = 0;
+    double avg_length = 0;
+
+    // Без длин документов (индекс без частот) нормализация по длине
+    // отключается, и score вырождается в сумму idf.
+    Bm25(uint64_t n, double avgdl) : doc_count((double)n), avg_length(avgdl) {
+        if (avg_length <= 0) b = 0;
+    }
+
+    double idf(uint64_t df) const {
+        double d = (double)df;
+        return std::log(1.0 + std::max(0.0, doc_count - d + 0.5) / (d + 0.5));
+    }
+
+    double termScore(double idf, uint32_t tf, uint32_t length) const {
+        double norm = b > 0 ? 1 - b + b * length / avg_length : 1;
+        return idf * tf * (k1 + 1) / (tf + k1 * norm);
+    }
+
+    // Граница с небольшим запасом: сумма границ не должна оказаться
+    // меньше суммы вкладов из-за другого порядка сложения.
+    double upperBound(double idf, uint32_t max_tf, uint32_t min_length) const {
+        return termScore(idf, std::max<uint32_t>(max_tf, 1), min_length) * (1 + 1e-9);
+    }
+};
+
+struct ScoredDoc {
+    int doc;
+    double score;
+};
+
+// Лучше — больший score, при равенстве — меньший doc_id.
+static inline bool betterScored(const ScoredDoc& a, const ScoredDoc& b) {
+    return a.score != b.score ? a.score > b.score : a.doc < b.doc;
+}
+
+// Ограниченная куча k лучших документов; в вершине — худший из них.
+class TopK {
+private:
+    size_t limit;
+    std::vector<ScoredDoc> heap;
+
+public:
+    explicit TopK(size_t k) : limit(k) { heap.reserve(k); }
+
+    bool full() const { return heap.size() >= limit; }
+
+    // Документ должен набрать больше, чтобы попасть в top-k.
+    double threshold() const {
+        return full() && limit ? heap.front().score : -std::numeric_limits<double>::infinity();
+    }
+
+    void push(int doc, double score) {
+        if (!limit) return;
+        ScoredDoc d = {doc, score};
+        if (!full()) {
+            heap.push_back(d);
+            std::push_heap(heap.begin(), heap.end(), betterScored);
+        } else if (betterScored(d, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), betterScored);
+            heap.back() = d;
+            std::push_heap(heap.begin(), heap.end(), betterScored);
+        }
+    }
+
+    // Результат от лучшего к худшему.
+    std::vector<ScoredDoc> take() {
+        std::sort_heap(heap.begin(), heap.end(), betterScored);
+        return std::move(heap);
+    }
+};
+
+// Терм ранжируемого запроса: курсор с частотами и оценки BM25.
+struct RankedTerm {
+    PostingCursor cursor;
+    double idf = 0;
+    double upper = 0;
+};
+
+// Top-k для дизъюнкции термов (WAND). Курсоры упорядочены по текущему
+// doc_id; pivot — первый курсор, на котором сумма верхних границ
+// превышает порог кучи. Документы до pivot-а набрать порог не могут,
+// и отстающие курсоры перепрыгивают к нему через advance(). Возвращает
+// число полностью оценённых документов.
+template <class DocLength>
+static inline uint64_t wandTopK(std::vector<RankedTerm>& terms, const Bm25& bm, DocLength length, TopK& top) {
+    std::vector<RankedTerm*> order;
+    for (auto& t : terms) {
+        if (t.cursor.valid()) order.push_back(&t);
+    }
+    // Курсоры на одном документе — в порядке термов: вклады складываются
+    // всегда в одном порядке, и равные документы (в том числе в разных
+    // шардах) получают побитово равные оценки.
+    auto byDoc = [](const RankedTerm* a, const RankedTerm* b) {
+        return a->cursor.doc() != b->cursor.doc() ? a->cursor.doc() < b->cursor.doc() : a < b;
+    };
+
+    uint64_t scored = 0;
+    while (!order.empty()) {
+        std::sort(order.begin(), order.end(), byDoc);
+
+        double threshold = top.threshold();
+        double bound = 0;
+        size_t p = 0;
+        for (; p < order.size(); ++p) {
+            bound += order[p]->upper;
+            if (bound > threshold) break;
+        }
+        if (p == order.size()) break;
+
+        int pivot = order[p]->cursor.doc();
+        if (order[0]->cursor.doc() == pivot) {
+            uint32_t len = length(pivot);
+            double score = 0;
+            for (auto* t : order) {
+                if (t->cursor.doc() != pivot) break;
+                score += bm.termScore(t->idf, (uint32_t)t->cursor.freq(), len);
+                t->cursor.next();
+            }
+            top.push(pivot, score);
+            ++scored;
+        } else {
+            for (size_t i = 0; i < p; ++i) order[i]->cursor.advance(pivot);
+        }
+        order.erase(std::remove_if(order.begin(), order.end(),
+                                   [](const RankedTerm* t) { return !t->cursor.valid(); }),
+                    order.end());
+    }
+    return scored;
+}
+
+// Top-k среди готового списка кандидатов (булев результат запроса):
+// вклад каждого терма добирается через advance() его курсора. Когда
+// порог кучи достигает суммы всех границ, оставшиеся кандидаты (с
+// большими doc_id) войти в top-k уже не могут.
+template <class DocLength>
+static inline uint64_t scoreCandidates(const std::vector<int>& candidates, std::vector<RankedTerm>& terms,
+                                       const Bm25& bm, DocLength length, TopK& top) {
+    double bound = 0;
+    for (auto& t : terms) bound += t.upper;
+    uint64_t scored = 0;
+    for (int doc : candidates) {
+        if (bound <= top.threshold()) break;
+        uint32_t len = length(doc);
+        double score = 0;
+        for (auto& t : terms) {
+            t.cursor.advance(doc);
+            if (t.cursor.valid() && t.cursor.doc() == doc) {
+                score += bm.termScore(t.idf, (uint32_t)t.cursor.freq(), len);
+            }
+        }
+        top.push(doc, score);
+        ++scored;
+    }
+    return scored;
+}
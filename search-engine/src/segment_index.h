@@ -0,0 +1,716 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "doc_bitmap.h"
+#include "doc_iterator.h"
+#include "index_format.h"
+#include "term_expansion.h"
+
+// Инкрементальный индекс — каталог из нескольких сегментов. Каждый
+// сегмент — обычный бинарный индекс с локальными doc_id, покрывающий
+// непрерывный диапазон глобальных doc_id [base, base + count). Состояние
+// описывает MANIFEST:
+//
+//   MANIFEST 1
+//   generation <N>
+//   next_id <следующий свободный doc_id>
+//   tombstones <файл битовой карты удалённых doc_id>
+//   docmap <файл external_id -> doc_id>
+//   segments <K>
+//   <файл сегмента> <base> <count>      K строк по возрастанию base
+//
+// Писатели создают новые файлы и атомарно заменяют MANIFEST через rename,
+// поэтому читатели всегда видят согласованное поколение.
+
+static const char MANIFEST_NAME[] = "MANIFEST";
+
+struct SegmentInfo {
+    std::string file;
+    uint32_t base = 0;
+    uint32_t count = 0;
+};
+
+struct IndexManifest {
+    uint64_t generation = 0;
+    uint32_t next_id = 0;
+    std::string tombstones;
+    std::string docmap;
+    std::vector<SegmentInfo> segments;
+
+    bool load(const std::string& dir) {
+        std::ifstream f(dir + "/" + MANIFEST_NAME);
+        if (!f) return false;
+        std::string word;
+        int version = 0;
+        size_t count = 0;
+        if (!(f >> word >> version) || word != "MANIFEST" || version != 1) {
+            std::cerr << "Bad manifest format: " << dir << "\n";
+            return false;
+        }
+        if (!(f >> word >> generation) || word != "generation" ||
+            !(f >> word >> next_id) || word != "next_id" ||
+            !(f >> word >> tombstones) || word != "tombstones" ||
+            !(f >> word >> docmap) || word != "docmap" ||
+            !(f >> word >> count) || word != "segments") {
+            std::cerr << "Bad manifest format: " << dir << "\n";
+            return false;
+        }
+        segments.assign(count, SegmentInfo());
+        for (auto& s : segments) {
+            if (!(f >> s.file >> s.base >> s.count)) {
+                std::cerr << "Bad manifest format: " << dir << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool save(const std::string& dir) const {
+        std::string tmp = dir + "/" + MANIFEST_NAME + ".tmp";
+        {
+            std::ofstream f(tmp);
+            if (!f) return false;
+            f << "MANIFEST 1\n";
+            f << "generation " << generation << "\n";
+            f << "next_id " << next_id << "\n";
+            f << "tombstones " << tombstones << "\n";
+            f << "docmap " << docmap << "\n";
+            f << "segments " << segments.size() << "\n";
+            for (auto& s : segments) f << s.file << " " << s.base << " " << s.count << "\n";
+            if (!f.flush()) return false;
+        }
+        return rename(tmp.c_str(), (dir + "/" + MANIFEST_NAME).c_str()) == 0;
+    }
+};
+
+// Шардированный индекс (index_builder --shards N) — каталог из N
+// бинарных индексов, разделённых по диапазонам doc_id, и файла SHARDS:
+//
+//   SHARDS 1
+//   shards <N>
+//   <файл шарда> <base> <count>      N строк по возрастанию base
+//
+// В отличие от каталога сегментов шарды не меняются и не сливаются:
+// search выполняет запрос на всех шардах параллельно и склеивает ответы.
+
+static const char SHARDS_NAME[] = "SHARDS";
+
+struct ShardManifest {
+    std::vector<SegmentInfo> shards;
+
+    bool load(const std::string& dir) {
+        std::ifstream f(dir + "/" + SHARDS_NAME);
+        if (!f) return false;
+        std::string word;
+        int version = 0;
+        size_t count = 0;
+        if (!(f >> word >> version) || word != "SHARDS" || version != 1 || !(f >> word >> count) ||
+            word != "shards") {
+            std::cerr << "Bad shards format: " << dir << "\n";
+            return false;
+        }
+        shards.assign(count, SegmentInfo());
+        uint32_t next = 0;
+        for (auto& s : shards) {
+            if (!(f >> s.file >> s.base >> s.count) || s.base != next) {
+                std::cerr << "Bad shards format: " << dir << "\n";
+                return false;
+            }
+            next = s.base + s.count;
+        }
+        return true;
+    }
+
+    bool save(const std::string& dir) const {
+        std::ofstream f(dir + "/" + SHARDS_NAME);
+        if (!f) return false;
+        f << "SHARDS 1\n";
+        f << "shards " << shards.size() << "\n";
+        for (auto& s : shards) f << s.file << " " << s.base << " " << s.count << "\n";
+        return (bool)f.flush();
+    }
+};
+
+static inline bool isIndexDirectory(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static inline bool isShardDirectory(const std::string& path) {
+    struct stat st;
+    return stat((path + "/" + SHARDS_NAME).c_str(), &st) == 0;
+}
+
+// Битовая карта удалённых (или заменённых новой версией) doc_id.
+class TombstoneSet {
+private:
+    std::vector<uint64_t> words;
+    size_t marked = 0;
+
+public:
+    bool test(uint32_t id) const {
+        size_t w = id >> 6;
+        return w < words.size() && ((words[w] >> (id & 63)) & 1);
+    }
+
+    void set(uint32_t id) {
+        size_t w = id >> 6;
+        if (w >= words.size()) words.resize(w + 1, 0);
+        if (!((words[w] >> (id & 63)) & 1)) ++marked;
+        words[w] |= 1ull << (id & 63);
+    }
+
+    size_t count() const { return marked; }
+    bool empty() const { return marked == 0; }
+
+    const uint64_t* data() const { return words.data(); }
+    size_t wordCount() const { return words.size(); }
+
+    // f(id) для каждого удалённого id из [begin, end).
+    template<class F>
+    void forEach(uint32_t begin, uint32_t end, F f) const {
+        for (size_t w = begin >> 6; w < words.size() && ((uint64_t)w << 6) < end; ++w) {
+            for (uint64_t bits = words[w]; bits; bits &= bits - 1) {
+                uint32_t id = (uint32_t)((w << 6) + (size_t)__builtin_ctzll(bits));
+                if (id >= begin && id < end) f(id);
+            }
+        }
+    }
+
+    bool load(const std::string& path) {
+        words.clear();
+        marked = 0;
+        std::ifstream f(path, std::ios::binary);
+        if (!f) return false;
+        uint64_t w;
+        while (f.read((char*)&w, sizeof(w))) {
+            words.push_back(w);
+            marked += (size_t)__builtin_popcountll(w);
+        }
+        return true;
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream f(path, std::ios::binary);
+        if (!f) return false;
+        f.write((const char*)words.data(), (std::streamsize)(words.size() * sizeof(uint64_t)));
+        return (bool)f;
+    }
+};
+
+// Позиции одного терма во всех сегментах. Документы запрашиваются по
+// возрастанию глобальных doc_id: курсоры сегментов идут только вперёд,
+// а позиции читаются лишь для запрошенных документов.
+class TermPositions {
+private:
+    struct Part {
+        int base;
+        PostingCursor docs;
+        PositionReader reader;
+    };
+    std::vector<Part> parts;
+    size_t cur = 0;
+
+public:
+    void add(int base, EncodedPostings docs, PositionReader reader) {
+        if (docs.count) parts.push_back(Part{base, PostingCursor(docs), reader});
+    }
+
+    // false, если терма в документе нет.
+    bool find(int doc_id, std::vector<uint32_t>& out) {
+        while (cur + 1 < parts.size() && parts[cur + 1].base <= doc_id) ++cur;
+        out.clear();
+        if (cur >= parts.size() || parts[cur].base > doc_id) return false;
+        Part& p = parts[cur];
+        int local = doc_id - p.base;
+        p.docs.advance(local);
+        if (!p.docs.valid() || p.docs.doc() != local) return false;
+        p.reader.read(p.docs.ordinal(), out);
+        return true;
+    }
+};
+
+// Терм по всем сегментам без копирования: курсоры сегментов идут по
+// очереди (базы возрастают), удалённые документы пропускаются.
+class SegmentTermIterator : public DocIterator {
+private:
+    struct Part {
+        int base;
+        PostingCursor docs;
+    };
+    std::vector<Part> parts;
+    const TombstoneSet* tombstones;
+    size_t cur = 0;
+    uint64_t total = 0;
+
+    void settle() {
+        for (; cur < parts.size(); ++cur) {
+            Part& p = parts[cur];
+            while (p.docs.valid() && tombstones->test((uint32_t)(p.base + p.docs.doc()))) p.docs.next();
+            if (p.docs.valid()) {
+                current = p.base + p.docs.doc();
+                return;
+            }
+        }
+        current = DOC_END;
+    }
+
+public:
+    explicit SegmentTermIterator(const TombstoneSet* t) : tombstones(t) {}
+
+    void add(int base, EncodedPostings docs) {
+        if (!docs.count) return;
+        parts.push_back(Part{base, PostingCursor(docs)});
+        total += docs.count;
+    }
+
+    // После всех add().
+    void start() { settle(); }
+
+    void next() override {
+        parts[cur].docs.next();
+        settle();
+    }
+
+    void advance(int target) override {
+        if (target <= current) return;
+        while (cur + 1 < parts.size() && parts[cur + 1].base <= target) ++cur;
+        if (cur < parts.size()) parts[cur].docs.advance(target - parts[cur].base);
+        settle();
+    }
+
+    uint64_t cost() const override { return total; }
+};
+
+// Живые документы: диапазоны doc_id сегментов без удалённых.
+class LiveDocsIterator : public DocIterator {
+private:
+    std::vector<std::pair<int, int>> ranges;  // [begin, end)
+    const TombstoneSet* tombstones;
+    size_t cur = 0;
+
+    void seek(int target) {
+        for (; cur < ranges.size(); ++cur) {
+            for (int d = std::max(target, ranges[cur].first); d < ranges[cur].second; ++d) {
+                if (!tombstones->test((uint32_t)d)) {
+                    current = d;
+                    return;
+                }
+            }
+        }
+        current = DOC_END;
+    }
+
+public:
+    LiveDocsIterator(std::vector<std::pair<int, int>> r, const TombstoneSet* t) : ranges(std::move(r)), tombstones(t) {
+        seek(0);
+    }
+
+    void next() override { seek(current + 1); }
+
+    void advance(int target) override {
+        if (target > current) seek(target);
+    }
+
+    uint64_t cost() const override {
+        uint64_t n = 0;
+        for (auto& r : ranges) n += (uint64_t)(r.second - r.first);
+        return n;
+    }
+};
+
+// Индекс для поиска: один файл (бинарный или текстовый) либо каталог
+// сегментов. Posting-листы отдаются в глобальных doc_id без удалённых
+// документов. Для единственного сегмента без удалений курсор читает
+// сжатый список прямо из mmap; иначе списки сегментов склеиваются
+// в storage запроса.
+//
+// Шардированный индекс открывается так же, как каталог сегментов без
+// удалений, и вдобавок отдаёт каждый шард отдельным индексом (shard()).
+class SegmentedIndex {
+private:
+    // Общие с индексами шардов.
+    std::vector<std::shared_ptr<MappedIndex>> segments;
+    std::vector<std::shared_ptr<TermExpander>> expanders;
+    std::vector<uint32_t> bases;
+    TombstoneSet tombstones;
+    // Удалённые документы каждого сегмента и их суммарная длина: BM25
+    // считает df и среднюю длину только по живым документам.
+    std::vector<uint32_t> dead_docs;
+    std::vector<uint64_t> dead_length;
+    // Живой df считается один раз на терм для открытого поколения.
+    struct LiveDfCache {
+        std::mutex mu;
+        std::unordered_map<std::string, uint64_t> df;
+    };
+    std::shared_ptr<LiveDfCache> live_df;
+    uint32_t doc_space = 0;
+    bool sharded = false;
+
+    int segmentOf(int doc_id) const {
+        if (doc_id < 0 || (uint32_t)doc_id >= doc_space) return -1;
+        auto it = std::upper_bound(bases.begin(), bases.end(), (uint32_t)doc_id);
+        int s = (int)(it - bases.begin()) - 1;
+        if (s < 0 || (uint32_t)doc_id - bases[s] >= segments[s]->docCount()) return -1;
+        return s;
+    }
+
+    bool direct() const {
+        return segments.size() == 1 && bases[0] == 0 && tombstones.empty();
+    }
+
+    void countDead() {
+        dead_docs.assign(segments.size(), 0);
+        dead_length.assign(segments.size(), 0);
+        live_df.reset(new LiveDfCache());
+        if (tombstones.empty()) return;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const MappedIndex& seg = *segments[i];
+            uint32_t base = bases[i];
+            tombstones.forEach(base, base + seg.docCount(), [&](uint32_t id) {
+                ++dead_docs[i];
+                dead_length[i] += seg.docLength((int)(id - base));
+            });
+        }
+    }
+
+    // Живые документы терма в сегменте i.
+    uint64_t segmentLiveDocFreq(size_t i, const TermEntry* e) const {
+        if (!dead_docs[i]) return e->doc_freq;
+        uint64_t dead = 0;
+        uint32_t base = bases[i];
+        if (const uint64_t* b = segments[i]->bitmap(e)) {
+            tombstones.forEach(base, base + segments[i]->docCount(), [&](uint32_t id) {
+                uint32_t local = id - base;
+                dead += (b[local >> 6] >> (local & 63)) & 1;
+            });
+        } else {
+            for (PostingCursor c(segments[i]->postings(e)); c.valid(); c.next()) {
+                if (tombstones.test(base + (uint32_t)c.doc())) ++dead;
+            }
+        }
+        return e->doc_freq - dead;
+    }
+
+public:
+    bool openFile(const std::string& path, bool* mapped = nullptr, int* text_terms = nullptr) {
+        std::unique_ptr<MappedIndex> seg(new MappedIndex());
+        bool binary = isBinaryIndexFile(path);
+        if (binary) {
+            if (!seg->open(path)) return false;
+        } else {
+            std::string image;
+            if (!convertTextIndex(path, image, text_terms)) return false;
+            if (!seg->openBuffer(std::move(image))) return false;
+        }
+        if (mapped) *mapped = binary;
+        sharded = false;
+        expanders.clear();
+        segments.clear();
+        bases.assign(1, 0);
+        doc_space = seg->docCount();
+        expanders.emplace_back(new TermExpander(*seg));
+        segments.push_back(std::move(seg));
+        countDead();
+        return true;
+    }
+
+    bool openShards(const std::string& dir) {
+        ShardManifest m;
+        if (!m.load(dir)) return false;
+        expanders.clear();
+        segments.clear();
+        bases.clear();
+        tombstones = TombstoneSet();
+        doc_space = 0;
+        for (auto& s : m.shards) {
+            std::shared_ptr<MappedIndex> seg(new MappedIndex());
+            if (!seg->open(dir + "/" + s.file)) return false;
+            if (seg->docCount() != s.count) {
+                std::cerr << "Шард не совпадает с SHARDS: " << s.file << "\n";
+                return false;
+            }
+            if (!segments.empty() && seg->stemmed() != segments[0]->stemmed()) {
+                std::cerr << "Шарды построены с разным стеммингом: " << s.file << "\n";
+                return false;
+            }
+            expanders.emplace_back(new TermExpander(*seg));
+            segments.push_back(std::move(seg));
+            bases.push_back(s.base);
+            doc_space = s.base + s.count;
+        }
+        countDead();
+        sharded = true;
+        return true;
+    }
+
+    bool openDirectory(const std::string& dir) {
+        if (isShardDirectory(dir)) return openShards(dir);
+        sharded = false;
+        IndexManifest m;
+        if (!m.load(dir)) {
+            std::cerr << "Не найден MANIFEST в каталоге индекса: " << dir << "\n";
+            return false;
+        }
+        expanders.clear();
+        segments.clear();
+        bases.clear();
+        for (auto& s : m.segments) {
+            std::shared_ptr<MappedIndex> seg(new MappedIndex());
+            if (!seg->open(dir + "/" + s.file)) return false;
+            if (!segments.empty() && seg->stemmed() != segments[0]->stemmed()) {
+                std::cerr << "Сегменты каталога построены с разным стеммингом: " << s.file << "\n";
+                return false;
+            }
+            expanders.emplace_back(new TermExpander(*seg));
+            segments.push_back(std::move(seg));
+            bases.push_back(s.base);
+        }
+        if (!m.tombstones.empty() && !tombstones.load(dir + "/" + m.tombstones)) {
+            std::cerr << "Не удалось прочитать tombstones: " << m.tombstones << "\n";
+            return false;
+        }
+        doc_space = m.next_id;
+        countDead();
+        return true;
+    }
+
+    size_t segmentCount() const { return segments.size(); }
+    // 0 — индекс не шардирован.
+    size_t shardCount() const { return sharded ? segments.size() : 0; }
+    uint32_t segmentBase(size_t i) const { return bases[i]; }
+
+    // Шард i как отдельный индекс с локальными doc_id (doc_id - base).
+    // Файл и раскрытие шаблонов общие с этим индексом.
+    SegmentedIndex shard(size_t i) const {
+        SegmentedIndex r;
+        r.segments.push_back(segments[i]);
+        r.expanders.push_back(expanders[i]);
+        r.bases.assign(1, 0);
+        r.doc_space = segments[i]->docCount();
+        r.countDead();
+        return r;
+    }
+    size_t deletedCount() const { return tombstones.count(); }
+    uint32_t docCount() const { return doc_space; }
+
+    uint64_t termCount() const {
+        uint64_t n = 0;
+        for (auto& s : segments) n += s->termCount();
+        return n;
+    }
+
+    // Сумма doc_freq сегментов вместе с удалёнными документами: оценки
+    // хватает планировщику, и она не читает posting-листы.
+    uint64_t docFreq(std::string_view term) const {
+        uint64_t n = 0;
+        for (auto& s : segments) {
+            const TermEntry* e = s->findTerm(term);
+            if (e) n += e->doc_freq;
+        }
+        return n;
+    }
+
+    // Точный df по живым документам (idf в BM25). Для сегментов с
+    // удалениями считается при первом запросе терма и кэшируется.
+    uint64_t liveDocFreq(std::string_view term) const {
+        if (tombstones.empty()) return docFreq(term);
+        std::string key(term);
+        {
+            std::lock_guard<std::mutex> lock(live_df->mu);
+            auto it = live_df->df.find(key);
+            if (it != live_df->df.end()) return it->second;
+        }
+        uint64_t n = 0;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const TermEntry* e = segments[i]->findTerm(term);
+            if (e) n += segmentLiveDocFreq(i, e);
+        }
+        std::lock_guard<std::mutex> lock(live_df->mu);
+        live_df->df.emplace(std::move(key), n);
+        return n;
+    }
+
+    // Термы всех сегментов под шаблон с '*' (fuzzy = false) или на
+    // расстоянии Левенштейна не больше distance от pattern, по возрастанию.
+    std::vector<std::string> expand(std::string_view pattern, bool fuzzy, uint32_t distance = 0) const {
+        std::vector<std::string_view> found;
+        for (auto& e : expanders) {
+            if (fuzzy) e->fuzzy(pattern, distance, found);
+            else e->wildcard(pattern, found);
+        }
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+        return std::vector<std::string>(found.begin(), found.end());
+    }
+
+    // Позиции термов есть во всех сегментах.
+    bool hasPositions() const {
+        for (auto& s : segments) {
+            if (!s->hasPositions()) return false;
+        }
+        return !segments.empty();
+    }
+
+    // Термы индекса — основы слов, запросы нужно стеммировать так же.
+    bool stemmed() const { return !segments.empty() && segments[0]->stemmed(); }
+
+    TermPositions positions(std::string_view term) const {
+        TermPositions r;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const TermEntry* e = segments[i]->findTerm(term);
+            r.add((int)bases[i], segments[i]->postings(e), segments[i]->positions(e));
+        }
+        return r;
+    }
+
+    // Частоты термов и длины документов есть во всех сегментах.
+    bool hasFreqs() const {
+        for (auto& s : segments) {
+            if (!s->hasFreqs()) return false;
+        }
+        return !segments.empty();
+    }
+
+    double avgDocLength() const {
+        uint64_t total = 0, docs = 0;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            total += segments[i]->totalLength() - dead_length[i];
+            docs += segments[i]->docCount() - dead_docs[i];
+        }
+        return docs ? (double)total / docs : 0;
+    }
+
+    uint32_t docLength(int doc_id) const {
+        int s = segmentOf(doc_id);
+        return s < 0 ? 0 : segments[s]->docLength(doc_id - (int)bases[s]);
+    }
+
+    // Оценки терма для верхней границы BM25: наибольшая частота и
+    // наименьшая длина документа по всем сегментам.
+    void termBounds(std::string_view term, uint32_t& max_tf, uint32_t& min_doc_len) const {
+        max_tf = 0;
+        min_doc_len = UINT32_MAX;
+        for (auto& s : segments) {
+            const TermEntry* e = s->findTerm(term);
+            if (!e) continue;
+            max_tf = std::max(max_tf, e->max_tf);
+            min_doc_len = std::min(min_doc_len, s->hasFreqs() ? e->min_doc_len : 0);
+        }
+    }
+
+    bool isLive(int doc_id) const {
+        return segmentOf(doc_id) >= 0 && !tombstones.test((uint32_t)doc_id);
+    }
+
+    // Ленивый итератор терма для булевых операторов.
+    DocIteratorPtr iterator(std::string_view term) const {
+        if (direct()) return DocIteratorPtr(new CursorIterator(PostingCursor(segments[0]->postings(term))));
+        SegmentTermIterator* it = new SegmentTermIterator(&tombstones);
+        for (size_t i = 0; i < segments.size(); ++i) it->add((int)bases[i], segments[i]->postings(term));
+        it->start();
+        return DocIteratorPtr(it);
+    }
+
+    // Битовая карта терма, отображённая из файла, если индекс — один
+    // сегмент без удалений и терм в нём плотный; count — число документов.
+    const uint64_t* directBitmap(std::string_view term, uint64_t& count) const {
+        if (!direct()) return nullptr;
+        const TermEntry* e = segments[0]->findTerm(term);
+        count = e ? e->doc_freq : 0;
+        return segments[0]->bitmap(e);
+    }
+
+    // Добавляет в out (docCount() бит) живые документы терма: карты
+    // плотных термов сегментов сдвигаются на базу, остальные листы
+    // раскладываются по битам.
+    void termBitmap(std::string_view term, DocBitmap& out) const {
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const TermEntry* e = segments[i]->findTerm(term);
+            if (!e) continue;
+            if (const uint64_t* b = segments[i]->bitmap(e)) {
+                out.orShifted(b, segments[i]->docCount(), bases[i]);
+                continue;
+            }
+            for (PostingCursor c(segments[i]->postings(e)); c.valid(); c.next()) {
+                uint64_t d = (uint64_t)c.doc() + bases[i];
+                if (d < doc_space) out.set((uint32_t)d);
+            }
+        }
+        out.trim();
+        out.andNotWith(tombstones.data(), tombstones.wordCount());
+    }
+
+    // Все живые документы в out (docCount() бит).
+    void liveBitmap(DocBitmap& out) const {
+        for (size_t i = 0; i < segments.size(); ++i) {
+            uint64_t end = std::min<uint64_t>(doc_space, (uint64_t)bases[i] + segments[i]->docCount());
+            if (bases[i] < end) out.setRange(bases[i], (uint32_t)end);
+        }
+        out.andNotWith(tombstones.data(), tombstones.wordCount());
+    }
+
+    DocIteratorPtr liveDocs() const {
+        std::vector<std::pair<int, int>> ranges;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            int end = (int)std::min<uint64_t>(doc_space, (uint64_t)bases[i] + segments[i]->docCount());
+            if ((int)bases[i] < end) ranges.push_back(std::make_pair((int)bases[i], end));
+        }
+        return DocIteratorPtr(new LiveDocsIterator(std::move(ranges), &tombstones));
+    }
+
+    // with_freqs — сохранить в storage и частоты (для ранжирования).
+    PostingCursor cursor(std::string_view term, std::deque<std::vector<int>>& storage,
+                         bool with_freqs = false) const {
+        if (direct()) return PostingCursor(segments[0]->postings(term));
+        storage.emplace_back();
+        std::vector<int>& out = storage.back();
+        std::vector<int>* freqs = nullptr;
+        if (with_freqs) {
+            storage.emplace_back();
+            freqs = &storage.back();
+        }
+        for (size_t i = 0; i < segments.size(); ++i) {
+            for (PostingCursor c(segments[i]->postings(term)); c.valid(); c.next()) {
+                int d = c.doc() + (int)bases[i];
+                if (tombstones.test((uint32_t)d)) continue;
+                out.push_back(d);
+                if (freqs) freqs->push_back(c.freq());
+            }
+        }
+        return PostingCursor(out.data(), out.size(), freqs ? freqs->data() : nullptr);
+    }
+
+    // См. MappedIndex::document().
+    bool document(int doc_id, StoredDocument& out, bool with_text = false, DocBlockCache* cache = nullptr) const {
+        int s = segmentOf(doc_id);
+        if (s < 0) {
+            out = StoredDocument();
+            return false;
+        }
+        return segments[s]->document(doc_id - (int)bases[s], out, with_text, cache);
+    }
+
+    // Хотя бы в одном сегменте хранятся тексты документов.
+    bool hasText() const {
+        for (auto& s : segments) {
+            if (s->hasText()) return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "stemmer.h"
+#include "text_tokenizer.h"
+
+// Сниппет для выдачи по тексту из хранилища документов (doc_store.h):
+// окно из SNIPPET_TOKENS токенов, в котором больше всего разных термов
+// запроса (при равенстве — больше вхождений, затем раньше в тексте),
+// вхождения выделены **...**. Текст разбирается тем же токенизатором,
+// что и при индексации; у индекса со стеммингом сравниваются основы.
+// Если термов в тексте нет — начало текста.
+
+static const size_t SNIPPET_TOKENS = 24;
+// Окно начинается на несколько токенов раньше вхождения, чтобы был виден контекст.
+static const size_t SNIPPET_LEAD = 3;
+// Больше вхождений как начала окна не перебирается.
+static const size_t SNIPPET_MAX_STARTS = 1024;
+
+class SnippetBuilder {
+private:
+    std::unordered_map<std::string, uint32_t> terms;
+    bool stemmed;
+    TokenScratch scratch;
+    std::string word;
+    std::vector<int32_t> hits;
+    std::vector<uint32_t> seen;
+    uint32_t stamp = 0;
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+    // Байты между токенами: пробельные серии сжимаются в один пробел.
+    static void appendGap(std::string& out, std::string_view gap) {
+        for (char c : gap) {
+            if (!isSpace(c)) out += c;
+            else if (out.empty() || out.back() != ' ') out += ' ';
+        }
+    }
+
+    int32_t termOf(size_t i) {
+        if (scratch.ends[i] - scratch.starts[i] < MIN_TOKEN_LENGTH) return -1;
+        std::string_view t = tokenAt(scratch, i);
+        word.assign(t.data(), t.size());
+        if (stemmed) word.resize(stemInPlace(&word[0], word.size()));
+        auto it = terms.find(word);
+        return it == terms.end() ? -1 : (int32_t)it->second;
+    }
+
+public:
+    // words — термы запроса в форме индекса (после стемминга, если stem).
+    SnippetBuilder(const std::vector<std::string>& words, bool stem) : stemmed(stem) {
+        for (auto& w : words) terms.emplace(w, (uint32_t)terms.size());
+        seen.assign(terms.size(), 0);
+    }
+
+    // Пусто, если в тексте нет ни одного токена.
+    std::string build(std::string_view text) {
+        size_t count = tokenBounds(text, scratch);
+        if (!count) return std::string();
+        hits.resize(count);
+        std::vector<size_t> starts;
+        for (size_t i = 0; i < count; ++i) {
+            hits[i] = termOf(i);
+            if (hits[i] >= 0 && starts.size() < SNIPPET_MAX_STARTS) {
+                size_t s = i >= SNIPPET_LEAD ? i - SNIPPET_LEAD : 0;
+                if (starts.empty() || starts.back() != s) starts.push_back(s);
+            }
+        }
+
+        size_t best = 0, best_distinct = 0, best_total = 0;
+        for (size_t s : starts) {
+            ++stamp;
+            size_t distinct = 0, total = 0;
+            for (size_t i = s; i < count && i < s + SNIPPET_TOKENS; ++i) {
+                if (hits[i] < 0) continue;
+                ++total;
+                if (seen[hits[i]] != stamp) {
+                    seen[hits[i]] = stamp;
+                    ++distinct;
+                }
+            }
+            if (distinct > best_distinct || (distinct == best_distinct && total > best_total)) {
+                best = s;
+                best_distinct = distinct;
+                best_total = total;
+            }
+        }
+
+        size_t last = std::min(count, best + SNIPPET_TOKENS) - 1;
+        std::string out;
+        if (best > 0) out = "... ";
+        for (size_t i = best; i <= last; ++i) {
+            if (i > best) appendGap(out, text.substr(scratch.ends[i - 1], scratch.starts[i] - scratch.ends[i - 1]));
+            std::string_view t = text.substr(scratch.starts[i], scratch.ends[i] - scratch.starts[i]);
+            if (hits[i] >= 0) {
+                out += "**";
+                out.append(t.data(), t.size());
+                out += "**";
+            } else {
+                out.append(t.data(), t.size());
+            }
+        }
+        if (last + 1 < count) out += " ...";
+        return out;
+    }
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Простой эвристический стеммер (правила прежнего SimpleStemmer) без
+// выделений памяти: слово укорачивается на месте. Все замены короче
+// отрезаемых окончаний, поэтому результат помещается в тот же буфер.
+//
+//  1. Первое из окончаний ing, ed, ly, es, s, 's отрезается, если слово
+//     длиннее окончания больше чем на 2 символа.
+//  2. Первое подходящее правило замены суффикса (ies -> y, ...), если
+//     слово длиннее порога правила.
+//  3. Удвоенная согласная в конце слова длиннее 3 символов сокращается.
+//
+// Токены индекса (от 2 символов) после стемминга не короче исходных
+// 3 символов либо не меняются, так что позиции токенов не сдвигаются.
+
+struct StemRule {
+    const char* suffix;
+    uint8_t suffix_len;
+    // Правило применяется к словам длиннее min_len.
+    uint8_t min_len;
+    const char* replacement;
+    uint8_t replacement_len;
+};
+
+template <size_t N, size_t M>
+constexpr StemRule stemRule(const char (&suffix)[N], size_t min_len, const char (&replacement)[M]) {
+    return StemRule{suffix, (uint8_t)(N - 1), (uint8_t)min_len, replacement, (uint8_t)(M - 1)};
+}
+
+template <size_t N>
+constexpr StemRule stemEnding(const char (&suffix)[N]) {
+    return stemRule(suffix, N - 1 + 2, "");
+}
+
+static constexpr StemRule STEM_ENDINGS[] = {
+    stemEnding("ing"), stemEnding("ed"), stemEnding("ly"), stemEnding("es"), stemEnding("s"), stemEnding("'s"),
+};
+
+static constexpr StemRule STEM_REWRITES[] = {
+    stemRule("ies", 5, "y"),
+    stemRule("ied", 5, "y"),
+    stemRule("iness", 6, "y"),
+    stemRule("ization", 8, "ize"),
+    stemRule("ational", 8, "ate"),
+    stemRule("tional", 7, "tion"),
+    stemRule("biliti", 7, "ble"),
+    stemRule("fulness", 8, "ful"),
+    stemRule("ousness", 8, "ous"),
+};
+
+static inline bool stemApplies(const char* w, size_t n, const StemRule& r) {
+    return n > r.min_len && memcmp(w + n - r.suffix_len, r.suffix, r.suffix_len) == 0;
+}
+
+// Стемминг w[0, n) на месте; возвращает новую длину.
+static inline size_t stemInPlace(char* w, size_t n) {
+    for (const StemRule& r : STEM_ENDINGS) {
+        if (stemApplies(w, n, r)) {
+            n -= r.suffix_len;
+            break;
+        }
+    }
+    for (const StemRule& r : STEM_REWRITES) {
+        if (stemApplies(w, n, r)) {
+            memcpy(w + n - r.suffix_len, r.replacement, r.replacement_len);
+            n = n - r.suffix_len + r.replacement_len;
+            break;
+        }
+    }
+    if (n > 3 && w[n - 1] == w[n - 2]) {
+        char c = (char)(w[n - 1] | 0x20);
+        if (c != 'a' && c != 'e' && c != 'i' && c != 'o' && c != 'u') --n;
+    }
+    return n;
+}
+
+static inline void stemWord(std::string& s) {
+    if (!s.empty()) s.resize(stemInPlace(&s[0], s.size()));
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с кражей работы для параллельного выполнения одного запроса
+// по шардам. У каждого потока своя очередь: задачи пачки раздаются по
+// очередям по кругу, поток берёт задачи из хвоста своей очереди, а
+// опустевший — крадёт из головы чужих. Так неравные по стоимости шарды
+// не оставляют потоки без дела, пока кто-то дорабатывает длинную очередь.
+//
+// parallelFor() можно вызывать из нескольких потоков сразу (воркеры
+// --serve): вызывающий поток сам выполняет задачи, пока его пачка не
+// закончится, поэтому пачки не ждут друг друга в очереди.
+class WorkStealingPool {
+private:
+    typedef std::function<void()> Task;
+
+    struct Queue {
+        std::mutex mu;
+        std::deque<Task> tasks;
+    };
+
+    struct Batch {
+        std::atomic<size_t> left{0};
+        std::mutex mu;
+        std::condition_variable done;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> pending{0};
+    std::atomic<size_t> next_queue{0};
+    std::mutex sleep_mu;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    bool popBack(Queue& q, Task& out) {
+        std::lock_guard<std::mutex> lock(q.mu);
+        if (q.tasks.empty()) return false;
+        out = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        --pending;
+        return true;
+    }
+
+    bool stealFront(Queue& q, Task& out) {
+        std::lock_guard<std::mutex> lock(q.mu);
+        if (q.tasks.empty()) return false;
+        out = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        --pending;
+        return true;
+    }
+
+    // Своя очередь, затем чужие, начиная со следующей.
+    bool take(size_t self, Task& out) {
+        if (queues.empty()) return false;
+        if (self < queues.size() && popBack(*queues[self], out)) return true;
+        for (size_t i = 1; i <= queues.size(); ++i) {
+            if (stealFront(*queues[(self + i) % queues.size()], out)) return true;
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        Task t;
+        for (;;) {
+            if (take(self, t)) {
+                t();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mu);
+            wake.wait(lock, [this] { return stopping || pending > 0; });
+            if (stopping && pending == 0) return;
+        }
+    }
+
+public:
+    // workers — потоков пула; вызывающий parallelFor() поток добавляется к ним.
+    explicit WorkStealingPool(size_t workers) {
+        for (size_t i = 0; i < workers; ++i) queues.emplace_back(new Queue());
+        for (size_t i = 0; i < workers; ++i) threads.emplace_back([this, i] { work(i); });
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mu);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    size_t workers() const { return threads.size(); }
+
+    // fn(0) ... fn(n - 1) параллельно; возвращается, когда все выполнены.
+    template <class Fn>
+    void parallelFor(size_t n, const Fn& fn) {
+        if (threads.empty() || n <= 1) {
+            for (size_t i = 0; i < n; ++i) fn(i);
+            return;
+        }
+        // Пачку держат и её задачи: последняя может ещё будить ждущего,
+        // когда вызывающий поток уже вернулся.
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+        batch->left = n;
+        // Задача 0 остаётся вызывающему потоку, остальные — в очереди.
+        for (size_t i = 1; i < n; ++i) {
+            Queue& q = *queues[next_queue++ % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mu);
+            q.tasks.push_back([&fn, batch, i] {
+                fn(i);
+                if (--batch->left == 0) {
+                    std::lock_guard<std::mutex> done(batch->mu);
+                    batch->done.notify_all();
+                }
+            });
+            ++pending;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mu);
+        }
+        wake.notify_all();
+
+        fn(0);
+        --batch->left;
+        Task t;
+        while (batch->left > 0) {
+            if (take(queues.size(), t)) {
+                t();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(batch->mu);
+            batch->done.wait(lock, [&batch] { return batch->left == 0; });
+        }
+    }
+};
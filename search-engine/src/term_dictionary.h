@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Общий словарь термов для tokenizer и index_builder, и замороженный
+// отсортированный словарь для поиска.
+//
+// TermDictionary — хэш-таблица с открытой адресацией (линейное
+// пробирование) поверх плотного массива записей. Слот — 8 байт: старшие
+// 32 бита хэша и номер записи, поэтому промах по слоту отсекается без
+// обращения к ключу, а таблица растёт удвоением при заполнении 70%.
+// Ключи до 12 байт лежат прямо в записи, длинные — в арене. Записи
+// нумеруются в порядке вставки, и номера при росте таблицы не меняются.
+
+// MurmurHash64A по 8 байт за шаг.
+static inline uint64_t hashTerm(std::string_view s) {
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const char* p = s.data();
+    size_t n = s.size();
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (n * m);
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t k;
+        memcpy(&k, p, 8);
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if (n) {
+        // Хвост побайтно: memcpy переменной длины здесь — вызов функции.
+        uint64_t k = 0;
+        for (size_t i = 0; i < n; ++i) k |= (uint64_t)(unsigned char)p[i] << (8 * i);
+        h ^= k;
+        h *= m;
+    }
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return h;
+}
+
+// Байты ключей (и других строк на время построения индекса) кусками по
+// 64 КБ; выданные указатели живут до clear().
+class TermArena {
+private:
+    static const size_t CHUNK = 1 << 16;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char* block = nullptr;
+    size_t used = CHUNK;
+    size_t total = 0;
+
+public:
+    char* allocate(size_t n) {
+        if (!n) return block;
+        char* dst;
+        if (n > CHUNK / 4) {
+            // Большой ключ — в отдельном куске, текущий кусок не трогаем.
+            chunks.emplace_back(new char[n]);
+            dst = chunks.back().get();
+        } else {
+            if (used + n > CHUNK) {
+                chunks.emplace_back(new char[CHUNK]);
+                block = chunks.back().get();
+                used = 0;
+            }
+            dst = block + used;
+            used += n;
+        }
+        total += n;
+        return dst;
+    }
+
+    const char* copy(std::string_view s) {
+        char* dst = allocate(s.size());
+        if (!s.empty()) memcpy(dst, s.data(), s.size());
+        return dst;
+    }
+
+    size_t bytes() const { return total; }
+
+    void clear() {
+        chunks.clear();
+        block = nullptr;
+        used = CHUNK;
+        total = 0;
+    }
+};
+
+template <class V>
+class TermDictionary {
+public:
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+private:
+    static const size_t INLINE_KEY = 12;
+    static const size_t MIN_SLOTS = 1024;
+
+    struct Key {
+        uint32_t len;
+        // Ключ до INLINE_KEY байт или указатель в арену.
+        char bytes[INLINE_KEY];
+
+        std::string_view view() const {
+            if (len <= INLINE_KEY) return std::string_view(bytes, len);
+            const char* p;
+            memcpy(&p, bytes, sizeof(p));
+            return std::string_view(p, len);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        V value;
+    };
+
+    // 0 — пустой слот; иначе (хэш >> 32) << 32 | (номер записи + 1).
+    std::vector<uint64_t> slots;
+    std::vector<Entry> entries;
+    TermArena arena;
+
+    static uint64_t slotOf(uint64_t h, uint32_t index) { return (h & 0xffffffff00000000ull) | (index + 1); }
+
+    void grow() {
+        std::vector<uint64_t> old;
+        old.swap(slots);
+        slots.assign(std::max(MIN_SLOTS, old.size() * 2), 0);
+        size_t mask = slots.size() - 1;
+        for (uint64_t s : old) {
+            if (!s) continue;
+            uint32_t index = (uint32_t)s - 1;
+            size_t i = hashTerm(entries[index].key.view()) & mask;
+            while (slots[i]) i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+    // Слот ключа или первый пустой слот на его пути.
+    size_t probe(std::string_view key, uint64_t h) const {
+        size_t mask = slots.size() - 1;
+        uint64_t tag = h & 0xffffffff00000000ull;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            uint64_t s = slots[i];
+            if (!s) return i;
+            if ((s & 0xffffffff00000000ull) == tag && entries[(uint32_t)s - 1].key.view() == key) return i;
+        }
+    }
+
+public:
+    TermDictionary() { slots.assign(MIN_SLOTS, 0); }
+
+    size_t size() const { return entries.size(); }
+
+    // Номер записи ключа; fresh — запись создана этим вызовом.
+    uint32_t insert(std::string_view key, bool& fresh) {
+        uint64_t h = hashTerm(key);
+        size_t i = probe(key, h);
+        fresh = slots[i] == 0;
+        if (!fresh) return (uint32_t)slots[i] - 1;
+
+        uint32_t index = (uint32_t)entries.size();
+        entries.emplace_back();
+        Key& k = entries.back().key;
+        k.len = (uint32_t)key.size();
+        if (key.size() <= INLINE_KEY) {
+            memcpy(k.bytes, key.data(), key.size());
+        } else {
+            const char* p = arena.copy(key);
+            memcpy(k.bytes, &p, sizeof(p));
+        }
+        slots[i] = slotOf(h, index);
+        if (entries.size() * 10 >= slots.size() * 7) grow();
+        return index;
+    }
+
+    V& operator[](std::string_view key) {
+        bool fresh;
+        return entries[insert(key, fresh)].value;
+    }
+
+    uint32_t find(std::string_view key) const {
+        uint64_t s = slots[probe(key, hashTerm(key))];
+        return s ? (uint32_t)s - 1 : NOT_FOUND;
+    }
+
+    std::string_view key(uint32_t index) const { return entries[index].key.view(); }
+    V& value(uint32_t index) { return entries[index].value; }
+    const V& value(uint32_t index) const { return entries[index].value; }
+
+    // Номера записей в порядке возрастания ключей.
+    std::vector<uint32_t> sortedOrder() const {
+        std::vector<uint32_t> order(entries.size());
+        for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return key(a) < key(b); });
+        return order;
+    }
+
+    // Память самой таблицы без содержимого значений.
+    size_t memoryBytes() const {
+        return slots.capacity() * sizeof(uint64_t) + entries.capacity() * sizeof(Entry) + arena.bytes();
+    }
+
+    void clear() {
+        entries.clear();
+        arena.clear();
+        slots.assign(MIN_SLOTS, 0);
+    }
+};
+
+// Первые 8 байт ключа как big-endian число, дополненное нулями: порядок
+// таких чисел совпадает с лексикографическим порядком ключей, пока
+// префиксы различаются (в термах нет нулевых байт).
+static inline uint64_t termPrefix(std::string_view s) {
+    uint64_t r = 0;
+    size_t n = std::min<size_t>(s.size(), 8);
+    for (size_t i = 0; i < n; ++i) r |= (uint64_t)(unsigned char)s[i] << (56 - 8 * i);
+    return r;
+}
+
+// Замороженный отсортированный словарь: массив префиксов termPrefix всех
+// термов по возрастанию (секция индекса SEC_TERM_PREFIXES). Бинарный
+// поиск идёт по плотному массиву uint64 без обращений к ключам, и только
+// среди термов с тем же 8-байтным префиксом (обычно одного) ключи
+// сравниваются целиком через key_at(i).
+template <class KeyAt>
+static inline uint32_t frozenLowerBound(const uint64_t* prefixes, uint32_t n, std::string_view key, KeyAt key_at) {
+    uint64_t p = termPrefix(key);
+    const uint64_t* lo = std::lower_bound(prefixes, prefixes + n, p);
+    uint32_t first = (uint32_t)(lo - prefixes);
+    if (first == n || *lo != p || key.size() <= 8) {
+        // Ключ короче 9 байт совпадает со своим префиксом и идёт первым
+        // среди термов с ним.
+        return first;
+    }
+    uint32_t last = (uint32_t)(std::upper_bound(lo, prefixes + n, p) - prefixes);
+    while (first < last) {
+        uint32_t mid = first + (last - first) / 2;
+        if (key_at(mid) < key) first = mid + 1;
+        else last = mid;
+    }
+    return first;
+}
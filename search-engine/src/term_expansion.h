@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "index_format.h"
+
+// Раскрытие шаблонов запроса в термы отсортированного словаря сегмента.
+//
+//  - Шаблон с '*' (любое число символов). Термы с литеральным префиксом
+//    шаблона — непрерывный диапазон словаря (два lowerBound); короткий
+//    диапазон просматривается целиком. Иначе кандидаты — пересечение
+//    списков триграмм k-грамм-индекса: триграммы "$терм$" -> номера
+//    термов, "$" отмечает начало и конец. Кандидаты сверяются с
+//    шаблоном. Индекс триграмм строится при первом шаблоне, которому он
+//    нужен, и живёт вместе с сегментом.
+//  - Нечёткий терм: все термы на расстоянии Левенштейна не больше 2.
+//    Словарь обходится по порядку как неявный бор, состояния автомата
+//    Левенштейна для общего префикса соседних термов не пересчитываются,
+//    а если префикс уже не может дать совпадения, обход перескакивает
+//    lowerBound'ом через все термы с этим префиксом.
+
+// Совпадение строки целиком с шаблоном, '*' — любая подстрока.
+static inline bool wildcardMatch(std::string_view pattern, std::string_view s) {
+    size_t p = 0, i = 0, star = std::string_view::npos, mark = 0;
+    while (i < s.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            mark = i;
+        } else if (p < pattern.size() && pattern[p] == s[i]) {
+            ++p;
+            ++i;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            i = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+// Наименьшая строка больше всех строк с префиксом prefix; пусто — такой нет.
+static inline std::string prefixSuccessor(std::string_view prefix) {
+    std::string s(prefix);
+    while (!s.empty() && (unsigned char)s.back() == 0xff) s.pop_back();
+    if (!s.empty()) s.back() = (char)((unsigned char)s.back() + 1);
+    return s;
+}
+
+// Автомат Левенштейна для слова и расстояния max: состояние — строка
+// таблицы динамического программирования по префиксу входа, значения
+// обрезаны на max + 1.
+class LevenshteinAutomaton {
+private:
+    std::string word;
+    uint8_t limit;
+
+public:
+    typedef std::vector<uint8_t> State;
+
+    LevenshteinAutomaton(std::string_view w, uint32_t max) : word(w), limit((uint8_t)(max + 1)) {}
+
+    State start() const {
+        State s(word.size() + 1);
+        for (size_t i = 0; i < s.size(); ++i) s[i] = (uint8_t)std::min<size_t>(i, limit);
+        return s;
+    }
+
+    void step(const State& s, char c, State& out) const {
+        out.resize(s.size());
+        out[0] = (uint8_t)std::min(s[0] + 1, (int)limit);
+        for (size_t i = 1; i < s.size(); ++i) {
+            int v = std::min({s[i - 1] + (word[i - 1] != c ? 1 : 0), s[i] + 1, out[i - 1] + 1});
+            out[i] = (uint8_t)std::min(v, (int)limit);
+        }
+    }
+
+    bool isMatch(const State& s) const { return s.back() < limit; }
+    bool canMatch(const State& s) const { return *std::min_element(s.begin(), s.end()) < limit; }
+};
+
+// Индекс триграмм словаря: для каждой триграммы — номера термов по
+// возрастанию (CSR: ключи, смещения, номера).
+class TermGramIndex {
+private:
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> ids;
+
+    static uint32_t pack(const char* p) {
+        return (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+    }
+
+public:
+    void build(const MappedIndex& dict) {
+        std::vector<uint64_t> pairs;
+        std::string s;
+        for (uint32_t i = 0; i < dict.termCount(); ++i) {
+            s = "$";
+            s += dict.termKey(*dict.termAt(i));
+            s += '$';
+            for (size_t j = 0; j + 3 <= s.size(); ++j) pairs.push_back((uint64_t)pack(&s[j]) << 32 | i);
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        ids.resize(pairs.size());
+        for (size_t j = 0; j < pairs.size(); ++j) {
+            uint32_t g = (uint32_t)(pairs[j] >> 32);
+            if (keys.empty() || keys.back() != g) {
+                keys.push_back(g);
+                offsets.push_back((uint32_t)j);
+            }
+            ids[j] = (uint32_t)pairs[j];
+        }
+        offsets.push_back((uint32_t)ids.size());
+    }
+
+    // Списки триграмм литеральных кусков шаблона. false — в шаблоне нет
+    // ни одной триграммы; пустой список в lists — совпадений нет.
+    bool lists(std::string_view pattern, std::vector<std::pair<const uint32_t*, const uint32_t*>>& out) const {
+        std::string s = "$";
+        s += pattern;
+        s += '$';
+        out.clear();
+        size_t from = 0;
+        while (from < s.size()) {
+            size_t to = s.find('*', from);
+            if (to == std::string::npos) to = s.size();
+            for (size_t j = from; j + 3 <= to; ++j) {
+                uint32_t g = pack(&s[j]);
+                auto it = std::lower_bound(keys.begin(), keys.end(), g);
+                if (it == keys.end() || *it != g) {
+                    out.assign(1, std::make_pair(ids.data(), ids.data()));
+                    return true;
+                }
+                size_t k = (size_t)(it - keys.begin());
+                out.push_back(std::make_pair(ids.data() + offsets[k], ids.data() + offsets[k + 1]));
+            }
+            from = to + 1;
+        }
+        return !out.empty();
+    }
+};
+
+class TermExpander {
+private:
+    // Диапазон префикса, который дешевле просмотреть, чем строить триграммы.
+    static const uint32_t RANGE_SCAN = 2048;
+
+    const MappedIndex& dict;
+    mutable std::once_flag grams_once;
+    mutable TermGramIndex grams;
+
+    std::string_view keyAt(uint32_t i) const { return dict.termKey(*dict.termAt(i)); }
+
+    uint32_t rangeEnd(std::string_view prefix) const {
+        std::string next = prefixSuccessor(prefix);
+        return next.empty() ? dict.termCount() : dict.lowerBound(next);
+    }
+
+public:
+    explicit TermExpander(const MappedIndex& d) : dict(d) {}
+    TermExpander(const TermExpander&) = delete;
+    TermExpander& operator=(const TermExpander&) = delete;
+
+    // Термы под шаблон с '*', по возрастанию.
+    void wildcard(std::string_view pattern, std::vector<std::string_view>& out) const {
+        std::string_view prefix = pattern.substr(0, pattern.find('*'));
+        uint32_t lo = prefix.empty() ? 0 : dict.lowerBound(prefix);
+        uint32_t hi = prefix.empty() ? dict.termCount() : rangeEnd(prefix);
+        if (prefix.size() == pattern.size()) {
+            if (lo < hi && keyAt(lo) == pattern) out.push_back(keyAt(lo));
+            return;
+        }
+
+        std::vector<std::pair<const uint32_t*, const uint32_t*>> lists;
+        if (hi - lo > RANGE_SCAN) {
+            std::call_once(grams_once, [this] { grams.build(dict); });
+            if (!grams.lists(pattern, lists)) lists.clear();
+        }
+        if (lists.empty()) {
+            for (uint32_t i = lo; i < hi; ++i) {
+                if (wildcardMatch(pattern, keyAt(i))) out.push_back(keyAt(i));
+            }
+            return;
+        }
+
+        std::sort(lists.begin(), lists.end(), [](const std::pair<const uint32_t*, const uint32_t*>& a,
+                                                 const std::pair<const uint32_t*, const uint32_t*>& b) {
+            return a.second - a.first < b.second - b.first;
+        });
+        for (const uint32_t* p = lists[0].first; p != lists[0].second; ++p) {
+            uint32_t id = *p;
+            if (id < lo || id >= hi) continue;
+            bool all = true;
+            for (size_t k = 1; k < lists.size() && all; ++k) {
+                lists[k].first = std::lower_bound(lists[k].first, lists[k].second, id);
+                all = lists[k].first != lists[k].second && *lists[k].first == id;
+            }
+            if (all && wildcardMatch(pattern, keyAt(id))) out.push_back(keyAt(id));
+        }
+    }
+
+    // Термы на расстоянии Левенштейна не больше max от term, по возрастанию.
+    void fuzzy(std::string_view term, uint32_t max, std::vector<std::string_view>& out) const {
+        LevenshteinAutomaton automaton(term, max);
+        std::vector<LevenshteinAutomaton::State> rows(1, automaton.start());
+        std::string_view prev;
+        size_t valid = 0;
+        uint32_t n = dict.termCount();
+        for (uint32_t i = 0; i < n;) {
+            std::string_view key = keyAt(i);
+            size_t depth = 0;
+            while (depth < valid && depth < key.size() && key[depth] == prev[depth]) ++depth;
+            if (rows.size() < key.size() + 1) rows.resize(key.size() + 1);
+            bool dead = false;
+            for (; depth < key.size(); ++depth) {
+                automaton.step(rows[depth], key[depth], rows[depth + 1]);
+                if (!automaton.canMatch(rows[depth + 1])) {
+                    dead = true;
+                    break;
+                }
+            }
+            prev = key;
+            valid = depth;
+            if (dead) {
+                // Ни один терм с префиксом key[0..depth] не подходит.
+                std::string next = prefixSuccessor(key.substr(0, depth + 1));
+                uint32_t j = next.empty() ? n : dict.lowerBound(next);
+                i = std::max(j, i + 1);
+                continue;
+            }
+            if (automaton.isMatch(rows[key.size()])) out.push_back(key);
+            ++i;
+        }
+    }
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define TEXT_TOKENIZER_X86 1
+#include <immintrin.h>
+#endif
+
+// Общий токенизатор для tokenizer, index_builder и search. Токен — максимальная
+// последовательность ASCII-букв и цифр (isalnum в локали "C"), приводится
+// к нижнему регистру; байты >= 0x80 и прочие символы — разделители.
+//
+// Ядро за один проход по 32 (AVX2) или 16 (SSE2) байт классифицирует
+// символы, приводит буквы к нижнему регистру прямо в регистре и пишет
+// битовую маску «байт входит в токен»; границы токенов затем ищутся по
+// маске через ctz. Без SSE2 (например, arm64) работает скалярная версия.
+
+static const size_t MIN_TOKEN_LENGTH = 2;
+
+// Буферы ядра, переиспользуются между вызовами.
+struct TokenScratch {
+    std::string lower;
+    std::vector<uint64_t> mask;
+    std::vector<uint32_t> starts, ends;
+};
+
+static inline bool isTokenChar(unsigned char c) {
+    unsigned char l = c | 0x20;
+    return (c >= '0' && c <= '9') || (l >= 'a' && l <= 'z');
+}
+
+// Байты [from, n): для не-x86 это весь текст, иначе — хвост короче вектора.
+static inline void tokenKernelScalar(const char* src, size_t from, size_t n, char* dst, uint64_t* mask) {
+    for (size_t i = from; i < n; ++i) {
+        unsigned char c = (unsigned char)src[i];
+        bool upper = c >= 'A' && c <= 'Z';
+        dst[i] = (char)(upper ? c | 0x20 : c);
+        if (isTokenChar(c)) mask[i >> 6] |= 1ull << (i & 63);
+    }
+}
+
+#ifdef TEXT_TOKENIZER_X86
+// Сравнения знаковые: байты >= 0x80 отрицательны и не попадают ни в один диапазон.
+static inline size_t tokenKernelSse2(const char* src, size_t n, char* dst, uint64_t* mask) {
+    const __m128i a1 = _mm_set1_epi8('A' - 1), z1 = _mm_set1_epi8('Z' + 1);
+    const __m128i la1 = _mm_set1_epi8('a' - 1), lz1 = _mm_set1_epi8('z' + 1);
+    const __m128i d1 = _mm_set1_epi8('0' - 1), d9 = _mm_set1_epi8('9' + 1);
+    const __m128i bit = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, a1), _mm_cmpgt_epi8(z1, v));
+        __m128i l = _mm_or_si128(v, _mm_and_si128(upper, bit));
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, la1), _mm_cmpgt_epi8(lz1, l));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, d1), _mm_cmpgt_epi8(d9, v));
+        _mm_storeu_si128((__m128i*)(dst + i), l);
+        uint64_t m = (uint32_t)_mm_movemask_epi8(_mm_or_si128(alpha, digit));
+        mask[i >> 6] |= m << (i & 63);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static inline size_t tokenKernelAvx2(const char* src, size_t n, char* dst, uint64_t* mask) {
+    const __m256i a1 = _mm256_set1_epi8('A' - 1), z1 = _mm256_set1_epi8('Z' + 1);
+    const __m256i la1 = _mm256_set1_epi8('a' - 1), lz1 = _mm256_set1_epi8('z' + 1);
+    const __m256i d1 = _mm256_set1_epi8('0' - 1), d9 = _mm256_set1_epi8('9' + 1);
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, a1), _mm256_cmpgt_epi8(z1, v));
+        __m256i l = _mm256_or_si256(v, _mm256_and_si256(upper, bit));
+        __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(l, la1), _mm256_cmpgt_epi8(lz1, l));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, d1), _mm256_cmpgt_epi8(d9, v));
+        _mm256_storeu_si256((__m256i*)(dst + i), l);
+        uint64_t m = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(alpha, digit));
+        mask[i >> 6] |= m << (i & 63);
+    }
+    return i;
+}
+
+static inline bool tokenHasAvx2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+#endif
+
+static inline const char* tokenKernelName() {
+#ifdef TEXT_TOKENIZER_X86
+    return tokenHasAvx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+// Пишет в scratch.lower текст в нижнем регистре, в scratch.mask — маску
+// символов токенов (бит i — байт i).
+static inline void classifyText(std::string_view text, TokenScratch& scratch) {
+    size_t n = text.size();
+    scratch.lower.resize(n);
+    scratch.mask.assign(n / 64 + 1, 0);
+    char* dst = &scratch.lower[0];
+    size_t done = 0;
+#ifdef TEXT_TOKENIZER_X86
+    done = tokenHasAvx2() ? tokenKernelAvx2(text.data(), n, dst, scratch.mask.data())
+                          : tokenKernelSse2(text.data(), n, dst, scratch.mask.data());
+#endif
+    tokenKernelScalar(text.data(), done, n, dst, scratch.mask.data());
+}
+
+// Границы токенов текста: токен i — байты [starts[i], ends[i]) в
+// scratch.lower. Возвращает число токенов (любой длины).
+static inline size_t tokenBounds(std::string_view text, TokenScratch& scratch) {
+    classifyText(text, scratch);
+    // Начало — переход 0->1 в маске, конец — переход 1->0. Бит
+    // text.size() всегда нулевой, поэтому у каждого начала есть конец.
+    size_t cap = text.size() / 2 + 1;
+    if (scratch.starts.size() < cap) {
+        scratch.starts.resize(cap);
+        scratch.ends.resize(cap);
+    }
+    uint32_t* sp = scratch.starts.data();
+    uint32_t* ep = scratch.ends.data();
+    uint64_t carry = 0;
+    for (size_t w = 0; w < scratch.mask.size(); ++w) {
+        uint64_t m = scratch.mask[w];
+        uint64_t prev = (m << 1) | carry;
+        carry = m >> 63;
+        uint32_t base = (uint32_t)(w * 64);
+        for (uint64_t b = m & ~prev; b; b &= b - 1) *sp++ = base + (uint32_t)__builtin_ctzll(b);
+        for (uint64_t b = ~m & prev; b; b &= b - 1) *ep++ = base + (uint32_t)__builtin_ctzll(b);
+    }
+    return (size_t)(sp - scratch.starts.data());
+}
+
+static inline std::string_view tokenAt(const TokenScratch& scratch, size_t i) {
+    return std::string_view(scratch.lower.data() + scratch.starts[i], scratch.ends[i] - scratch.starts[i]);
+}
+
+// Вызывает f(token) для каждого токена длиной не меньше min_len. token
+// указывает в scratch.lower и живёт до следующего вызова с этим scratch;
+// смещение токена в тексте — token.data() - scratch.lower.data().
+template <class F>
+static inline void forEachToken(std::string_view text, TokenScratch& scratch, F f,
+                                size_t min_len = MIN_TOKEN_LENGTH) {
+    size_t count = tokenBounds(text, scratch);
+    for (size_t i = 0; i < count; ++i) {
+        if (scratch.ends[i] - scratch.starts[i] >= min_len) f(tokenAt(scratch, i));
+    }
+}
+
+// Первая позиция не раньше pos, где не может продолжаться токен: по ней
+// большой текст можно резать на куски, не разрывая токены.
+static inline size_t tokenBoundary(std::string_view text, size_t pos) {
+    while (pos < text.size() && isTokenChar((unsigned char)text[pos])) ++pos;
+    return pos;
+}
@@ -3,136 +3,235 @@
 #include <vector>
 #include <algorithm>
 #include <cstring>
-#include <cctype>
+#include <cstdint>
+#include <climits>
+#include <cstdlib>
 #include <chrono>
 #include <cmath>
+#include <cerrno>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+#include "frequency_sketch.h"
+#include "mapped_file.h"
+#include "term_dictionary.h"
+#include "text_tokenizer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace std::chrono;
 
-struct HashNode {
-    char* word;
-    int frequency;
-    HashNode* next;
-};
-
 class FrequencyTable {
-    static const int TABLE_SIZE = 1000000;
-    HashNode** table;
+    TermDictionary<int> table;
     long long total_tokens;
     long long total_chars;
-    long long unique_words;
-
-    unsigned int hash(const char* str) {
-        unsigned int h = 5381;
-        int c;
-        while ((c = *str++)) {
-            h = ((h << 5) + h) + c;
-        }
-        return h % TABLE_SIZE;
-    }
 
 public:
-    FrequencyTable() : total_tokens(0), total_chars(0), unique_words(0) {
-        table = new HashNode*[TABLE_SIZE]();
-    }
-
-    ~FrequencyTable() {
-        for (int i = 0; i < TABLE_SIZE; ++i) {
-            HashNode* node = table[i];
-            while (node) {
-                HashNode* temp = node;
-                node = node->next;
-                free(temp->word);
-                delete temp;
-            }
-        }
-        delete[] table;
-    }
+    FrequencyTable() : total_tokens(0), total_chars(0) {}
 
-    void add(const string& w) {
+    void add(string_view w) {
         total_tokens++;
         total_chars += w.length();
-        
-        unsigned int h = hash(w.c_str());
-        HashNode* node = table[h];
-        
-        while (node) {
-            if (strcmp(node->word, w.c_str()) == 0) {
-                node->frequency++;
-                return;
-            }
-            node = node->next;
-        }
+        table[w]++;
+    }
 
-        unique_words++;
-        HashNode* newNode = new HashNode;
-        newNode->word = strdup(w.c_str());
-        newNode->frequency = 1;
-        newNode->next = table[h];
-        table[h] = newNode;
+    void mergeFrom(const FrequencyTable& other) {
+        total_tokens += other.total_tokens;
+        total_chars += other.total_chars;
+        for (uint32_t i = 0; i < other.table.size(); ++i) table[other.table.key(i)] += other.table.value(i);
     }
 
     long long getTotalTokens() const { return total_tokens; }
     long long getTotalChars() const { return total_chars; }
-    long long getUniqueWords() const { return unique_words; }
+    long long getUniqueWords() const { return (long long)table.size(); }
     double getAvgTokenLength() const { 
         return total_tokens > 0 ? (double)total_chars / total_tokens : 0.0; 
     }
 
+    // word указывает в таблицу и живёт, пока жива она.
     struct Entry {
-        string word;
+        string_view word;
         int freq;
     };
 
-    vector<Entry> getAllEntries() {
+    // Первые limit записей по убыванию частоты, при равной частоте — по
+    // алфавиту, чтобы порядок не зависел от таблицы и числа потоков.
+    // Если нужны не все записи, упорядочивается только их префикс.
+    vector<Entry> topEntries(size_t limit) const {
         vector<Entry> entries;
-        for (int i = 0; i < TABLE_SIZE; ++i) {
-            HashNode* node = table[i];
-            while (node) {
-                entries.push_back({node->word, node->frequency});
-                node = node->next;
-            }
+        entries.reserve(table.size());
+        for (uint32_t i = 0; i < table.size(); ++i) entries.push_back({table.key(i), table.value(i)});
+        auto before = [](const Entry& a, const Entry& b) {
+            return a.freq != b.freq ? a.freq > b.freq : a.word < b.word;
+        };
+        if (limit < entries.size()) {
+            partial_sort(entries.begin(), entries.begin() + limit, entries.end(), before);
+            entries.resize(limit);
+        } else {
+            sort(entries.begin(), entries.end(), before);
         }
         return entries;
     }
 };
 
-int main(int argc, char* argv[]) {
-    string input_file = "data/corpus.txt";
-    string output_file = "results/frequencies.csv";
-    
-    if (argc > 1) input_file = argv[1];
-    if (argc > 2) output_file = argv[2];
-    
-    freopen(input_file.c_str(), "r", stdin);
-    freopen(output_file.c_str(), "w", stdout);
-    freopen("results/stats.txt", "w", stderr);
-    
-    auto start_time = high_resolution_clock::now();
-    FrequencyTable ft;
-    string current;
-    long long input_bytes = 0;
-    
-    char c;
-    while (cin.get(c)) {
-        input_bytes++;
-        if (isalnum(static_cast<unsigned char>(c))) {
-            current += static_cast<char>(tolower(static_cast<unsigned char>(c)));
-        } else {
-            if (current.length() >= 2) {
-                ft.add(current);
-            }
-            current.clear();
+// Частоты в ограниченной памяти (--approx): уникальные слова оценивает
+// HyperLogLog, кандидатов в частые слова отбирает Space-Saving, а их
+// частоту — меньшая из оценок Space-Saving и Count-Min (обе не меньше
+// истинной). Всего токенов и средняя длина считаются точно.
+class ApproxFrequencyTable {
+    static const size_t SKETCH_WIDTH = 1 << 21;
+    static const size_t SKETCH_ROWS = 4;
+    static const unsigned HLL_PRECISION = 14;
+    // Space-Saving следит за большим числом слов, чем выводится: нижние
+    // счётчики структуры завышены сильнее всего.
+    static const size_t TRACK_FACTOR = 4;
+
+    CountMinSketch sketch;
+    SpaceSaving heavy;
+    HyperLogLog distinct;
+    long long total_tokens = 0;
+    long long total_chars = 0;
+
+public:
+    explicit ApproxFrequencyTable(size_t k)
+        : sketch(SKETCH_WIDTH, SKETCH_ROWS), heavy(k * TRACK_FACTOR), distinct(HLL_PRECISION) {}
+
+    void add(string_view w) {
+        total_tokens++;
+        total_chars += w.length();
+        uint64_t h = hashTerm(w);
+        sketch.add(h);
+        distinct.add(h);
+        heavy.add(w, h);
+    }
+
+    long long getTotalTokens() const { return total_tokens; }
+    long long getTotalChars() const { return total_chars; }
+    long long getUniqueWords() const { return llround(distinct.estimate()); }
+    double getAvgTokenLength() const {
+        return total_tokens > 0 ? (double)total_chars / total_tokens : 0.0;
+    }
+
+    typedef FrequencyTable::Entry Entry;
+
+    vector<Entry> topEntries(size_t limit) const {
+        vector<Entry> entries;
+        entries.reserve(heavy.size());
+        for (auto& c : heavy.entries()) {
+            uint64_t f = min<uint64_t>(c.count, sketch.estimate(hashTerm(c.word)));
+            entries.push_back({c.word, (int)min<uint64_t>(f, INT_MAX)});
         }
+        auto before = [](const Entry& a, const Entry& b) {
+            return a.freq != b.freq ? a.freq > b.freq : a.word < b.word;
+        };
+        limit = min(limit, entries.size());
+        partial_sort(entries.begin(), entries.begin() + limit, entries.end(), before);
+        entries.resize(limit);
+        return entries;
     }
-    
-    if (current.length() >= 2) {
-        ft.add(current);
+
+    void reportErrors(ostream& out) const {
+        out << "Приближённый подсчёт: Count-Min " << SKETCH_ROWS << " x " << SKETCH_WIDTH
+            << ", Space-Saving на " << heavy.size() << " слов, HyperLogLog 2^" << HLL_PRECISION << endl;
+        out << "Погрешность числа уникальных слов: ±" << distinct.standardError() * 100
+            << "% (стандартная ошибка)" << endl;
+        out << "Погрешность частот: завышение не больше " << (long long)ceil(sketch.errorBound(total_tokens))
+            << " с вероятностью " << (1 - sketch.failureProbability()) * 100 << "%" << endl;
+        out << "Все слова с частотой больше " << heavy.minCount() << " есть в списке" << endl;
+        out << "Память приближённых структур: "
+            << (sketch.memoryBytes() + heavy.memoryBytes() + distinct.memoryBytes()) / 1024 << " KB" << endl;
     }
-    
-    auto end_time = high_resolution_clock::now();
-    auto duration = duration_cast<milliseconds>(end_time - start_time);
+};
+
+// Считает токены text кусками по границам токенов; время ядра
+// токенизатора прибавляется к tokenize_sec.
+template <class Table>
+static void countText(string_view text, Table& table, TokenScratch& scratch, double& tokenize_sec) {
+    const size_t CHUNK = 1 << 20;
+    for (size_t pos = 0; pos < text.size();) {
+        size_t end = tokenBoundary(text, min(text.size(), pos + CHUNK));
+        auto t0 = high_resolution_clock::now();
+        size_t count = tokenBounds(text.substr(pos, end - pos), scratch);
+        tokenize_sec += duration<double>(high_resolution_clock::now() - t0).count();
+        for (size_t i = 0; i < count; ++i) {
+            string_view t = tokenAt(scratch, i);
+            if (t.size() >= MIN_TOKEN_LENGTH) table.add(t);
+        }
+        pos = end;
+    }
+}
+
+// Вход, который нельзя отобразить (канал, FIFO, /dev/stdin), читается
+// кусками через read(); хвост куска, в котором может продолжаться токен,
+// переносится в начало следующего. Память не зависит от размера входа.
+template <class Table>
+static bool countStream(int fd, Table& table, TokenScratch& scratch, double& tokenize_sec, long long& input_bytes) {
+    const size_t CHUNK = 1 << 20;
+    string buf;
+    size_t carry = 0;
+    for (;;) {
+        buf.resize(carry + CHUNK);
+        ssize_t n = read(fd, &buf[carry], CHUNK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        input_bytes += n;
+        size_t len = carry + (size_t)n;
+        size_t cut = len;
+        if (n > 0) {
+            while (cut > 0 && isTokenChar((unsigned char)buf[cut - 1])) --cut;
+        }
+        countText(string_view(buf.data(), cut), table, scratch, tokenize_sec);
+        carry = len - cut;
+        memmove(&buf[0], buf.data() + cut, carry);
+        if (n == 0) return true;
+    }
+}
+
+// Делит text на threads кусков по границам токенов, считает каждый в
+// своей таблице и сливает таблицы по порядку. tokenize_sec — время ядра
+// самого долгого потока.
+static void countParallel(string_view text, int threads, FrequencyTable& ft, double& tokenize_sec) {
+    vector<size_t> bounds(1, 0);
+    for (int t = 1; t < threads; ++t) {
+        bounds.push_back(tokenBoundary(text, max(bounds.back(), text.size() * t / threads)));
+    }
+    bounds.push_back(text.size());
+
+    vector<FrequencyTable> parts(threads);
+    vector<double> part_sec(threads, 0);
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            TokenScratch scratch;
+            countText(text.substr(bounds[t], bounds[t + 1] - bounds[t]), parts[t], scratch, part_sec[t]);
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    for (auto& p : parts) ft.mergeFrom(p);
+    tokenize_sec = *max_element(part_sec.begin(), part_sec.end());
+}
+
+static const size_t APPROX_DEFAULT_TOP = 50000;
+
+static void usage(const char* prog) {
+    cerr << "Использование: " << prog << " [--threads N | --approx] [--top K] [входной_файл] [frequencies.csv]" << endl;
+    cerr << "  --threads N  считать частоты в N потоков (результат тот же, что в одном)" << endl;
+    cerr << "  --top K      записать только K самых частых слов" << endl;
+    cerr << "  --approx     приближённый подсчёт в ограниченной памяти (по умолчанию --top "
+         << APPROX_DEFAULT_TOP << ")" << endl;
+}
+
+// Печать статистики и CSV по точной или приближённой таблице.
+template <class Table>
+static void writeResults(const Table& ft, long long input_bytes, double wall_sec, double tokenize_sec,
+                         int threads, size_t top) {
+    double tokenize_ms = tokenize_sec * 1000;
+    double wall_ms = wall_sec * 1000;
     
     cerr << "======= СТАТИСТИКА ТОКЕНИЗАЦИИ =======" << endl;
     cerr << "Общий объем данных: " << input_bytes << " байт (" 
@@ -140,27 +239,130 @@ int main(int argc, char* argv[]) {
     cerr << "Всего токенов: " << ft.getTotalTokens() << endl;
     cerr << "Уникальных слов: " << ft.getUniqueWords() << endl;
     cerr << "Средняя длина токена: " << ft.getAvgTokenLength() << " символов" << endl;
-    cerr << "Время выполнения: " << duration.count() << " мс" << endl;
+    cerr << "Время выполнения: " << (long long)wall_ms << " мс" << endl;
+    cerr << "Время токенизации: " << tokenize_ms << " мс (ядро " << tokenKernelName();
+    if (threads > 1) cerr << ", потоков: " << threads << ", по самому долгому";
+    cerr << ")" << endl;
     cerr << "Скорость обработки: " 
-         << (input_bytes > 0 ? (double)input_bytes / duration.count() : 0) 
+         << (wall_ms > 0 ? input_bytes / wall_ms : 0) 
          << " байт/мс" << endl;
     cerr << "Скорость обработки: " 
-         << (input_bytes > 0 ? (double)input_bytes / duration.count() / 1024 : 0) 
+         << (wall_ms > 0 ? input_bytes / wall_ms / 1024 : 0) 
          << " KB/мс" << endl;
     cerr << "Скорость токенизации: " 
-         << (ft.getTotalTokens() > 0 ? (double)ft.getTotalTokens() / duration.count() * 1000 : 0) 
+         << (wall_sec > 0 ? ft.getTotalTokens() / wall_sec : 0) 
          << " токенов/сек" << endl;
+    cerr << "Скорость ядра токенизатора: "
+         << (tokenize_sec > 0 ? input_bytes / tokenize_sec / 1048576 : 0) << " МБ/с, "
+         << (tokenize_sec > 0 ? ft.getTotalTokens() / tokenize_sec : 0) << " токенов/сек" << endl;
+    if constexpr (is_same<Table, ApproxFrequencyTable>::value) ft.reportErrors(cerr);
     cerr << "======================================" << endl;
     
-    auto entries = ft.getAllEntries();
-    sort(entries.begin(), entries.end(), [](const FrequencyTable::Entry& a, const FrequencyTable::Entry& b) {
-        return a.freq > b.freq;
-    });
+    auto entries = ft.topEntries(top);
     
     cout << "Rank,Frequency,Word" << endl;
     for (size_t i = 0; i < entries.size(); ++i) {
-        cout << i + 1 << "," << entries[i].freq << "," << entries[i].word << endl;
+        cout << i + 1 << "," << entries[i].freq << "," << entries[i].word << "\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string input_file = "data/corpus.txt";
+    string output_file = "results/frequencies.csv";
+    int threads = 1;
+    size_t top = SIZE_MAX;
+    bool approx = false;
+    vector<string> args;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads < 1) {
+                cerr << "Некорректное число потоков: " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (a == "--approx") approx = true;
+        else if (a == "--top" && i + 1 < argc) {
+            long long k = atoll(argv[++i]);
+            if (k < 1) {
+                cerr << "Некорректное число слов: " << argv[i] << endl;
+                return 1;
+            }
+            top = (size_t)k;
+        }
+        else if (a.rfind("--", 0) == 0 || args.size() == 2) {
+            usage(argv[0]);
+            return 1;
+        }
+        else args.push_back(a);
+    }
+    if (approx && threads > 1) {
+        cerr << "--approx поддерживается только в одном потоке" << endl;
+        return 1;
+    }
+    if (args.size() > 0) input_file = args[0];
+    if (args.size() > 1) output_file = args[1];
+    
+    // Обычный файл отображается в память и может делиться между потоками;
+    // остальные входы и любой вход --approx (неограниченный поток в
+    // ограниченной памяти) читаются кусками в одном потоке.
+    struct stat st;
+    if (stat(input_file.c_str(), &st) != 0) {
+        cerr << "Не удалось открыть входной файл: " << input_file << endl;
+        return 1;
+    }
+    bool streamed = approx || !S_ISREG(st.st_mode);
+    if (streamed && threads > 1) {
+        cerr << "--threads требует обычный файл, а не поток: " << input_file << endl;
+        return 1;
+    }
+    MappedFile input;
+    int fd = -1;
+    if (streamed ? (fd = open(input_file.c_str(), O_RDONLY)) < 0 : !input.open(input_file, true)) {
+        cerr << "Не удалось открыть входной файл: " << input_file << endl;
+        return 1;
+    }
+    freopen(output_file.c_str(), "w", stdout);
+    freopen("results/stats.txt", "w", stderr);
+    
+    // Вход режется на куски по границам токенов; границы токенов куска
+    // сначала находит ядро токенизатора, затем токены считаются в таблице.
+    auto start_time = high_resolution_clock::now();
+    string_view text(input.data(), input.size());
+    long long input_bytes = (long long)text.size();
+    double tokenize_sec = 0;
+    auto wallSec = [&]() { return duration<double>(high_resolution_clock::now() - start_time).count(); };
+    
+    if (approx) {
+        if (top == SIZE_MAX) top = APPROX_DEFAULT_TOP;
+        ApproxFrequencyTable at(top);
+        TokenScratch scratch;
+        if (!countStream(fd, at, scratch, tokenize_sec, input_bytes)) {
+            cerr << "Ошибка чтения входа: " << input_file << endl;
+            return 1;
+        }
+        close(fd);
+        writeResults(at, input_bytes, wallSec(), tokenize_sec, 1, top);
+        return 0;
     }
+
+    FrequencyTable ft;
+    if (streamed) {
+        TokenScratch scratch;
+        if (!countStream(fd, ft, scratch, tokenize_sec, input_bytes)) {
+            cerr << "Ошибка чтения входа: " << input_file << endl;
+            return 1;
+        }
+        close(fd);
+    } else if (threads > 1) {
+        countParallel(text, threads, ft, tokenize_sec);
+    } else {
+        TokenScratch scratch;
+        countText(text, ft, scratch, tokenize_sec);
+    }
+    
+    writeResults(ft, input_bytes, wallSec(), tokenize_sec, threads, top);
     
     return 0;
-}
\ No newline at end of file
+}
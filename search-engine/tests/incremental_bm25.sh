@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# BM25 по инкрементальному каталогу сегментов должен совпадать с BM25
+# индекса, заново построенного из того же дампа: df и средняя длина
+# документа считаются только по живым документам. Проверяется каталог
+# после обновления (с tombstones) и после --compact.
+# Запуск из каталога search-engine: ./tests/incremental_bm25.sh
+
+cd "$(dirname "$0")/.." || exit 1
+./compile.sh > /dev/null || { echo "Ошибка компиляции"; exit 1; }
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# Дамп из документов first..last; изменённые (id % changed == 0) получают
+# другой текст, а документы с id из [gap_from, gap_to) пропускаются.
+make_dump() {
+    awk -v first="$1" -v last="$2" -v changed="$3" -v gap_from="$4" -v gap_to="$5" 'BEGIN {
+        split("alpha beta gamma delta quake earthquake river stone", w, " ")
+        for (i = first; i <= last; ++i) {
+            if (i >= gap_from && i < gap_to) continue
+            print "==DOC_START=="
+            print "doc" i
+            print "==CONTENT_START=="
+            line = ""
+            n = 3 + (i * 7) % 23
+            for (j = 0; j < n; ++j) line = line " " w[1 + (i * 31 + j * j) % 8]
+            if (changed > 0 && i % changed == 0) line = line " quake quake stone update"
+            print line
+            print "==DOC_END=="
+        }
+    }' > "$6"
+}
+
+make_dump 0 399 0 0 0 "$tmp/v1.txt"
+make_dump 0 479 5 250 330 "$tmp/v2.txt"
+
+./bin/index_builder --incremental "$tmp/v1.txt" "$tmp/incdir" > /dev/null || exit 1
+./bin/index_builder --incremental "$tmp/v2.txt" "$tmp/incdir" > /dev/null || exit 1
+./bin/index_builder --binary "$tmp/v2.txt" "$tmp/full.idx" > /dev/null || exit 1
+
+# Пары "external_id score" всей выдачи, по external_id: doc_id у двух
+# индексов разные.
+scores() {
+    ./bin/search --index "$1" --top 1000 "$2" < /dev/null |
+        awk '/score:/ { s = $NF } /external_id:/ { print $2, s }' | sort
+}
+
+queries=("quake" "earthquake" "alpha" "quake stone" "update" "river OR delta" "beta AND NOT gamma")
+fail=0
+check() {
+    for q in "${queries[@]}"; do
+        a=$(scores "$tmp/incdir" "$q")
+        b=$(scores "$tmp/full.idx" "$q")
+        if [ -z "$b" ] || [ "$a" != "$b" ]; then
+            echo "РАСХОЖДЕНИЕ ($1): $q"
+            diff <(echo "$a") <(echo "$b") | head -5
+            fail=1
+        fi
+    done
+}
+
+check "после обновления"
+./bin/index_builder --compact "$tmp/incdir" > /dev/null || exit 1
+check "после --compact"
+
+if [ $fail -ne 0 ]; then
+    echo "FAIL"
+    exit 1
+fi
+echo "OK: BM25 инкрементального индекса совпадает с полным построением (${#queries[@]} запросов)"